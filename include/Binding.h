@@ -0,0 +1,277 @@
+#ifndef BINDING_H
+#define BINDING_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <list>
+#include <memory>
+#include <functional>
+#include <limits>
+#include <cmath>
+#include <type_traits>
+#include <utility>
+
+#include "Table.h"
+#include "Rope.h"
+#include "ExpressionParser.h"
+#include "InterpreterException.h"
+
+// 宿主程序与脚本之间的类型化调用。
+// ValueConverter<T> 在编译期为每种参数类型生成 Value 与 C++ 类型之间的转换:
+// 数字原样传递, 字符串和 rope 宿主视图尽量以 string_view 引用原数据,
+// 键为 "1".."n" 的表或列表字符串以 Span 的形式交给绑定函数。
+
+// 只读的连续区间
+template <typename T>
+class Span {
+public:
+    Span() = default;
+    Span(const T* data, size_t size) : ptr(data), count(size) {}
+    Span(const std::vector<std::remove_const_t<T>>& items) : ptr(items.data()), count(items.size()) {}
+
+    const T* data() const { return ptr; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+    const T& operator[](size_t index) const { return ptr[index]; }
+    const T* begin() const { return ptr; }
+    const T* end() const { return ptr + count; }
+
+private:
+    const T* ptr = nullptr;
+    size_t count = 0;
+};
+
+// 引用参数数据的类型只能作为绑定函数的参数, 不能作为返回给宿主的结果
+template <typename T>
+struct BorrowsData : std::false_type {};
+template <>
+struct BorrowsData<std::string_view> : std::true_type {};
+template <typename T>
+struct BorrowsData<Span<T>> : std::true_type {};
+
+// 一次调用期间转换出来的临时数据, 调用结束后释放; 用 list 保证元素地址不变
+struct BindingScratch {
+    std::list<std::string> strings;
+    std::list<std::vector<double>> numbers;
+    std::list<std::vector<std::string_view>> views;
+
+    const std::string& keep(std::string text) {
+        strings.push_back(std::move(text));
+        return strings.back();
+    }
+};
+
+namespace binding_detail {
+
+// 字符串直接引用, 只有一个片段的 rope 引用该片段, 其他值转换后保存在 scratch 里
+std::string_view viewOf(const Value& value, BindingScratch& scratch);
+double toDouble(const Value& value, int line);
+std::vector<std::string> splitList(std::string_view list);
+
+// 键为 "1".."n" 的表按顺序展开; 其他值按列表字符串拆分
+template <typename Visit>
+void forEachElement(const Value& value, BindingScratch& scratch, int line, Visit&& visit) {
+    if (const auto* table = std::get_if<std::shared_ptr<Table>>(&value)) {
+        const auto& fields = (*table)->fields;
+        for (size_t i = 1; i <= fields.size(); i++) {
+            auto it = fields.find(std::to_string(i));
+            if (it == fields.end()) {
+                throw RuntimeError("expected array table with keys 1.." + std::to_string(fields.size()), line);
+            }
+            visit(it->second);
+        }
+        return;
+    }
+    for (auto& element : splitList(viewOf(value, scratch))) {
+        visit(Value(std::move(element)));
+    }
+}
+
+} // namespace binding_detail
+
+template <typename T, typename Enable = void>
+struct ValueConverter;
+
+template <>
+struct ValueConverter<Value> {
+    static const Value& from(const Value& value, BindingScratch&, int) { return value; }
+    static Value to(Value value) { return value; }
+};
+
+template <typename T>
+struct ValueConverter<T, std::enable_if_t<std::is_arithmetic_v<T> && !std::is_same_v<T, bool>>> {
+    static T from(const Value& value, BindingScratch&, int line) {
+        double number = binding_detail::toDouble(value, line);
+        if constexpr (std::is_integral_v<T>) {
+            // max() 转成 double 会舍入到 2^digits, 所以用精确可表示的 2^digits 作为开区间上界;
+            // 有符号类型的 min() 恰好是 -2^digits, 可以取到
+            const double limit = std::ldexp(1.0, std::numeric_limits<T>::digits);
+            const double lowest = std::is_signed_v<T> ? -limit : 0.0;
+            if (number != std::floor(number) || number < lowest || number >= limit) {
+                throw RuntimeError("expected integer but got \"" + ExpressionParser::valueToString(value) + "\"",
+                                   line);
+            }
+        }
+        return static_cast<T>(number);
+    }
+    static Value to(T value) { return static_cast<double>(value); }
+};
+
+template <>
+struct ValueConverter<bool> {
+    static bool from(const Value& value, BindingScratch&, int line) {
+        if (const auto* flag = std::get_if<bool>(&value)) return *flag;
+        double number;
+        if (ExpressionParser::toNumber(value, number)) return number != 0.0;
+        const auto* word = std::get_if<std::string>(&value);
+        std::string_view text = word ? std::string_view(*word) : std::string_view();
+        if (text == "true" || text == "yes" || text == "on") return true;
+        if (text == "false" || text == "no" || text == "off") return false;
+        throw RuntimeError("expected boolean value but got \"" + ExpressionParser::valueToString(value) + "\"", line);
+    }
+    static Value to(bool value) { return value; }
+};
+
+template <>
+struct ValueConverter<std::string> {
+    static const std::string& from(const Value& value, BindingScratch& scratch, int) {
+        if (const auto* text = std::get_if<std::string>(&value)) return *text;
+        return scratch.keep(ExpressionParser::valueToString(value));
+    }
+    static Value to(std::string value) { return value; }
+};
+
+template <>
+struct ValueConverter<std::string_view> {
+    static std::string_view from(const Value& value, BindingScratch& scratch, int) {
+        return binding_detail::viewOf(value, scratch);
+    }
+    static Value to(std::string_view value) { return std::string(value); }
+};
+
+template <>
+struct ValueConverter<std::shared_ptr<Rope>> {
+    static Value to(std::shared_ptr<Rope> value) { return value; }
+};
+
+template <>
+struct ValueConverter<const char*> {
+    static Value to(const char* value) { return std::string(value); }
+};
+
+template <>
+struct ValueConverter<std::shared_ptr<Table>> {
+    static std::shared_ptr<Table> from(const Value& value, BindingScratch&, int line) {
+        if (const auto* table = std::get_if<std::shared_ptr<Table>>(&value)) return *table;
+        throw RuntimeError("expected table but got \"" + ExpressionParser::valueToString(value) + "\"", line);
+    }
+    static Value to(std::shared_ptr<Table> value) { return value; }
+};
+
+template <>
+struct ValueConverter<Span<const double>> {
+    static Span<const double> from(const Value& value, BindingScratch& scratch, int line) {
+        scratch.numbers.emplace_back();
+        auto& numbers = scratch.numbers.back();
+        binding_detail::forEachElement(value, scratch, line, [&](const Value& element) {
+            numbers.push_back(binding_detail::toDouble(element, line));
+        });
+        return numbers;
+    }
+    static Value to(Span<const double> values) {
+        auto table = std::make_shared<Table>();
+        for (size_t i = 0; i < values.size(); i++) table->set(std::to_string(i + 1), values[i]);
+        return table;
+    }
+};
+
+template <>
+struct ValueConverter<Span<const std::string_view>> {
+    static Span<const std::string_view> from(const Value& value, BindingScratch& scratch, int line) {
+        scratch.views.emplace_back();
+        auto& views = scratch.views.back();
+        // 表中的字符串直接引用, 列表拆出的元素先保存在 scratch 里
+        if (std::holds_alternative<std::shared_ptr<Table>>(value)) {
+            binding_detail::forEachElement(value, scratch, line, [&](const Value& element) {
+                views.push_back(binding_detail::viewOf(element, scratch));
+            });
+        } else {
+            binding_detail::forEachElement(value, scratch, line, [&](const Value& element) {
+                views.push_back(scratch.keep(std::get<std::string>(element)));
+            });
+        }
+        return views;
+    }
+    static Value to(Span<const std::string_view> values) {
+        auto table = std::make_shared<Table>();
+        for (size_t i = 0; i < values.size(); i++) table->set(std::to_string(i + 1), std::string(values[i]));
+        return table;
+    }
+};
+
+template <typename T>
+struct FunctionSignature : FunctionSignature<decltype(&T::operator())> {};
+
+template <typename R, typename... Args>
+struct FunctionSignature<R (*)(Args...)> {
+    using type = R(Args...);
+};
+
+template <typename R, typename... Args>
+struct FunctionSignature<R(Args...)> {
+    using type = R(Args...);
+};
+
+template <typename C, typename R, typename... Args>
+struct FunctionSignature<R (C::*)(Args...)> {
+    using type = R(Args...);
+};
+
+template <typename C, typename R, typename... Args>
+struct FunctionSignature<R (C::*)(Args...) const> {
+    using type = R(Args...);
+};
+
+class Binding {
+public:
+    // 绑定到脚本的原生命令, line 为调用所在的行号
+    using NativeCommand = std::function<Value(const std::vector<Value>& args, int line)>;
+
+    template <typename F>
+    static NativeCommand wrap(const std::string& name, F fn) {
+        using Signature = typename FunctionSignature<std::decay_t<F>>::type;
+        return wrapSignature(name, std::move(fn), static_cast<Signature*>(nullptr));
+    }
+
+    template <typename T>
+    static Value toValue(T&& value) {
+        return ValueConverter<std::decay_t<T>>::to(std::forward<T>(value));
+    }
+
+private:
+    template <typename F, typename R, typename... Args>
+    static NativeCommand wrapSignature(const std::string& name, F fn, R (*)(Args...)) {
+        return [name, fn = std::move(fn)](const std::vector<Value>& args, int line) -> Value {
+            if (args.size() != sizeof...(Args)) {
+                std::string usage = name;
+                for (size_t i = 0; i < sizeof...(Args); i++) usage += " arg";
+                throw RuntimeError("wrong # args: should be \"" + usage + "\"", line);
+            }
+            return invoke<R, Args...>(fn, args, line, std::index_sequence_for<Args...>{});
+        };
+    }
+
+    template <typename R, typename... Args, typename F, size_t... I>
+    static Value invoke(const F& fn, const std::vector<Value>& args, int line, std::index_sequence<I...>) {
+        BindingScratch scratch;
+        if constexpr (std::is_void_v<R>) {
+            fn(ValueConverter<std::decay_t<Args>>::from(args[I], scratch, line)...);
+            return std::string();
+        } else {
+            return toValue(fn(ValueConverter<std::decay_t<Args>>::from(args[I], scratch, line)...));
+        }
+    }
+};
+
+#endif // BINDING_H
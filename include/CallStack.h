@@ -6,27 +6,86 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <memory>
 #include "Table.h"
 
+// 闭包捕获的变量 (upvalue)。
+// 外层帧还在执行时指向帧里的局部变量, 多个闭包和外层帧共享同一个存储;
+// 外层帧退出时把值搬进单元自身, 之后由捕获它的闭包继续共享
+class UpvalueCell {
+public:
+    explicit UpvalueCell(Value* slot) : location(slot) {}
+    // 已经关闭的单元, 从镜像恢复闭包时使用
+    explicit UpvalueCell(Value value) : location(&closed), closed(std::move(value)) {}
+    UpvalueCell(const UpvalueCell&) = delete;
+    UpvalueCell& operator=(const UpvalueCell&) = delete;
+    
+    Value& value() { return *location; }
+    bool isOpen() const { return location != &closed; }
+    
+    void close() {
+        if (!isOpen()) return;
+        closed = std::move(*location);
+        location = &closed;
+    }
+    
+private:
+    Value* location;
+    Value closed;
+};
+
+// 一个过程捕获的全部 upvalue, 按索引访问; 过程和它的每次调用帧共享同一份
+struct Upvalues {
+    std::vector<std::string> names;
+    std::vector<std::shared_ptr<UpvalueCell>> cells;
+    
+    int indexOf(const std::string& name) const {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (names[i] == name) return static_cast<int>(i);
+        }
+        return -1;
+    }
+};
+
 struct StackFrame {
     std::string function;
     int line;
     std::map<std::string, Value> locals;
+    std::shared_ptr<const Upvalues> upvalues;                          // 本次调用可见的 upvalue
+    std::map<std::string, std::shared_ptr<UpvalueCell>> openUpvalues;  // 本帧被闭包捕获的局部变量
 };
 
+class MemoryAccount;
+
 class CallStack {
 private:
     std::stack<StackFrame> frames;
+    MemoryAccount* account;
+    
+    void assign(UpvalueCell& cell, const Value& value);
     
 public:
-    void push(const std::string& func, int line);
+    explicit CallStack(MemoryAccount* account = nullptr) : account(account) {}
+    
+    void push(const std::string& func, int line, std::shared_ptr<const Upvalues> upvalues = nullptr);
     void pop();
     StackFrame& top();
     void setLocal(const std::string& name, const Value& value);
     Value getLocal(const std::string& name) const;
+    const Value* findLocal(const std::string& name) const;
+    Value* findLocal(const std::string& name);
+    
+    // 按索引访问当前帧的 upvalue, 索引在过程体编译时由名字解析得到 (见 SubstTemplate);
+    // 当前帧没有这个 upvalue 时返回 nullptr 或 false, 调用方再按名字查找
+    const Value* findUpvalue(int index) const;
+    bool setUpvalue(int index, const Value& value);
+    
+    // 当前帧中名为 name 的局部变量或 upvalue 的共享单元, 不存在时返回 nullptr
+    std::shared_ptr<UpvalueCell> capture(const std::string& name);
+    
     std::vector<StackFrame> getFrames() const;
     bool empty() const;
+    size_t depth() const { return frames.size(); }
 };
 
 #endif // CALL_STACK_H
-
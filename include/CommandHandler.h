@@ -13,15 +13,51 @@
 #include "VariableManager.h"
 #include "ExpressionParser.h"
 #include "CallStack.h"
+#include "GlobPattern.h"
+#include "LruCache.h"
+#include "Regex.h"
+#include "SwitchTable.h"
+#include "MemoryAccount.h"
+#include "Optimizer.h"
+#include "Binding.h"
+#include "ModuleRegistry.h"
 
 class CommandHandler {
 private:
     struct Procedure {
         std::vector<std::string> parameters;
         std::string body;
-        std::map<std::string, Value> capturedVars; // 闭包捕获的变量
+        std::shared_ptr<Rope> mappedBody;          // 从镜像恢复的长过程体, 直接引用映射的页面, 此时 body 为空
+        std::shared_ptr<const Upvalues> upvalues; // 闭包捕获的变量, 与外层帧共享同一组单元
+        mutable size_t codeBytes = 0;              // 计入内存账户的大小
+        std::string ns;                            // 过程所属的命名空间
+        // 单独编译的过程体: 闭包在定义时编译, 捕获变量已解析为 upvalue 索引;
+        // 映射的过程体在第一次调用时才编译, 之前不占用堆内存
+        mutable std::shared_ptr<const CompiledScript> compiled;
+        
+        std::string_view text() const {
+            std::string_view mapped;
+            if (mappedBody && mappedBody->flat(mapped)) return mapped;
+            return body;
+        }
     };
     
+    // 本解释器中的模块: 编译结果与其他解释器共享, 模块体在首次使用导出的名字时才执行
+    struct ModuleInstance {
+        enum State { PENDING, LOADING, LOADED };
+        std::shared_ptr<const ModuleRegistry::Module> module; // 只声明了命名空间时为空
+        State state = PENDING;
+    };
+    
+    // return 命令沿调用链抛到 executeProcedure
+    struct ProcedureReturn {
+        Value value;
+    };
+    
+    // break/continue 沿调用链抛到最近的循环
+    struct LoopBreak {};
+    struct LoopContinue {};
+    
     struct DebugInfo {
         bool breakpointsEnabled = false;
         std::map<int, std::string> breakpoints; // 行号 -> 条件
@@ -38,50 +74,141 @@ private:
     DebugInfo debugInfo;
     int currentLine = -1;
     CallStack& callStack;
+    MemoryAccount& memory;
     
-    std::map<std::string, Procedure> procedures;
+    std::map<std::string, std::shared_ptr<const Procedure>> procedures;
+    std::map<std::string, Binding::NativeCommand> nativeCommands; // 宿主程序绑定的命令
     std::map<std::string, std::shared_ptr<Table>> classes;
     std::stack<TryCatchBlock> tryStack;
     std::stack<std::string> loopStack;
+    std::map<std::string, ModuleInstance> modules;
+    std::map<std::string, std::string> importedCommands; // import 引入的短名 -> 限定名
+    
+    // 编译后的 glob 模式, string match 与 switch -glob 共用
+    LruCache<std::string, std::shared_ptr<const GlobPattern>> globCache{256};
+    
+    // 编译后的正则表达式, 以标志和模式为键
+    LruCache<std::string, std::shared_ptr<Regex>> regexCache{128};
+    
+    // 编译后的 switch 分支表。分支是常量单词时以单词本身为键, 条目持有单词保证地址不被复用;
+    // 分支由替换生成时以匹配方式和分支文本为键。两者占用的内存计入 CODE
+    struct SwitchEntry {
+        std::shared_ptr<const SubstTemplate> arms;
+        SwitchTable::Mode mode;
+        std::shared_ptr<const SwitchTable> table;
+    };
+    LruCache<const SubstTemplate*, SwitchEntry> switchCache{128};
+    LruCache<std::string, std::shared_ptr<const SwitchTable>> switchTextCache{64};
+    size_t switchCacheBytes = 0;
+    
+    // 过程体中出现的标识符, 定义闭包时用来确定要捕获哪些变量
+    LruCache<std::string, std::shared_ptr<const std::vector<std::string>>> bodyNamesCache{256};
+    
+    // if/while/for 的执行计划, -O1 起按参数文本缓存
+    LruCache<std::string, std::shared_ptr<const Optimizer::IfPlan>> ifPlanCache{256};
+    LruCache<std::string, std::shared_ptr<const Optimizer::LoopPlan>> loopPlanCache{128};
+    
+    std::function<Value(const std::string&, bool)> scriptEvaluator;
+    std::function<Value(const CompiledScript&, bool)> compiledEvaluator;
+    
+    // 当前命令是否是过程体的最后一条 (或 if/switch 在这个位置选中的分支的最后一条),
+    // 这个位置上的 return 直接返回值, 不必抛出异常
+    bool tailPosition = false;
+    
+    // 正在分派的命令编译后的单词, 由 executeCommand 取走, 只对直接由它执行的命令有效
+    const CompiledCommand* commandWords = nullptr;
     
 public:
-    CommandHandler(VariableManager& vm, ExpressionParser& ep, CallStack& cs) 
-        : varManager(vm), exprParser(ep), callStack(cs) {}
+    CommandHandler(VariableManager& vm, ExpressionParser& ep, CallStack& cs, MemoryAccount& memory) 
+        : varManager(vm), exprParser(ep), callStack(cs), memory(memory) {
+        varManager.setModuleLoader([this](const std::string& ns) { return loadModule(ns); });
+    }
     
     void setLineNumber(int line) { currentLine = line; }
+    void setTailPosition(bool tail) { tailPosition = tail; }
+    void setCommandWords(const CompiledCommand* words) { commandWords = words; }
+    // tail 为 true 时脚本的最后一条命令处于过程的尾部位置
+    void setScriptEvaluator(std::function<Value(const std::string&, bool tail)> evaluator) {
+        scriptEvaluator = std::move(evaluator);
+    }
+    // 执行编译好的模块体和闭包过程体, tail 的含义同上
+    void setCompiledEvaluator(std::function<Value(const CompiledScript&, bool tail)> evaluator) {
+        compiledEvaluator = std::move(evaluator);
+    }
+    
+    // 切换优化级别时丢弃按旧级别生成的执行计划
+    void resetPlans() {
+        ifPlanCache.clear();
+        loopPlanCache.clear();
+    }
     
-    Value executeCommand(const std::string& cmd, const std::vector<std::string>& args);
+    Value executeCommand(const std::string& cmd, const std::vector<Value>& args);
+    
+    // 注册宿主命令, 同名的过程被替换
+    void registerCommand(const std::string& name, Binding::NativeCommand command);
+    
+    // 镜像: 过程 (连同闭包共享的单元), 类, 全局变量, 模块状态和导入的短名写入 image 的各个部分;
+    // 宿主绑定的命令不保存, 恢复后由宿主重新绑定
+    void exportState(Table& image) const;
+    // 与当前状态合并, 同名的过程, 变量和类被替换
+    void importState(const Table& image);
+    
+    // 过程或宿主命令是否存在
+    bool hasCommand(const std::string& name) const {
+        return procedures.count(name) || nativeCommands.count(name);
+    }
     
 private:
     bool shouldBreak();
-    void enterDebugMode(const std::string& cmd, const std::vector<std::string>& args);
+    void enterDebugMode(const std::string& cmd, const std::vector<Value>& args);
     void handleDebugCommand(const std::string& cmd);
     void printBacktrace();
     void printVariables(const std::string& filter);
     
-    Value handleSet(const std::vector<std::string>& args);
-    Value handleExpr(const std::vector<std::string>& args);
-    Value handlePuts(const std::vector<std::string>& args);
-    Value handleProc(const std::vector<std::string>& args);
-    Value handleIf(const std::vector<std::string>& args);
-    Value handleFor(const std::vector<std::string>& args);
-    Value handleIncr(const std::vector<std::string>& args);
-    Value handleReturn(const std::vector<std::string>& args);
-    Value handleString(const std::vector<std::string>& args);
-    Value handleWhile(const std::vector<std::string>& args);
-    Value handleSwitch(const std::vector<std::string>& args);
-    Value handleClass(const std::vector<std::string>& args);
-    Value handleNew(const std::vector<std::string>& args);
-    Value handleSetMetatable(const std::vector<std::string>& args);
-    Value handleTry(const std::vector<std::string>& args);
-    Value handleTable(const std::vector<std::string>& args);
-    Value handleBreakpoint(const std::vector<std::string>& args);
-    Value handleStep(const std::vector<std::string>& args);
-    Value handleMath(const std::vector<std::string>& args);
-    Value handleFile(const std::vector<std::string>& args);
-    Value handleModule(const std::vector<std::string>& args);
-    Value handleImport(const std::vector<std::string>& args);
-    Value executeProcedure(const std::string& name, const std::vector<std::string>& args);
+    Value evalScript(const std::string& script, bool tail = false);
+    std::shared_ptr<const GlobPattern> globPattern(const std::string& pattern, bool nocase);
+    std::shared_ptr<Regex> regex(const std::string& pattern, bool nocase);
+    
+    Value handleSet(const std::vector<Value>& args, const CompiledCommand* words);
+    Value handleExpr(const std::vector<Value>& args);
+    Value handlePuts(const std::vector<Value>& args);
+    Value handleProc(const std::vector<Value>& args);
+    Value handleIf(const std::vector<Value>& args);
+    Value handleFor(const std::vector<Value>& args);
+    Value handleIncr(const std::vector<Value>& args, const CompiledCommand* words);
+    Value handleReturn(const std::vector<Value>& args);
+    Value handleString(const std::vector<Value>& args);
+    Value handleAppend(const std::vector<Value>& args);
+    void appendInPlace(Value& slot, const std::vector<Value>& args, size_t added);
+    Value handleSplit(const std::vector<Value>& args);
+    Value handleRegexp(const std::vector<Value>& args);
+    Value handleRegsub(const std::vector<Value>& args);
+    Value handleWhile(const std::vector<Value>& args);
+    Value handleLoopControl(const std::string& cmd, const std::vector<Value>& args);
+    std::shared_ptr<const Optimizer::LoopPlan> loopPlan(const std::string& test, const std::string& next,
+                                                        const std::string& body, bool isFor);
+    Value runLoop(const Optimizer::LoopPlan& plan);
+    bool loopTest(const Optimizer::LoopPlan& plan);
+    void loopNext(const Optimizer::LoopPlan& plan);
+    Value handleSwitch(const std::vector<Value>& args, const CompiledCommand* words);
+    std::shared_ptr<const SwitchTable> compileSwitch(const std::vector<std::string>& arms, SwitchTable::Mode mode);
+    Value handleClass(const std::vector<Value>& args);
+    Value handleNew(const std::vector<Value>& args);
+    Value handleSetMetatable(const std::vector<Value>& args);
+    Value handleTry(const std::vector<Value>& args);
+    Value handleTable(const std::vector<Value>& args);
+    Value handleBreakpoint(const std::vector<Value>& args);
+    Value handleStep(const std::vector<Value>& args);
+    Value handleMath(const std::vector<Value>& args);
+    Value handleFile(const std::vector<Value>& args);
+    Value handleModule(const std::vector<Value>& args);
+    Value handleMemory(const std::vector<Value>& args);
+    Value handleImport(const std::vector<Value>& args);
+    // 执行命名空间 ns 对应的模块体; 模块不存在, 已执行或正在执行时返回 false
+    bool loadModule(const std::string& ns);
+    Value executeProcedure(const std::string& name, const std::vector<Value>& args);
+    void defineProcedure(const std::string& name, std::shared_ptr<Procedure> proc);
+    std::shared_ptr<const CompiledScript> compileBody(const Procedure& proc) const;
 };
 
 #endif // COMMAND_HANDLER_H
@@ -0,0 +1,35 @@
+#ifndef COMPILED_SCRIPT_H
+#define COMPILED_SCRIPT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "SubstTemplate.h"
+
+// 一行命令编译后的结果: 每个单词一个替换模板
+struct CompiledCommand {
+    std::vector<std::shared_ptr<const SubstTemplate>> words;
+    size_t codeBytes = 0;
+    
+    // upvalues 不为空时命令属于这个闭包的过程体, 见 SubstTemplate::compile
+    static std::shared_ptr<const CompiledCommand> compile(const std::string& line, int lineNumber = -1,
+                                                          const Upvalues* upvalues = nullptr);
+};
+
+// 脚本按完整命令拆分后的结果, 记录每条命令相对脚本开头的行号。
+// 编译结果不可变, 同一份可以被多个解释器执行
+struct CompiledScript {
+    using CommandCompiler = std::function<std::shared_ptr<const CompiledCommand>(const std::string&)>;
+    
+    std::vector<std::pair<int, std::shared_ptr<const CompiledCommand>>> commands;
+    size_t codeBytes = 0;
+    
+    // compileCommand 负责编译单条命令, 解释器借此复用自己的命令缓存
+    static std::shared_ptr<const CompiledScript> compile(const std::string& script,
+                                                         const CommandCompiler& compileCommand);
+    static std::shared_ptr<const CompiledScript> compile(const std::string& script);
+};
+
+#endif // COMPILED_SCRIPT_H
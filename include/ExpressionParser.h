@@ -6,57 +6,137 @@
 #include <variant>
 #include <memory>
 #include <unordered_map>
+#include <unordered_set>
 #include <stack>
 #include <functional>
 
 #include "Table.h"
 #include "VariableManager.h"
 #include "InterpreterException.h"
+#include "SubstTemplate.h"
+#include "LruCache.h"
 
+// 表达式求值。
+// 表达式先编译成语法树再求值, 按优化级别:
+//   -O0  每次求值都重新解析, 不做任何优化
+//   -O1  语法树按表达式文本缓存, 编译时折叠常量子表达式
+//   -O2  另外在循环执行期间缓存不变的子表达式 (循环不变量外提),
+//        并把 "变量 比较 常数" 融合成一个节点
 class ExpressionParser {
+public:
+    enum Op {
+        OR, AND, BIT_OR, BIT_XOR, BIT_AND, STR_EQ, STR_NE, EQ, NE, LT, GT, LE, GE,
+        SHL, SHR, ADD, SUB, MUL, DIV, MOD, POW, NEG, PLUS, NOT, BIT_NOT
+    };
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node : std::enable_shared_from_this<Node> {
+        enum Kind { CONSTANT, VARIABLE, TEMPLATE, COMMAND, UNARY, BINARY, TERNARY, FUNCTION, COMPARE_VAR_CONST };
+
+        Kind kind;
+        Op op = ADD;
+        Value constant;                              // CONSTANT; COMPARE_VAR_CONST 的右操作数
+        std::string text;                            // 变量名, 命令脚本或函数名
+        int symbol = -1;                             // 限定变量名的符号编号, 见 ModuleRegistry
+        std::shared_ptr<const SubstTemplate> word;   // TEMPLATE: 带替换的引号字符串
+        std::vector<NodePtr> operands;
+        std::vector<std::string> variables;          // 子树读取的变量, 排序去重
+        bool pure = true;                            // 子树中没有命令替换
+        bool hoistable = false;                      // 可以作为循环不变量缓存
+    };
+
+    // 循环执行期间的作用域: written 是循环体可能写入的变量,
+    // 只读取其他变量且没有命令替换的子表达式在这期间只求值一次。
+    // written 为 nullptr 表示循环体无法分析, 不做缓存
+    class LoopScope {
+    public:
+        LoopScope(ExpressionParser& parser, const std::unordered_set<std::string>* written);
+        ~LoopScope();
+        LoopScope(const LoopScope&) = delete;
+        LoopScope& operator=(const LoopScope&) = delete;
+    private:
+        ExpressionParser& parser;
+    };
+
 private:
     VariableManager& varManager;
     int currentLine = -1;
-    
+    int optimizationLevel = 2;
+    std::function<Value(const std::string&)> commandEvaluator;
+
     enum TokenType { NUMBER, OPERATOR, VARIABLE, STRING, BRACE, BRACKET, END, IDENTIFIER };
-    
+
     struct Token {
         TokenType type;
         std::string value;
         double numValue = 0.0;
     };
-    
+
     std::vector<Token> tokens;
     size_t currentToken = 0;
-    
-    std::unordered_map<std::string, int> opPrecedence = {
-        {"||", 1}, {"&&", 2},
-        {"==", 3}, {"!=", 3}, {"<", 4}, {">", 4}, {"<=", 4}, {">=", 4},
-        {"|", 5}, {"^", 6}, {"&", 7},
-        {"<<", 8}, {">>", 8},
-        {"+", 9}, {"-", 9},
-        {"*", 10}, {"/", 10}, {"%", 10},
-        {"!", 11}, {"~", 11},
-        {"^", 12}
+
+    LruCache<std::string, NodePtr> compiledCache{1024};
+
+    struct HoistedValue {
+        NodePtr node;    // 保持节点存活, 避免地址被复用
+        bool invariant;
+        Value value;
+    };
+
+    struct LoopFrame {
+        const std::unordered_set<std::string>* written;
+        std::unordered_map<const Node*, HoistedValue> hoisted;
     };
-    
+
+    std::vector<LoopFrame> loops;
+
     void tokenizeExpression(const std::string& expr);
-    
+
     const Token& peek() const;
     Token consume();
-    
-    Value parsePrimary();
-    Value parseExpression(int precedence = 0);
-    
-    Value applyUnaryOp(const std::string& op, const Value& operand);
-    Value applyBinaryOp(const std::string& op, const Value& left, const Value& right);
-    bool isTruthy(const Value& val) const;
-    
+    bool peekOperator(const char* op) const;
+    void expectOperator(const char* op);
+
+    NodePtr parseTernary();
+    NodePtr parseExpression(int precedence);
+    NodePtr parseUnary();
+    NodePtr parsePrimary();
+
+    NodePtr makeConstant(Value value) const;
+    NodePtr makeWord(const std::string& word) const;
+    NodePtr makeUnary(Op op, NodePtr operand) const;
+    NodePtr makeBinary(Op op, NodePtr left, NodePtr right) const;
+    NodePtr makeTernary(NodePtr condition, NodePtr whenTrue, NodePtr whenFalse) const;
+    NodePtr makeFunction(const std::string& name, std::vector<NodePtr> args) const;
+    NodePtr parse(const std::string& expr);
+
+    Value eval(const Node& node);
+    Value evalUncached(const Node& node);
+    Value applyUnaryOp(Op op, const Value& operand) const;
+    Value applyBinaryOp(Op op, const Value& left, const Value& right) const;
+    Value applyFunction(const std::string& name, const std::vector<Value>& args) const;
+
 public:
     ExpressionParser(VariableManager& vm) : varManager(vm) {}
-    
+
+    void setCommandEvaluator(std::function<Value(const std::string&)> evaluator) {
+        commandEvaluator = std::move(evaluator);
+    }
+    void setOptimizationLevel(int level);
+    int getOptimizationLevel() const { return optimizationLevel; }
+
     Value evaluate(const std::string& expr, int line = -1);
-    
+
+    // 编译表达式; -O1 及以上时结果按文本缓存
+    NodePtr compile(const std::string& expr);
+    Value evaluate(const NodePtr& expr, int line = -1);
+
+    bool isTruthy(const Value& val) const;
+    static bool toNumber(const Value& value, double& number);
+    static bool compareNumbers(Op op, double left, double right);
+
     static std::string valueToString(const Value& value);
 };
 
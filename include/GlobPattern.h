@@ -0,0 +1,39 @@
+#ifndef GLOB_PATTERN_H
+#define GLOB_PATTERN_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bitset>
+
+// 编译后的 glob 模式 (*, ?, [a-z], \x)。
+// 模式只解析一次; 匹配时星号后面的字面量用向量化查找直接定位
+class GlobPattern {
+public:
+    GlobPattern(const std::string& pattern, bool nocase = false);
+    
+    bool matches(std::string_view text) const;
+    
+    // 模式开头的字面量部分, 以及整个模式是否就是一个字面量
+    const std::string& literalPrefix() const { return prefix; }
+    bool isLiteral() const { return literal; }
+    
+private:
+    enum TokenKind { LITERAL, ANY_CHAR, ANY_SEQUENCE, CHAR_CLASS };
+    
+    struct Token {
+        TokenKind kind;
+        std::string text;          // LITERAL
+        std::bitset<256> chars;    // CHAR_CLASS
+    };
+    
+    std::vector<Token> tokens;
+    std::string prefix;
+    bool literal = true;
+    bool nocase;
+    
+    bool literalAt(const Token& token, std::string_view text, size_t pos) const;
+    size_t nextCandidate(size_t tokenIndex, std::string_view text, size_t pos) const;
+};
+
+#endif // GLOB_PATTERN_H
@@ -0,0 +1,25 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <string>
+#include <memory>
+
+#include "Table.h"
+
+// 解释器状态的镜像文件, 用于跳过启动脚本直接恢复一个初始化好的解释器。
+// 格式: "TCLUAIMG" 版本号, 之后是 TableCodec 二进制编码的根表 (各部分的内容见 Tclua::saveImage)。
+// 编码中只有长度和编号, 没有指针, 文件可以映射到任何地址。
+// 读取时以只读方式 mmap 整个文件, 长字符串解码为直接引用映射页面的 rope 视图,
+// 同一主机上恢复同一镜像的多个进程共享这些页面; 其余内容解码到各自的堆上。
+class Image {
+public:
+    // 不小于这个长度的字符串在恢复后引用映射的页面
+    static const size_t BORROW_BYTES = 256;
+
+    // 先写同一目录下名字唯一的临时文件, 落盘后再改名;
+    // 正在映射旧镜像的进程和同时写同一镜像的其他进程都不受影响
+    static void write(const std::string& path, const Value& root);
+    static std::shared_ptr<Table> read(const std::string& path);
+};
+
+#endif // IMAGE_H
@@ -30,4 +30,10 @@ public:
     virtual std::string fullMessage() const override;
 };
 
+// 超过解释器的内存限制, 和其他运行时错误一样可以被脚本捕获
+class MemoryLimitError : public RuntimeError {
+public:
+    MemoryLimitError(const std::string& msg, int ln = -1);
+};
+
 #endif // INTERPRETER_EXCEPTION_H
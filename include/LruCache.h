@@ -0,0 +1,57 @@
+#ifndef LRU_CACHE_H
+#define LRU_CACHE_H
+
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+// 容量有限的最近最少使用缓存, 用于缓存编译后的模式等
+template <typename Key, typename Value>
+class LruCache {
+private:
+    using Entry = std::pair<Key, Value>;
+    
+    size_t capacity;
+    std::list<Entry> entries; // 表头为最近使用
+    std::unordered_map<Key, typename std::list<Entry>::iterator> index;
+    
+public:
+    explicit LruCache(size_t cap) : capacity(cap) {}
+    
+    // 未命中时返回 nullptr
+    const Value* find(const Key& key) {
+        auto it = index.find(key);
+        if (it == index.end()) return nullptr;
+        entries.splice(entries.begin(), entries, it->second);
+        return &it->second->second;
+    }
+    
+    const Value& insert(const Key& key, Value value) {
+        auto it = index.find(key);
+        if (it != index.end()) {
+            it->second->second = std::move(value);
+            entries.splice(entries.begin(), entries, it->second);
+            return it->second->second;
+        }
+        if (entries.size() >= capacity && !entries.empty()) {
+            index.erase(entries.back().first);
+            entries.pop_back();
+        }
+        entries.emplace_front(key, std::move(value));
+        index[key] = entries.begin();
+        return entries.front().second;
+    }
+    
+    // 未命中时调用 make 构造并插入
+    template <typename Factory>
+    const Value& getOrCreate(const Key& key, Factory&& make) {
+        if (const Value* cached = find(key)) return *cached;
+        return insert(key, make());
+    }
+    
+    size_t size() const { return entries.size(); }
+    bool full() const { return entries.size() >= capacity; }
+    void clear() { entries.clear(); index.clear(); }
+};
+
+#endif // LRU_CACHE_H
@@ -0,0 +1,96 @@
+#ifndef MEMORY_ACCOUNT_H
+#define MEMORY_ACCOUNT_H
+
+#include <string>
+#include <memory>
+
+#include "Table.h"
+
+// 一个解释器的内存账户。
+// 表, 变量和字段中的字符串, 调用帧以及编译后的代码在创建或增长之前记账,
+// 释放时退账; 计数器只是普通整数, 单线程使用, 可以在生产环境中一直开启。
+// 软限制: 越过时抛出一次可捕获的错误, 用量回落到限制的 90% 以下后重新生效,
+// 撤销失败操作时退还的少量内存不会让它立即再次触发;
+// 硬限制: 任何会越过它的分配都被拒绝并抛出错误。两种情况下触发错误的操作都不会生效。
+// try 捕获错误后在一段有上限的预留空间内运行处理程序, 见 Reserve。
+class MemoryAccount : public std::enable_shared_from_this<MemoryAccount> {
+public:
+    enum Category { TABLES, STRINGS, FRAMES, CODE };
+    static const int CATEGORY_COUNT = 4;
+    
+    struct Stats {
+        size_t used[CATEGORY_COUNT] = {0, 0, 0, 0};
+        size_t total = 0;
+        size_t peak = 0;
+        size_t softLimit = 0;
+        size_t hardLimit = 0;
+    };
+    
+    static const char* categoryName(Category category);
+    
+    // 0 表示不限制
+    void setLimits(size_t softLimit, size_t hardLimit);
+    Stats stats() const;
+    
+    void charge(Category category, size_t bytes);
+    void release(Category category, size_t bytes);
+    
+    // 即将分配一个临时的大对象 (之后才会存入变量): 只检查硬限制, 不记账
+    void check(size_t bytes) const;
+    
+    // 硬限制之前还能分配的字节数, 不限制时为 SIZE_MAX
+    size_t headroom() const;
+    
+    // 用量已经越过硬限制时抛出错误
+    void enforce() const;
+    
+    // 操作完成后按实际大小修正记账; 调用方保证多出的部分不超过 headroom()
+    void adjust(Category category, size_t expected, size_t actual);
+    
+    // 当前线程正在执行脚本的解释器的账户; 没有脚本在执行时为 nullptr, 此时创建的表不记账
+    static MemoryAccount* current();
+    
+    class Scope {
+    public:
+        explicit Scope(MemoryAccount* account);
+        ~Scope();
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    private:
+        MemoryAccount* previous;
+    };
+    
+    // 作用域内硬限制临时放宽 RESERVE_BYTES, 软限制不再触发。
+    // try 用它执行捕获之后的全部工作 (绑定 catch 变量, 编译和执行处理程序, 调用过程时压入的帧),
+    // 否则刚捕获的限制错误会在处理时再次抛出; 嵌套时不再叠加
+    static const size_t RESERVE_BYTES = 64 * 1024;
+    
+    class Reserve {
+    public:
+        explicit Reserve(MemoryAccount& account);
+        ~Reserve();
+        Reserve(const Reserve&) = delete;
+        Reserve& operator=(const Reserve&) = delete;
+    private:
+        MemoryAccount& account;
+        size_t previous;
+    };
+    
+    // 值本身持有的堆内存, 表另外记账不计在内; rope 按长度计
+    static size_t footprint(const Value& value);
+    static size_t footprint(const std::string& text);
+    
+    // std::map 中一个 string -> Value 节点的大小 (不含键和值的堆内存)
+    static const size_t MAP_NODE_BYTES = 4 * sizeof(void*) + sizeof(std::string) + sizeof(Value);
+    
+private:
+    Stats usage;
+    bool softTripped = false;
+    size_t reserve = 0;
+    
+    size_t ceiling() const { return usage.hardLimit + reserve; }
+    
+    std::string describe(size_t bytes) const;
+};
+
+#endif // MEMORY_ACCOUNT_H
@@ -0,0 +1,64 @@
+#ifndef MODULE_REGISTRY_H
+#define MODULE_REGISTRY_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+#include "CompiledScript.h"
+
+// 进程内共享的模块注册表。
+// import 按搜索路径查找 <dir>/<name>.tcl (名字中的 :: 对应子目录), 每个模块在进程内
+// 只读取和编译一次, 编译结果不可变, 由进程中所有解释器共享; 每个解释器在首次使用模块的
+// 导出符号时才执行模块体。
+// 限定名 ns::name 在编译期被登记为进程内唯一的符号编号, 解释器按编号直接定位变量槽。
+class ModuleRegistry {
+public:
+    struct Module {
+        std::string name;
+        std::string path;                         // 内联定义的模块为空
+        std::string source;                       // 保存镜像时记录尚未执行的模块
+        std::shared_ptr<const CompiledScript> body;
+        std::vector<std::string> procs;           // 模块体顶层定义的过程, 不含命名空间前缀
+        std::vector<std::string> variables;       // 模块体顶层设置的变量
+        bool eager = false;                       // 导出的名字无法静态确定, 导入时立即执行
+    };
+
+    static ModuleRegistry& instance();
+
+    // 搜索路径, 初始值取自环境变量 TCLUA_PATH (以 ':' 分隔), 未设置时为当前目录。
+    // 路径对进程内所有解释器生效, 只能由宿主程序 (Tclua::addModulePath) 修改, 脚本只能查询
+    std::vector<std::string> searchPath() const;
+    void addSearchPath(const std::string& dir);
+
+    // 模块名由 :: 分隔的非空段组成, 段中不能有路径分隔符, 也不能是 . 或 ..,
+    // 保证拼出的文件路径不会离开搜索路径中的目录
+    static bool isValidName(const std::string& name);
+
+    // 查找并编译模块, 找不到或名字无效时返回 nullptr
+    std::shared_ptr<const Module> find(const std::string& name);
+
+    // 编译内联定义的模块, 不进入注册表
+    static std::shared_ptr<const Module> compile(const std::string& name, const std::string& source,
+                                                 const std::string& path = "");
+
+    // 限定名的符号编号, 同一个名字在进程内总是得到同一个编号
+    static int symbol(const std::string& qualifiedName);
+    static std::string symbolName(int symbol);
+
+    // ns::name 拆分为命名空间和名字, 不是限定名时返回 false
+    static bool splitQualified(const std::string& name, std::string& ns, std::string& tail);
+
+private:
+    ModuleRegistry();
+
+    mutable std::mutex mutex;
+    std::vector<std::string> paths;
+    std::map<std::string, std::shared_ptr<const Module>> modules;
+};
+
+#endif // MODULE_REGISTRY_H
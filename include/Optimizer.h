@@ -0,0 +1,68 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_set>
+
+#include "ExpressionParser.h"
+
+// 控制结构的优化: 把 if/while/for 的参数预先整理成执行计划, 由 CommandHandler 缓存并执行。
+//   -O0  计划每次重新生成, 条件按文本求值
+//   -O1  条件编译成语法树并折叠常量, 条件为常量的分支在生成计划时删除
+//   -O2  分析循环体写入的变量, 循环期间缓存不变的子表达式;
+//        for 的 "incr 计数器" 与 "$计数器 比较 上界" 融合为一条超级指令
+class Optimizer {
+public:
+    // 一段脚本可能写入的变量; opaque 表示无法分析 (调用了过程或变量名是动态的)
+    struct Effects {
+        std::unordered_set<std::string> written;
+        bool opaque = false;
+    };
+
+    struct IfPlan {
+        struct Clause {
+            std::string condition;
+            ExpressionParser::NodePtr compiled; // -O0 时为空
+            std::string body;
+        };
+        std::vector<Clause> clauses;
+        bool hasElse = false;
+        std::string elseBody;
+    };
+
+    struct LoopPlan {
+        std::string test;
+        ExpressionParser::NodePtr compiled;     // -O0 时为空
+        std::string next;                       // 只有 for 有
+        std::string body;
+        bool isFor = false;
+        std::shared_ptr<const std::unordered_set<std::string>> written; // 为空表示不做外提
+
+        // 融合的 incr/比较/跳转
+        bool fused = false;
+        std::string counter;
+        double step = 1.0;
+        ExpressionParser::Op compare = ExpressionParser::LT;
+        ExpressionParser::NodePtr bound;
+    };
+
+    static Effects analyze(const std::string& script);
+
+    // words 为 if 的全部参数
+    static std::shared_ptr<const IfPlan> planIf(const std::vector<std::string>& words, ExpressionParser& parser,
+                                                int line);
+    static std::shared_ptr<const LoopPlan> planLoop(const std::string& test, const std::string& next,
+                                                    const std::string& body, bool isFor, ExpressionParser& parser);
+
+private:
+    static void analyzeScript(const std::string& script, Effects& effects);
+    static void analyzeCommand(const std::vector<std::string>& words, Effects& effects);
+    static void analyzeBody(const std::string& word, Effects& effects);
+    static void analyzeExpression(const std::string& word, Effects& effects);
+    static void analyzeSubstitutions(const std::string& word, Effects& effects);
+    static void addWritten(const std::string& word, Effects& effects);
+};
+
+#endif // OPTIMIZER_H
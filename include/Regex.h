@@ -0,0 +1,117 @@
+#ifndef REGEX_H
+#define REGEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <bitset>
+#include <map>
+#include <memory>
+#include <utility>
+#include <cstdint>
+
+// 正则表达式引擎。
+// 模式编译成一段 Thompson 式的指令程序:
+//   - 只需判断是否匹配时, 在程序上按需构建 DFA (lazy DFA) 线性扫描;
+//   - 需要子匹配位置时, 先由正向 DFA 求出最左匹配的终点, 再由反向程序的 DFA 从终点
+//     往回求出起点, 最后只在 [起点, 终点] 上运行带访问位图的回溯执行器,
+//     每个 (指令, 位置) 最多访问一次。
+// 模式以字面量开头时, 用向量化的子串查找跳过不可能匹配的输入。
+class Regex {
+public:
+    static const int NOCASE = 1;
+
+    // 每个分组的 [起点, 终点), 未参与匹配的分组为 (-1, -1)
+    using Captures = std::vector<std::pair<long long, long long>>;
+
+    Regex(const std::string& pattern, int flags = 0);
+
+    size_t groupCount() const { return groups; }
+
+    bool search(std::string_view text, size_t start = 0);
+    bool exec(std::string_view text, size_t start, Captures& captures);
+
+private:
+    enum Op { CHAR, CLASS, ANY, SPLIT, JMP, SAVE, BOL, EOL, WORD_BOUNDARY, NOT_WORD_BOUNDARY, MATCH };
+
+    struct Inst {
+        Op op;
+        int x = 0;
+        int y = 0;
+    };
+
+    struct Node;
+
+    // DFA 状态是按优先级排列的线程 (指令位置) 列表, 出现 MATCH 后优先级更低的线程被丢弃,
+    // 因此正向扫描越过第一次接受后继续前进, 最后一次接受的位置就是最左优先匹配的终点。
+    // RESTART 表示还没有找到匹配, 下一个位置可以开始新的匹配 (非锚定搜索), 总是排在最后
+    static constexpr int RESTART = -1;
+
+    struct DfaState {
+        std::vector<int> pcs;
+        bool accepting = false;
+        bool halts = false;  // 接受或死状态, 快速路径必须停下检查
+        int next[256];
+    };
+
+    // 一段指令程序和在它上面按需构建的 DFA;
+    // leftmostFirst 为 false 时不丢弃 MATCH 之后的线程, 用于求最长匹配
+    struct Dfa {
+        const std::vector<Inst>* program = nullptr;
+        bool leftmostFirst = true;
+        std::vector<DfaState> states;
+        std::map<std::vector<int>, int> index;
+        int startAtBol = -1;
+        int start = -1;
+        unsigned flushes = 0;
+        std::vector<unsigned> closureMark;
+        unsigned closureGeneration = 0;
+    };
+
+    static const size_t MAX_DFA_STATES = 2048;
+
+    std::string pattern;
+    int flags;
+    size_t groups = 0;
+    std::vector<Inst> program;
+    std::vector<Inst> reverseProgram;  // 从右往左匹配的程序, 不含分组
+    std::vector<std::bitset<256>> classes;
+    std::string prefix;        // 所有匹配都必须以它开头
+    bool anchored = false;     // 以 ^ 开头
+    bool dfaSupported = true;  // 含单词边界断言时只能回溯
+
+    Dfa forward;
+    Dfa reverse;
+    std::vector<uint64_t> backtrackBitmap;
+
+    // 解析
+    std::unique_ptr<Node> parseAlternation(size_t& pos);
+    std::unique_ptr<Node> parseConcat(size_t& pos);
+    std::unique_ptr<Node> parseRepeat(size_t& pos);
+    std::unique_ptr<Node> parseAtom(size_t& pos);
+    std::unique_ptr<Node> parseBracket(size_t& pos);
+    std::unique_ptr<Node> literalNode(unsigned char c);
+    int addClass(std::bitset<256> chars);
+    void extractPrefix(const Node& root);
+
+    // 生成指令; reversed 时按从右往左的顺序生成, ^ 与 $ 互换
+    static int emit(std::vector<Inst>& out, Op op, int x = 0, int y = 0);
+    void compileNode(const Node& node, std::vector<Inst>& out, bool reversed);
+
+    // 执行
+    bool consumes(const Inst& inst, unsigned char c) const;
+    std::vector<int> closure(Dfa& dfa, const std::vector<int>& seeds, bool atStart, bool atEnd);
+    static bool containsMatch(const Dfa& dfa, const std::vector<int>& pcs);
+    int dfaState(Dfa& dfa, std::vector<int> pcs);
+    int dfaNext(Dfa& dfa, int state, unsigned char c);
+    void dfaStarts(Dfa& dfa, const std::vector<int>& seeds);
+    bool reachesMatchAtEnd(Dfa& dfa, int state, bool atStart);
+    // matchEnd 为空时找到匹配即返回, 否则继续扫描求出最左优先匹配的终点
+    bool dfaSearch(std::string_view text, size_t start, size_t* matchEnd = nullptr);
+    // 从 end 往回扫描到 start, 返回以 end 结束的最长匹配的起点
+    size_t dfaMatchStart(std::string_view text, size_t start, size_t end);
+    // 依次尝试 [first, last] 中的起点, 超过 limit 的位置视为失败
+    bool backtrack(std::string_view text, size_t first, size_t last, size_t limit, Captures& captures);
+};
+
+#endif // REGEX_H
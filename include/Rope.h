@@ -0,0 +1,82 @@
+#ifndef ROPE_H
+#define ROPE_H
+
+#include <string>
+#include <memory>
+#include <ostream>
+#include <string_view>
+#include <functional>
+
+// 用于大字符串拼接的绳索(rope)类型。
+// 已完成的部分保存在不可变的平衡树中, 可以在多个值之间共享;
+// 末尾有一个可变的构建缓冲区, append 只写入缓冲区, 满一块后才并入树中。
+// 只有在调用方需要连续内存时才通过 str() 展开为普通字符串。
+// 叶子也可以直接引用宿主程序的只读缓冲区 (见 view), 切片时继续共享这块内存。
+class Rope {
+public:
+    static const size_t LEAF_SIZE = 4096;
+
+    Rope() = default;
+    explicit Rope(const std::string& text);
+
+    // 不复制地包装宿主缓冲区; owner 保持缓冲区存活, 为空时由调用方保证
+    // 缓冲区比引用它的所有值活得更久
+    static Rope view(std::string_view data, std::shared_ptr<const void> owner = nullptr);
+
+    size_t length() const { return (root ? root->length : 0) + tail.length(); }
+    
+    // 由 rope 自己分配的字节数, 不含引用的宿主缓冲区
+    size_t ownedLength() const { return (root ? root->owned : 0) + tail.length(); }
+    
+    // 内容只有一个连续片段时返回它, 否则返回 false
+    bool flat(std::string_view& out) const;
+
+    char at(size_t index) const;                          // O(log n)
+    Rope slice(size_t start, size_t count) const;         // O(log n), 与原串共享节点
+    std::string substr(size_t start, size_t count) const; // O(log n + count)
+
+    void append(const std::string& text);
+    void append(const Rope& other);
+
+    std::string str() const;
+    void appendTo(std::string& out) const;
+    void write(std::ostream& os) const;
+    
+    // 按顺序访问每个连续片段, 不展开整个字符串
+    void visitChunks(const std::function<void(std::string_view)>& visit) const;
+
+private:
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    struct Node {
+        NodePtr left;
+        NodePtr right;
+        std::string leaf;
+        std::string_view external;           // 引用宿主缓冲区的叶子
+        std::shared_ptr<const void> owner;
+        bool borrowed = false;
+        size_t length = 0;
+        size_t owned = 0;
+        int depth = 0;
+        
+        std::string_view text() const { return borrowed ? external : std::string_view(leaf); }
+    };
+
+    NodePtr root;
+    std::string tail; // 可变的构建缓冲区
+
+    static NodePtr makeLeaf(std::string text);
+    static NodePtr makeView(std::string_view text, const std::shared_ptr<const void>& owner);
+    static NodePtr makeNode(const NodePtr& left, const NodePtr& right);
+    static NodePtr build(const std::string& text, size_t start, size_t count);
+    static NodePtr join(const NodePtr& left, const NodePtr& right);
+    static NodePtr balance(const NodePtr& left, const NodePtr& right);
+    static NodePtr slice(const NodePtr& node, size_t start, size_t count);
+    static int depthOf(const NodePtr& node) { return node ? node->depth : -1; }
+
+    void flushTail();
+    template <typename Visitor> void forEachChunk(Visitor&& visit) const;
+};
+
+#endif // ROPE_H
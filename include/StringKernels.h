@@ -0,0 +1,53 @@
+#ifndef STRING_KERNELS_H
+#define STRING_KERNELS_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <utility>
+#include <cstdint>
+
+// 字符串热点操作的向量化实现。
+// 运行时检测 CPU, 依次选择 AVX2, SSE4.2 或标量实现, 三者结果完全一致。
+class StringKernels {
+public:
+    static const size_t npos = std::string::npos;
+
+    // 字符集合, 用于 split/trim 以及 map 的候选首字符
+    class CharSet {
+    public:
+        explicit CharSet(std::string_view chars, bool nocase = false);
+
+        bool contains(unsigned char c) const { return (bits[c >> 6] >> (c & 63)) & 1; }
+        const std::string& chars() const { return list; }
+
+    private:
+        uint64_t bits[4] = {0, 0, 0, 0};
+        std::string list; // 去重后的字符, 向量化比较时使用
+    };
+
+    static const CharSet& whitespace();
+
+    // 子串查找, 语义与 std::string_view::find / rfind 相同
+    static size_t find(std::string_view haystack, std::string_view needle, size_t from = 0);
+    static size_t rfind(std::string_view haystack, std::string_view needle, size_t before = npos);
+
+    static size_t findFirstOf(std::string_view text, const CharSet& set, size_t from = 0);
+    static size_t findFirstNotOf(std::string_view text, const CharSet& set, size_t from = 0);
+    static size_t findLastNotOf(std::string_view text, const CharSet& set);
+
+    static std::vector<std::string> split(std::string_view text, const CharSet& set);
+    static std::string_view trim(std::string_view text, const CharSet& set, bool left, bool right);
+
+    // string map: 在每个位置按顺序尝试各个键, 命中后跳过整个键
+    static std::string map(std::string_view text,
+                           const std::vector<std::pair<std::string, std::string>>& mapping,
+                           bool nocase = false);
+
+    // JSON 字符串内容中第一个引号, 反斜杠, 控制字符或非 ASCII 字节的位置
+    static size_t scanJsonString(std::string_view text, size_t from = 0);
+    
+    static const char* isaName();
+};
+
+#endif // STRING_KERNELS_H
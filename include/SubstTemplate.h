@@ -0,0 +1,61 @@
+#ifndef SUBST_TEMPLATE_H
+#define SUBST_TEMPLATE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "Table.h"
+#include "VariableManager.h"
+
+// 预编译的替换模板: 一个单词只扫描一次 $ 和 [,
+// 拆分为字面量段与变量/命令槽, 之后每次执行只做渲染
+class SubstTemplate {
+public:
+    enum SegmentKind { LITERAL, VARIABLE, COMMAND };
+
+    struct Segment {
+        SegmentKind kind;
+        std::string text; // 字面量内容, 变量名或命令脚本
+        int symbol = -1;  // 限定变量名 ns::name 的符号编号, 见 ModuleRegistry
+        int upvalue = -1; // 闭包过程体中捕获变量的 upvalue 索引, 见 CallStack::findUpvalue
+    };
+
+    using CommandEvaluator = std::function<Value(const std::string&)>;
+
+    // upvalues 不为空时单词属于这个闭包的过程体, 引用捕获变量的槽在编译期解析为索引
+    static std::shared_ptr<const SubstTemplate> compile(const std::string& word, const Upvalues* upvalues = nullptr);
+
+    // 没有任何替换的单词在编译期就变成共享的常量字符串
+    bool isConstant() const { return constant != nullptr; }
+    const std::shared_ptr<const std::string>& constantValue() const { return constant; }
+    // 常量单词是捕获变量的名字时 (如 set/incr 的变量名参数) 对应的 upvalue 索引, 否则为 -1
+    int constantUpvalue() const { return upvalue; }
+    const std::vector<Segment>& getSegments() const { return segments; }
+
+    std::string render(const VariableManager& vars, const CommandEvaluator& evalCommand,
+                       int line = -1) const;
+    
+    // 与 render 相同, 但只由一个槽组成的单词直接返回槽中的值,
+    // 表和 rope 等值不会被转换成字符串
+    Value evaluate(const VariableManager& vars, const CommandEvaluator& evalCommand,
+                   int line = -1) const;
+
+    // 模板占用的内存, 计入解释器的编译代码用量
+    size_t memoryUsage() const;
+
+private:
+    std::vector<Segment> segments;
+    size_t literalLength = 0;
+    size_t slotCount = 0;
+    bool hasCommands = false;
+    std::shared_ptr<const std::string> constant;
+    int upvalue = -1;
+
+    void addLiteral(std::string& pending);
+    void addVariable(std::string name);
+    void parse(const std::string& text, size_t begin, size_t end, bool backslashes);
+};
+
+#endif // SUBST_TEMPLATE_H
@@ -0,0 +1,57 @@
+#ifndef SWITCH_TABLE_H
+#define SWITCH_TABLE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+
+#include "GlobPattern.h"
+
+// 编译后的 switch 分支表。
+// 字面量分支放入以分支文本为键的哈希表, 一次哈希和一次比较即可选中分支;
+// glob 分支按字面量前缀分组, 只测试前缀与主体相符的分支。
+// 选择分支的代价与分支数量无关, 也不分配内存。
+class SwitchTable {
+public:
+    enum Mode { EXACT, GLOB };
+    
+    // 由调用者提供编译好的 glob 模式, 以便与其它命令共用模式缓存
+    using GlobFactory = std::function<std::shared_ptr<const GlobPattern>(const std::string&)>;
+    
+    // arms 为 pattern body pattern body ... 形式, GLOB 模式下每个分支模式都经由 makeGlob 编译
+    SwitchTable(const std::vector<std::string>& arms, Mode mode, const GlobFactory& makeGlob);
+    
+    SwitchTable(const SwitchTable&) = delete;
+    SwitchTable& operator=(const SwitchTable&) = delete;
+    
+    // 返回要执行的分支主体 ("-" 穿透已经解析), 没有分支匹配时返回 nullptr
+    const std::string* select(std::string_view subject) const;
+    
+    // 分支表占用的内存, 计入解释器的编译代码用量
+    size_t memoryUsage() const { return codeBytes; }
+    
+private:
+    std::vector<std::string> patterns;
+    std::vector<std::string> bodies;  // 每个分支最终执行的主体
+    int defaultArm = -1;
+    
+    // 字面量分支, 键指向 patterns 或 unescaped 中的文本
+    std::vector<std::string> unescaped; // 含转义的 glob 字面量去掉转义后的文本
+    std::unordered_map<std::string_view, int> literals;
+    
+    // glob 分支, 键指向 globs 中模式的字面量前缀; 每组内按分支编号升序
+    std::vector<std::shared_ptr<const GlobPattern>> globs;
+    std::unordered_map<std::string_view, std::vector<int>> globsByPrefix;
+    std::vector<size_t> prefixLengths;
+    std::vector<int> unprefixedGlobs;
+    
+    size_t codeBytes = 0;
+    
+    // 在按编号升序的分支中找第一个编号小于 chosen 且匹配主体的分支
+    int firstMatch(const std::vector<int>& arms, std::string_view subject, int chosen) const;
+};
+
+#endif // SWITCH_TABLE_H
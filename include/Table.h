@@ -2,24 +2,34 @@
 #define TABLE_H
 
 #include <map>
+#include <string>
 #include <vector>
 #include <memory>
 #include <variant>
 #include <functional>
-#include "Table.h"
+#include "Rope.h"
 
-using Value = std::variant<double, std::string, bool, std::nullptr_t, std::shared_ptr<class Table>>;
+using Value = std::variant<double, std::string, bool, std::nullptr_t, std::shared_ptr<class Table>,
+                           std::shared_ptr<Rope>>;
 
 class Table;
+class MemoryAccount;
 
 class Table : public std::enable_shared_from_this<Table> {
 public:
+    // 字段应通过 set 修改, 这样才会计入所属解释器的内存账户
     std::map<std::string, Value> fields;
     std::shared_ptr<Table> metatable;
     
+    Table();
+    Table(const Table& other);
+    Table& operator=(const Table&) = delete;
+    ~Table();
+    
     bool contains(const std::string& key) const;
     Value get(const std::string& key, int line = -1) const;
     void set(const std::string& key, const Value& value);
+    void set(std::string&& key, Value&& value);
     
     std::vector<std::string> keys() const;
     std::vector<Value> values() const;
@@ -27,6 +37,11 @@ public:
     void sort(const std::function<bool(const Value&, const Value&)>& comparator);
     Table filter(const std::function<bool(const std::string&, const Value&)>& predicate) const;
     Table map(const std::function<Value(const std::string&, const Value&)>& mapper) const;
+    
+private:
+    std::shared_ptr<MemoryAccount> account; // 创建时正在执行脚本的解释器的账户
+    
+    void charge(const std::string& key, const Value& value, bool newKey);
 };
 
 #endif // TABLE_H
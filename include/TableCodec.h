@@ -0,0 +1,33 @@
+#ifndef TABLE_CODEC_H
+#define TABLE_CODEC_H
+
+#include <string>
+#include <string_view>
+#include <istream>
+#include <functional>
+#include <memory>
+
+#include "Table.h"
+
+// 表的序列化。
+// 二进制格式紧凑且保留表的同一性: 共享的子表只写一次, 之后以编号引用, 因此环也能还原;
+// 元表一起编码。JSON 格式用于和外部交换数据, 键为 "1".."n" 的表写成数组, 不含元表。
+// 编码直接遍历 Table::fields 和 metatable 写入同一个输出缓冲区, 不生成中间字符串。
+class TableCodec {
+public:
+    static std::string encodeBinary(const Value& value);
+    static Value decodeBinary(std::string_view data);
+    // 不小于 borrowFrom 字节的字符串解码为直接引用 data 的 rope 视图, owner 保持 data 存活
+    static Value decodeBinary(std::string_view data, std::shared_ptr<const void> owner, size_t borrowFrom);
+
+    static std::string encodeJson(const Value& value);
+
+    // 一趟完成校验和解析, 字符串内容用向量化扫描跳过普通字符
+    static Value decodeJson(std::string_view text);
+
+    // 流式解码顶层为数组的 JSON 文档: 分块读取输入, 每解析完一个元素就交给 onElement,
+    // 内存占用只与单个元素的大小有关。返回元素个数
+    static size_t decodeJsonArray(std::istream& in, const std::function<void(Value)>& onElement);
+};
+
+#endif // TABLE_CODEC_H
@@ -7,29 +7,119 @@
 #include <map>
 #include <stack>
 #include <memory>
+#include <unordered_map>
 
 #include "CallStack.h"
 #include "VariableManager.h"
 #include "ExpressionParser.h"
 #include "CommandHandler.h"
+#include "SubstTemplate.h"
+#include "MemoryAccount.h"
+#include "Binding.h"
+#include "CompiledScript.h"
+#include "ModuleRegistry.h"
 
 class Tclua {
 private:
+    static const size_t MAX_COMPILED_COMMANDS = 4096;
+    
+    std::shared_ptr<MemoryAccount> memoryAccount; // 表可能比解释器活得更久, 账户随它们一起保留
     CallStack callStack;
     VariableManager varManager;
     ExpressionParser exprParser;
     CommandHandler cmdHandler;
     int currentLine = 0;
+    std::unordered_map<std::string, std::shared_ptr<const CompiledCommand>> compiledCommands;
+    std::unordered_map<std::string, std::shared_ptr<const CompiledScript>> compiledScripts;
+    size_t compiledCommandBytes = 0;
+    size_t compiledScriptBytes = 0;
     
     // 添加私有方法声明
     Value execute_line(const std::string& line);
+    Value execute_compiled(const CompiledCommand& command, bool tail = false);
+    Value evaluateScript(const std::string& script, bool tail);
+    Value run(const CompiledScript& compiled, bool tail);
+    std::shared_ptr<const CompiledCommand> compile(const std::string& line);
+    std::shared_ptr<const CompiledScript> compileScript(const std::string& script);
+    Value invoke(const std::string& name, const std::vector<Value>& args);
     
 public:
     Tclua() 
-        : varManager(callStack), exprParser(varManager), 
-          cmdHandler(varManager, exprParser, callStack) {}
+        : memoryAccount(std::make_shared<MemoryAccount>()), callStack(memoryAccount.get()),
+          varManager(callStack, memoryAccount.get()), exprParser(varManager),
+          cmdHandler(varManager, exprParser, callStack, *memoryAccount) {
+        cmdHandler.setScriptEvaluator([this](const std::string& script, bool tail) { return evaluateScript(script, tail); });
+        exprParser.setCommandEvaluator([this](const std::string& script) { return evaluate(script); });
+        cmdHandler.setCompiledEvaluator([this](const CompiledScript& script, bool tail) { return run(script, tail); });
+    }
+    
+    Tclua(const Tclua&) = delete;
+    Tclua& operator=(const Tclua&) = delete;
     
     void execute(const std::string& script);
+    
+    // 执行脚本并返回最后一条命令的结果, 错误以异常形式抛出
+    Value evaluate(const std::string& script);
+    
+    // 优化级别 0-2, 默认 2, 各级别的含义见 Optimizer.h
+    void setOptimizationLevel(int level) {
+        exprParser.setOptimizationLevel(level);
+        cmdHandler.resetPlans();
+    }
+    int optimizationLevel() const { return exprParser.getOptimizationLevel(); }
+    
+    // 把宿主函数 (函数指针或 lambda) 绑定为脚本命令, 参数转换按函数签名在编译期生成。
+    // 支持的参数类型: 算术类型, bool, std::string, std::string_view, Value,
+    // std::shared_ptr<Table>, Span<const double>, Span<const std::string_view>
+    template <typename F>
+    void bind(const std::string& name, F fn) {
+        cmdHandler.registerCommand(name, Binding::wrap(name, std::move(fn)));
+    }
+    
+    // 调用脚本过程或宿主命令, 参数以原来的类型传入, 不经过字符串; 错误以异常形式抛出
+    template <typename R = Value, typename... Args>
+    R call(const std::string& name, Args&&... args) {
+        std::vector<Value> values;
+        values.reserve(sizeof...(Args));
+        (values.push_back(Binding::toValue(std::forward<Args>(args))), ...);
+        Value result = invoke(name, values);
+        if constexpr (!std::is_void_v<R>) {
+            static_assert(!BorrowsData<R>::value, "call result must own its data");
+            BindingScratch scratch;
+            return ValueConverter<R>::from(result, scratch, -1);
+        }
+    }
+    
+    // 宿主缓冲区的只读视图, 在脚本中作为字符串使用而不复制内容
+    static Value view(std::string_view data, std::shared_ptr<const void> owner = nullptr) {
+        return std::make_shared<Rope>(Rope::view(data, std::move(owner)));
+    }
+    
+    template <typename T>
+    void setVariable(const std::string& name, T&& value) {
+        MemoryAccount::Scope scope(memoryAccount.get());
+        varManager.set(name, Binding::toValue(std::forward<T>(value)));
+    }
+    
+    template <typename R = Value>
+    R variable(const std::string& name) const {
+        static_assert(!BorrowsData<R>::value, "variable result must own its data");
+        BindingScratch scratch;
+        return ValueConverter<R>::from(varManager.get(name), scratch, -1);
+    }
+    
+    // 把初始化好的解释器保存为镜像文件, 之后的进程用 loadImage 恢复而不必重新执行启动脚本。
+    // 保存过程, 类, 全局变量和表, 模块状态; 宿主绑定的命令和优化级别不保存。
+    // 编译后的命令和表达式在恢复后首次执行时重新生成
+    void saveImage(const std::string& path);
+    // 从镜像恢复, 与当前状态合并; 长字符串直接引用映射的文件页面, 多个进程共享
+    void loadImage(const std::string& path);
+    
+    // 在模块搜索路径末尾添加目录, 对进程中所有解释器生效
+    static void addModulePath(const std::string& dir) { ModuleRegistry::instance().addSearchPath(dir); }
+    
+    // 内存账户: 设置软/硬限制, 查询各类别用量
+    MemoryAccount& memory() { return *memoryAccount; }
 };
 
-#endif // LUA_INTERPRETER_H
\ No newline at end of file
+#endif // LUA_INTERPRETER_H
@@ -7,6 +7,17 @@
 class Tokenizer {
 public:
     static std::vector<std::string> tokenize(const std::string& input, int line);
+    
+    // 括号和引号都已闭合时命令才完整, 否则需要继续读入下一行
+    static bool isComplete(const std::string& input);
+    
+    // pos 处的 '[' 对应的 ']' 的位置, 未闭合时返回 npos。
+    // 命令替换内部按单词扫描, 大括号和引号括起的单词整体跳过, 其中的方括号不计数
+    static size_t matchBracket(const std::string& input, size_t pos, size_t end = std::string::npos);
+    
+    // 列表字符串与元素之间的转换, 元素中的大括号和引号会被去掉/补上
+    static std::vector<std::string> splitList(const std::string& list);
+    static std::string joinList(const std::vector<std::string>& elements);
 };
 
 #endif // TOKENIZER_H
\ No newline at end of file
@@ -6,10 +6,14 @@
 #include <string>
 #include <variant>
 #include <memory>
+#include <vector>
+#include <functional>
 
 #include "Table.h"
 #include "CallStack.h"
 
+class MemoryAccount;
+
 class VariableManager {
 private:
     struct Variable {
@@ -21,13 +25,68 @@ private:
     
     std::unordered_map<std::string, Variable> variables;
     CallStack& callStack;
+    MemoryAccount* account;
+    
+    // 正在执行的命名空间; 模块体顶层 (调用栈深度等于 namespaceDepth) 的普通变量名
+    // 属于命名空间, 命名空间内过程的变量先找局部变量, 再找命名空间变量
+    std::string currentNamespace;
+    size_t namespaceDepth = 0;
+    
+    // 限定名 ns::name 按符号编号缓存的全局变量; 变量从不删除, 节点地址保持不变
+    mutable std::vector<const Variable*> slots;
+    
+    std::function<bool(const std::string&)> moduleLoader;
+    
+    // 名为 tableName 的表变量, 不存在或不是表时新建
+    std::shared_ptr<Table> tableVariable(const std::string& tableName);
+    
+    bool atNamespaceTop() const {
+        return !currentNamespace.empty() && callStack.depth() == namespaceDepth;
+    }
+    // name 在当前命名空间中对应的全局变量名
+    std::string qualify(const std::string& name) const;
+    // 限定名对应的模块还没有执行时先执行模块体, 之后重新查找
+    bool loadModuleOf(const std::string& name) const;
     
 public:
-    VariableManager(CallStack& cs);
+    VariableManager(CallStack& cs, MemoryAccount* account = nullptr);
+    ~VariableManager();
+    VariableManager(const VariableManager&) = delete;
+    VariableManager& operator=(const VariableManager&) = delete;
     
-    void set(const std::string& name, const Value& value, int line = -1);
+    // upvalue 为过程体编译时解析出的 upvalue 索引 (见 SubstTemplate), 小于 0 或不适用于当前帧时按名字查找
+    void set(const std::string& name, const Value& value, int line = -1, int upvalue = -1);
     Value get(const std::string& name, int line = -1) const;
     bool exists(const std::string& name) const;
+    
+    // 返回普通变量(局部或全局)的存储槽, 表字段或不存在时返回 nullptr
+    const Value* lookup(const std::string& name) const;
+    Value* lookup(const std::string& name);
+    // symbol 为限定名的符号编号 (见 ModuleRegistry::symbol), upvalue 同 set; 都小于 0 时同上
+    const Value* lookup(const std::string& name, int symbol, int upvalue = -1) const;
+    Value* lookup(const std::string& name, int symbol, int upvalue);
+    
+    // 访问未执行模块的限定名时调用, 参数为命名空间, 返回是否执行了模块体
+    void setModuleLoader(std::function<bool(const std::string&)> loader) { moduleLoader = std::move(loader); }
+    
+    const std::string& namespaceName() const { return currentNamespace; }
+    
+    // 镜像: 全局变量按名字放进 globals, 由字段赋值自动创建的表变量另记在 fieldTables 中
+    void exportGlobals(Table& globals, Table& fieldTables) const;
+    void importGlobals(const Table& globals, const Table& fieldTables);
+    
+    // 在命名空间中执行: topLevel 为 true 表示模块体顶层, 否则为命名空间内的过程
+    class NamespaceScope {
+    public:
+        NamespaceScope(VariableManager& vm, const std::string& ns, bool topLevel);
+        ~NamespaceScope();
+        NamespaceScope(const NamespaceScope&) = delete;
+        NamespaceScope& operator=(const NamespaceScope&) = delete;
+    private:
+        VariableManager& vm;
+        std::string savedNamespace;
+        size_t savedDepth;
+    };
 };
 
 #endif // VARIABLE_MANAGER_H
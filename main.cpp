@@ -2,6 +2,7 @@
 #include "include/InterpreterException.h"
 #include <fstream>
 #include <filesystem>
+#include <sstream>
 
 namespace fs = std::filesystem;
 
@@ -137,9 +138,51 @@ public:
     }
 };
 
-int main() {
+int main(int argc, char* argv[]) {
     Tclua interpreter;
     
+    // tclua ?-O0|-O1|-O2? ?-path dir ...? ?-image file? ?-save-image file? ?script.tcl?
+    // -path 把目录加入模块搜索路径 (脚本自己不能修改),
+    // -image 先从镜像恢复再执行脚本, -save-image 在脚本执行完后保存镜像
+    std::string scriptFile, loadImage, saveImage;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg.size() == 3 && arg.compare(0, 2, "-O") == 0 && arg[2] >= '0' && arg[2] <= '2') {
+            interpreter.setOptimizationLevel(arg[2] - '0');
+        } else if (arg == "-path" && i + 1 < argc) {
+            Tclua::addModulePath(argv[++i]);
+        } else if ((arg == "-image" || arg == "-save-image") && i + 1 < argc) {
+            (arg == "-image" ? loadImage : saveImage) = argv[++i];
+        } else {
+            scriptFile = arg;
+        }
+    }
+    try {
+        if (!loadImage.empty()) interpreter.loadImage(loadImage);
+    } catch (const InterpreterException& e) {
+        std::cerr << "Error: " << e.fullMessage() << std::endl;
+        return 1;
+    }
+    if (!scriptFile.empty() || !loadImage.empty() || !saveImage.empty()) {
+        if (!scriptFile.empty()) {
+            std::ifstream in(scriptFile);
+            if (!in) {
+                std::cerr << "Error: cannot open \"" << scriptFile << "\"" << std::endl;
+                return 1;
+            }
+            std::stringstream buffer;
+            buffer << in.rdbuf();
+            interpreter.execute(buffer.str());
+        }
+        try {
+            if (!saveImage.empty()) interpreter.saveImage(saveImage);
+        } catch (const InterpreterException& e) {
+            std::cerr << "Error: " << e.fullMessage() << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    
     // 示例脚本
     std::string script = R"(
         # 基础变量操作
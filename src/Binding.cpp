@@ -0,0 +1,27 @@
+#include "Binding.h"
+#include "Tokenizer.h"
+
+namespace binding_detail {
+
+std::string_view viewOf(const Value& value, BindingScratch& scratch) {
+    if (const auto* text = std::get_if<std::string>(&value)) return *text;
+    if (const auto* rope = std::get_if<std::shared_ptr<Rope>>(&value)) {
+        std::string_view flat;
+        if ((*rope)->flat(flat)) return flat;
+    }
+    return scratch.keep(ExpressionParser::valueToString(value));
+}
+
+double toDouble(const Value& value, int line) {
+    double number;
+    if (!ExpressionParser::toNumber(value, number)) {
+        throw RuntimeError("expected number but got \"" + ExpressionParser::valueToString(value) + "\"", line);
+    }
+    return number;
+}
+
+std::vector<std::string> splitList(std::string_view list) {
+    return Tokenizer::splitList(std::string(list));
+}
+
+} // namespace binding_detail
@@ -1,11 +1,30 @@
 #include "CallStack.h"
+#include "MemoryAccount.h"
 
-void CallStack::push(const std::string& func, int line) {
-    frames.push({func, line, {}});
+void CallStack::push(const std::string& func, int line, std::shared_ptr<const Upvalues> upvalues) {
+    // 先记账再入栈, 超过内存限制时调用直接失败
+    if (account) account->charge(MemoryAccount::FRAMES, sizeof(StackFrame) + MemoryAccount::footprint(func));
+    frames.push({func, line, {}, std::move(upvalues), {}});
 }
 
 void CallStack::pop() {
-    if (!frames.empty()) frames.pop();
+    if (frames.empty()) return;
+    if (account) {
+        const StackFrame& frame = frames.top();
+        size_t frameBytes = sizeof(StackFrame) + MemoryAccount::footprint(frame.function);
+        size_t stringBytes = 0;
+        for (const auto& local : frame.locals) {
+            frameBytes += MemoryAccount::MAP_NODE_BYTES + MemoryAccount::footprint(local.first);
+            stringBytes += MemoryAccount::footprint(local.second);
+        }
+        account->release(MemoryAccount::FRAMES, frameBytes);
+        account->release(MemoryAccount::STRINGS, stringBytes);
+    }
+    // 帧退出前关闭被捕获的局部变量, 闭包之后读写的是单元里的值
+    for (auto& entry : frames.top().openUpvalues) {
+        entry.second->close();
+    }
+    frames.pop();
 }
 
 StackFrame& CallStack::top() {
@@ -13,17 +32,104 @@ StackFrame& CallStack::top() {
 }
 
 void CallStack::setLocal(const std::string& name, const Value& value) {
-    if (!frames.empty()) {
-        frames.top().locals[name] = value;
+    if (frames.empty()) return;
+    StackFrame& frame = frames.top();
+    size_t bytes = MemoryAccount::footprint(value);
+    
+    auto it = frame.locals.find(name);
+    if (it != frame.locals.end()) {
+        if (account) {
+            account->charge(MemoryAccount::STRINGS, bytes);
+            account->release(MemoryAccount::STRINGS, MemoryAccount::footprint(it->second));
+        }
+        it->second = value;
+        return;
+    }
+    
+    if (frame.upvalues) {
+        int index = frame.upvalues->indexOf(name);
+        if (index >= 0) {
+            assign(*frame.upvalues->cells[index], value);
+            return;
+        }
+    }
+    
+    if (account) {
+        account->charge(MemoryAccount::FRAMES, MemoryAccount::MAP_NODE_BYTES + MemoryAccount::footprint(name));
+        try {
+            account->charge(MemoryAccount::STRINGS, bytes);
+        } catch (...) {
+            account->release(MemoryAccount::FRAMES, MemoryAccount::MAP_NODE_BYTES + MemoryAccount::footprint(name));
+            throw;
+        }
+    }
+    frame.locals.emplace(name, value);
+}
+
+// 开放的单元由外层帧退出时退账, 已关闭的单元不再记账
+void CallStack::assign(UpvalueCell& cell, const Value& value) {
+    if (account && cell.isOpen()) {
+        account->charge(MemoryAccount::STRINGS, MemoryAccount::footprint(value));
+        account->release(MemoryAccount::STRINGS, MemoryAccount::footprint(cell.value()));
     }
+    cell.value() = value;
+}
+
+const Value* CallStack::findUpvalue(int index) const {
+    if (frames.empty() || index < 0) return nullptr;
+    const auto& upvalues = frames.top().upvalues;
+    if (!upvalues || static_cast<size_t>(index) >= upvalues->cells.size()) return nullptr;
+    return &upvalues->cells[index]->value();
+}
+
+bool CallStack::setUpvalue(int index, const Value& value) {
+    if (frames.empty() || index < 0) return false;
+    const auto& upvalues = frames.top().upvalues;
+    if (!upvalues || static_cast<size_t>(index) >= upvalues->cells.size()) return false;
+    assign(*upvalues->cells[index], value);
+    return true;
 }
 
 Value CallStack::getLocal(const std::string& name) const {
-    if (!frames.empty()) {
-        auto it = frames.top().locals.find(name);
-        if (it != frames.top().locals.end()) {
-            return it->second;
-        }
+    if (const Value* slot = findLocal(name)) {
+        return *slot;
+    }
+    return nullptr;
+}
+
+const Value* CallStack::findLocal(const std::string& name) const {
+    if (frames.empty()) return nullptr;
+    const StackFrame& frame = frames.top();
+    auto it = frame.locals.find(name);
+    if (it != frame.locals.end()) return &it->second;
+    
+    if (frame.upvalues) {
+        int index = frame.upvalues->indexOf(name);
+        if (index >= 0) return &frame.upvalues->cells[index]->value();
+    }
+    return nullptr;
+}
+
+Value* CallStack::findLocal(const std::string& name) {
+    return const_cast<Value*>(static_cast<const CallStack*>(this)->findLocal(name));
+}
+
+std::shared_ptr<UpvalueCell> CallStack::capture(const std::string& name) {
+    if (frames.empty()) return nullptr;
+    StackFrame& frame = frames.top();
+    
+    auto it = frame.locals.find(name);
+    if (it != frame.locals.end()) {
+        // 同一帧里创建的闭包共享同一个单元
+        auto& cell = frame.openUpvalues[name];
+        if (!cell) cell = std::make_shared<UpvalueCell>(&it->second);
+        return cell;
+    }
+    
+    // 嵌套闭包直接沿用外层闭包的单元
+    if (frame.upvalues) {
+        int index = frame.upvalues->indexOf(name);
+        if (index >= 0) return frame.upvalues->cells[index];
     }
     return nullptr;
 }
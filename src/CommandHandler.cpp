@@ -1,98 +1,1308 @@
-#ifndef COMMAND_HANDLER_H
-#define COMMAND_HANDLER_H
-
-#include <vector>
-#include <string>
-#include <map>
-#include <stack>
-#include <memory>
-#include <functional>
+#include "CommandHandler.h"
+#include "StringKernels.h"
+#include "Tokenizer.h"
+#include "TableCodec.h"
+#include <fstream>
 #include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 
-#include "InterpreterException.h"
-#include "Table.h"
-#include "VariableManager.h"
-#include "ExpressionParser.h"
-#include "CallStack.h"
-
-class CommandHandler {
-private:
-    struct Procedure {
-        std::vector<std::string> parameters;
-        std::string body;
-        std::map<std::string, Value> capturedVars; // 闭包捕获的变量
+namespace {
+
+std::string toString(const Value& value) {
+    return ExpressionParser::valueToString(value);
+}
+
+size_t valueLength(const Value& value) {
+    if (std::holds_alternative<std::shared_ptr<Rope>>(value)) {
+        return std::get<std::shared_ptr<Rope>>(value)->length();
+    }
+    if (std::holds_alternative<std::string>(value)) {
+        return std::get<std::string>(value).length();
+    }
+    return toString(value).length();
+}
+
+// 解析 Tcl 风格的索引: 整数, end, end-N
+long long parseIndex(const std::string& spec, size_t length, int line) {
+    try {
+        if (spec.compare(0, 3, "end") == 0) {
+            long long offset = spec.length() > 3 ? std::stoll(spec.substr(3)) : 0;
+            return static_cast<long long>(length) - 1 + offset;
+        }
+        size_t used = 0;
+        long long index = std::stoll(spec, &used);
+        if (used == spec.length()) return index;
+    } catch (const std::exception&) {
+    }
+    throw RuntimeError("bad index \"" + spec + "\": must be integer?[+-]integer? or end?[+-]integer?", line);
+}
+
+// 脚本中出现的所有标识符 (字母, 数字, 下划线组成的片段), 去重后按字典序排列
+std::vector<std::string> collectNames(const std::string& script) {
+    std::vector<std::string> names;
+    size_t pos = 0;
+    while (pos < script.length()) {
+        unsigned char c = script[pos];
+        if (!isalnum(c) && c != '_') {
+            pos++;
+            continue;
+        }
+        size_t start = pos;
+        while (pos < script.length() && (isalnum(static_cast<unsigned char>(script[pos])) || script[pos] == '_')) {
+            pos++;
+        }
+        names.push_back(script.substr(start, pos - start));
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+// 镜像中名为 name 的部分, 缺少时镜像无效
+std::shared_ptr<Table> imageSection(const Table& image, const std::string& name) {
+    auto it = image.fields.find(name);
+    if (it == image.fields.end() || !std::holds_alternative<std::shared_ptr<Table>>(it->second)) {
+        throw RuntimeError("image has no \"" + name + "\" section");
+    }
+    return std::get<std::shared_ptr<Table>>(it->second);
+}
+
+std::string imageField(const Table& entry, const std::string& key) {
+    auto it = entry.fields.find(key);
+    return it == entry.fields.end() ? std::string() : toString(it->second);
+}
+
+// set/incr 的变量名参数在闭包过程体中解析出的 upvalue 索引, 命令不是直接由编译结果执行时为 -1
+int nameUpvalue(const CompiledCommand* words, size_t argc) {
+    if (!words || words->words.size() != argc + 1 || argc == 0) return -1;
+    return words->words[1]->constantUpvalue();
+}
+
+} // namespace
+
+Value CommandHandler::executeCommand(const std::string& cmd, const std::vector<Value>& args) {
+    const CompiledCommand* words = commandWords;
+    commandWords = nullptr;
+    if (cmd == "print") {
+        for (const auto& arg : args) {
+            std::cout << toString(arg) << " ";
+        }
+        std::cout << std::endl;
+        return 0.0;
+    }
+    if (cmd == "set") return handleSet(args, words);
+    if (cmd == "puts") return handlePuts(args);
+    if (cmd == "string") return handleString(args);
+    if (cmd == "append") return handleAppend(args);
+    if (cmd == "split") return handleSplit(args);
+    if (cmd == "switch") return handleSwitch(args, words);
+    if (cmd == "regexp") return handleRegexp(args);
+    if (cmd == "regsub") return handleRegsub(args);
+    if (cmd == "table") return handleTable(args);
+    if (cmd == "try") return handleTry(args);
+    if (cmd == "memory") return handleMemory(args);
+    if (cmd == "proc") return handleProc(args);
+    if (cmd == "return") return handleReturn(args);
+    if (cmd == "expr") return handleExpr(args);
+    if (cmd == "if") return handleIf(args);
+    if (cmd == "while") return handleWhile(args);
+    if (cmd == "for") return handleFor(args);
+    if (cmd == "incr") return handleIncr(args, words);
+    if (cmd == "break" || cmd == "continue") return handleLoopControl(cmd, args);
+    if (cmd == "module") return handleModule(args);
+    if (cmd == "import") return handleImport(args);
+    const std::string& ns = varManager.namespaceName();
+    if (!ns.empty()) {
+        // 命名空间内先找同一命名空间的过程
+        auto local = procedures.find(ns + "::" + cmd);
+        if (local != procedures.end()) return executeProcedure(local->first, args);
+    }
+    if (procedures.count(cmd)) return executeProcedure(cmd, args);
+    auto native = nativeCommands.find(cmd);
+    if (native != nativeCommands.end()) {
+        // 宿主函数抛出的普通异常转换为脚本可以捕获的运行时错误
+        try {
+            return native->second(args, currentLine);
+        } catch (const InterpreterException&) {
+            throw;
+        } catch (const std::exception& e) {
+            throw RuntimeError(e.what(), currentLine);
+        }
+    }
+    // import 引入的短名或限定名: 模块体还没有执行时先执行, 再按限定名分派
+    auto alias = importedCommands.find(cmd);
+    const std::string& qualified = alias != importedCommands.end() ? alias->second : cmd;
+    std::string moduleName, tail;
+    if (ModuleRegistry::splitQualified(qualified, moduleName, tail)) {
+        loadModule(moduleName);
+        if (hasCommand(qualified)) return executeCommand(qualified, args);
+    }
+    return 0.0;
+}
+
+void CommandHandler::registerCommand(const std::string& name, Binding::NativeCommand command) {
+    auto proc = procedures.find(name);
+    if (proc != procedures.end()) {
+        memory.release(MemoryAccount::CODE, proc->second->codeBytes);
+        procedures.erase(proc);
+    }
+    nativeCommands[name] = std::move(command);
+}
+
+Value CommandHandler::evalScript(const std::string& script, bool tail) {
+    if (!scriptEvaluator) {
+        throw RuntimeError("no script evaluator installed", currentLine);
+    }
+    return scriptEvaluator(script, tail);
+}
+
+std::shared_ptr<const GlobPattern> CommandHandler::globPattern(const std::string& pattern, bool nocase) {
+    std::string key = (nocase ? "i:" : "c:") + pattern;
+    return globCache.getOrCreate(key, [&]() {
+        return std::make_shared<const GlobPattern>(pattern, nocase);
+    });
+}
+
+std::shared_ptr<Regex> CommandHandler::regex(const std::string& pattern, bool nocase) {
+    std::string key = (nocase ? "i:" : "c:") + pattern;
+    if (const auto* cached = regexCache.find(key)) return *cached;
+    auto compiled = std::make_shared<Regex>(pattern, nocase ? Regex::NOCASE : 0);
+    return regexCache.insert(key, compiled);
+}
+
+Value CommandHandler::handleTable(const std::vector<Value>& args) {
+    if (args.empty()) {
+        throw RuntimeError("wrong # args: should be \"table subcommand ?arg ...?\"", currentLine);
+    }
+    std::string sub = toString(args[0]);
+    if (sub != "encode" && sub != "decode") {
+        throw RuntimeError("unknown or ambiguous subcommand \"" + sub + "\": must be decode or encode", currentLine);
+    }
+    
+    bool json = false, stream = false;
+    size_t i = 1;
+    for (; i < args.size(); i++) {
+        std::string option = toString(args[i]);
+        if (option == "-binary") json = false;
+        else if (option == "-json") json = true;
+        else if (option == "-stream" && sub == "decode") stream = true;
+        else break;
+    }
+    
+    // table decode -json -stream fileName varName body: 逐个元素解码顶层数组并执行 body
+    if (stream) {
+        if (!json || args.size() - i != 3) {
+            throw RuntimeError("wrong # args: should be \"table decode -json -stream fileName varName body\"", currentLine);
+        }
+        std::string fileName = toString(args[i]);
+        std::string varName = toString(args[i + 1]);
+        std::string body = toString(args[i + 2]);
+        std::ifstream file(fileName, std::ios::binary);
+        if (!file) {
+            throw RuntimeError("couldn't open \"" + fileName + "\"", currentLine);
+        }
+        size_t count = TableCodec::decodeJsonArray(file, [&](Value element) {
+            varManager.set(varName, element, currentLine);
+            evalScript(body);
+        });
+        return static_cast<double>(count);
+    }
+    
+    if (args.size() - i != 1) {
+        throw RuntimeError("wrong # args: should be \"table " + sub + " ?-binary|-json? value\"", currentLine);
+    }
+    if (sub == "encode") {
+        return json ? TableCodec::encodeJson(args[i]) : TableCodec::encodeBinary(args[i]);
+    }
+    std::string data = toString(args[i]);
+    return json ? TableCodec::decodeJson(data) : TableCodec::decodeBinary(data);
+}
+
+// try body ?catch varName handler?
+Value CommandHandler::handleTry(const std::vector<Value>& args) {
+    bool hasHandler = args.size() == 4 && toString(args[1]) == "catch";
+    if (args.size() != 1 && !hasHandler) {
+        throw RuntimeError("wrong # args: should be \"try body ?catch varName handler?\"", currentLine);
+    }
+    
+    int line = currentLine;
+    try {
+        return evalScript(toString(args[0]));
+    } catch (const InterpreterException& e) {
+        currentLine = line;
+        if (!hasHandler) return std::string();
+        Value result;
+        {
+            MemoryAccount::Reserve reserve(memory);
+            varManager.set(toString(args[2]), std::string(e.what()), currentLine);
+            result = evalScript(toString(args[3]));
+        }
+        // 处理程序结束后重新按原限制检查, 没有释放内存的处理程序不能让用量停在限制之上
+        memory.enforce();
+        return result;
+    }
+}
+
+Value CommandHandler::handleMemory(const std::vector<Value>& args) {
+    std::string sub = args.empty() ? "" : toString(args[0]);
+    if (sub != "stats" || args.size() != 1) {
+        throw RuntimeError("wrong # args: should be \"memory stats\"", currentLine);
+    }
+    
+    // 以键值列表返回各类别用量, 总量, 峰值和限制 (0 表示不限制)
+    MemoryAccount::Stats stats = memory.stats();
+    std::vector<std::string> result;
+    for (int category = 0; category < MemoryAccount::CATEGORY_COUNT; category++) {
+        result.push_back(MemoryAccount::categoryName(static_cast<MemoryAccount::Category>(category)));
+        result.push_back(std::to_string(stats.used[category]));
+    }
+    const std::pair<const char*, size_t> totals[] = {
+        {"total", stats.total}, {"peak", stats.peak}, {"softLimit", stats.softLimit}, {"hardLimit", stats.hardLimit}};
+    for (const auto& entry : totals) {
+        result.push_back(entry.first);
+        result.push_back(std::to_string(entry.second));
+    }
+    return Tokenizer::joinList(result);
+}
+
+Value CommandHandler::handleProc(const std::vector<Value>& args) {
+    if (args.size() != 3) {
+        throw RuntimeError("wrong # args: should be \"proc name args body\"", currentLine);
+    }
+    auto proc = std::make_shared<Procedure>();
+    std::string name = toString(args[0]);
+    // 命名空间内定义的过程属于该命名空间; 限定名的过程在自己的命名空间中执行
+    const std::string& ns = varManager.namespaceName();
+    if (!ns.empty() && name.find("::") == std::string::npos) name = ns + "::" + name;
+    std::string tail;
+    ModuleRegistry::splitQualified(name, proc->ns, tail);
+    proc->parameters = Tokenizer::splitList(toString(args[1]));
+    proc->body = toString(args[2]);
+    
+    // 在过程内定义的过程是闭包: 过程体引用到的外层局部变量按共享单元捕获,
+    // 同一帧里创建的多个闭包共享同一个单元, 不再复制变量
+    if (!callStack.empty()) {
+        auto names = bodyNamesCache.getOrCreate(proc->body, [&]() {
+            return std::make_shared<const std::vector<std::string>>(collectNames(proc->body));
+        });
+        auto upvalues = std::make_shared<Upvalues>();
+        for (const auto& candidate : *names) {
+            if (std::find(proc->parameters.begin(), proc->parameters.end(), candidate) != proc->parameters.end()) {
+                continue;
+            }
+            if (auto cell = callStack.capture(candidate)) {
+                upvalues->names.push_back(candidate);
+                upvalues->cells.push_back(std::move(cell));
+            }
+        }
+        if (!upvalues->names.empty()) proc->upvalues = std::move(upvalues);
+    }
+    
+    defineProcedure(name, std::move(proc));
+    return std::string();
+}
+
+// 单独编译过程体, 闭包对捕获变量的引用直接按索引访问单元;
+// 过程体有语法错误时返回 nullptr, 留到调用时按普通脚本报告
+std::shared_ptr<const CompiledScript> CommandHandler::compileBody(const Procedure& proc) const {
+    const Upvalues* upvalues = proc.upvalues.get();
+    int line = currentLine;
+    try {
+        return CompiledScript::compile(std::string(proc.text()), [upvalues, line](const std::string& command) {
+            return CompiledCommand::compile(command, line, upvalues);
+        });
+    } catch (const InterpreterException&) {
+        return nullptr;
+    }
+}
+
+void CommandHandler::defineProcedure(const std::string& name, std::shared_ptr<Procedure> proc) {
+    if (proc->upvalues) proc->compiled = compileBody(*proc);
+    
+    // 映射的过程体不计入, 它的页面属于镜像文件
+    proc->codeBytes = sizeof(Procedure) + MemoryAccount::footprint(proc->body);
+    if (proc->compiled) proc->codeBytes += proc->compiled->codeBytes;
+    for (const auto& parameter : proc->parameters) proc->codeBytes += sizeof(std::string) + MemoryAccount::footprint(parameter);
+    memory.charge(MemoryAccount::CODE, proc->codeBytes);
+    
+    nativeCommands.erase(name);
+    auto& slot = procedures[name];
+    if (slot) memory.release(MemoryAccount::CODE, slot->codeBytes);
+    slot = std::move(proc);
+}
+
+Value CommandHandler::handleReturn(const std::vector<Value>& args) {
+    if (args.size() > 1) {
+        throw RuntimeError("wrong # args: should be \"return ?value?\"", currentLine);
+    }
+    Value value = args.empty() ? Value(std::string()) : args[0];
+    if (callStack.empty() || tailPosition) return value;
+    throw ProcedureReturn{std::move(value)};
+}
+
+Value CommandHandler::executeProcedure(const std::string& name, const std::vector<Value>& args) {
+    // 持有过程本身, 过程体里重新定义同名过程也不影响本次调用
+    std::shared_ptr<const Procedure> proc = procedures.at(name);
+    const auto& parameters = proc->parameters;
+    bool variadic = !parameters.empty() && parameters.back() == "args";
+    size_t fixed = variadic ? parameters.size() - 1 : parameters.size();
+    
+    if (args.size() < fixed || (!variadic && args.size() > fixed)) {
+        std::string usage = name;
+        for (const auto& parameter : parameters) usage += " " + (parameter == "args" ? "?arg ...?" : parameter);
+        throw RuntimeError("wrong # args: should be \"" + usage + "\"", currentLine);
+    }
+    
+    callStack.push(name, currentLine, proc->upvalues);
+    struct FrameGuard {
+        CallStack& stack;
+        ~FrameGuard() { stack.pop(); }
+    } guard{callStack};
+    VariableManager::NamespaceScope scope(varManager, proc->ns, false);
+    // 过程体里的变量名指向新的帧, 调用方循环缓存的不变量在这里不适用
+    ExpressionParser::LoopScope barrier(exprParser, nullptr);
+    
+    for (size_t i = 0; i < fixed; i++) callStack.setLocal(parameters[i], args[i]);
+    if (variadic) {
+        std::vector<std::string> rest;
+        for (size_t i = fixed; i < args.size(); i++) rest.push_back(toString(args[i]));
+        callStack.setLocal("args", Tokenizer::joinList(rest));
+    }
+    
+    if (proc->mappedBody && !proc->compiled) {
+        if (auto compiled = compileBody(*proc)) {
+            memory.charge(MemoryAccount::CODE, compiled->codeBytes);
+            proc->codeBytes += compiled->codeBytes;
+            proc->compiled = std::move(compiled);
+        }
+    }
+    
+    try {
+        if (proc->compiled && compiledEvaluator) return compiledEvaluator(*proc->compiled, true);
+        if (proc->mappedBody) return evalScript(std::string(proc->text()), true);
+        return evalScript(proc->body, true);
+    } catch (ProcedureReturn& result) {
+        return std::move(result.value);
+    } catch (const LoopBreak&) {
+        throw RuntimeError("invoked \"break\" outside of a loop", currentLine);
+    } catch (const LoopContinue&) {
+        throw RuntimeError("invoked \"continue\" outside of a loop", currentLine);
+    }
+}
+
+Value CommandHandler::handleModule(const std::vector<Value>& args) {
+    static const char* const USAGE = "wrong # args: should be \"module name ?body?\", \"module -path\" "
+                                     "or \"module -status name\"";
+    if (args.empty()) throw RuntimeError(USAGE, currentLine);
+    std::string name = toString(args[0]);
+    
+    if (name == "-path") {
+        // 搜索路径由进程内所有解释器共享, 只有宿主程序可以修改
+        if (args.size() != 1) {
+            throw RuntimeError("module search path can only be changed by the host program", currentLine);
+        }
+        return Tokenizer::joinList(ModuleRegistry::instance().searchPath());
+    }
+    if (name == "-status") {
+        if (args.size() != 2) {
+            throw RuntimeError("wrong # args: should be \"module -status name\"", currentLine);
+        }
+        auto it = modules.find(toString(args[1]));
+        if (it == modules.end()) return std::string("none");
+        switch (it->second.state) {
+            case ModuleInstance::PENDING: return std::string("pending");
+            case ModuleInstance::LOADING: return std::string("loading");
+            case ModuleInstance::LOADED: break;
+        }
+        return std::string("loaded");
+    }
+    if (name.empty() || name[0] == '-') {
+        throw RuntimeError("bad option \"" + name + "\": must be -path or -status", currentLine);
+    }
+    if (args.size() > 2) throw RuntimeError(USAGE, currentLine);
+    
+    // 只给出名字时声明一个空的命名空间, 变量和过程直接用限定名定义
+    if (args.size() == 1) {
+        modules.emplace(name, ModuleInstance{nullptr, ModuleInstance::LOADED});
+        return std::string();
+    }
+    auto& instance = modules[name];
+    if (instance.state == ModuleInstance::LOADING) {
+        throw RuntimeError("module \"" + name + "\" is being loaded", currentLine);
+    }
+    instance.module = ModuleRegistry::compile(name, toString(args[1]));
+    instance.state = ModuleInstance::PENDING;
+    return std::string();
+}
+
+Value CommandHandler::handleImport(const std::vector<Value>& args) {
+    if (args.empty()) {
+        throw RuntimeError("wrong # args: should be \"import name ?name ...?\"", currentLine);
+    }
+    for (const auto& arg : args) {
+        std::string name = toString(arg);
+        auto it = modules.find(name);
+        if (it == modules.end()) {
+            if (!ModuleRegistry::isValidName(name)) {
+                throw RuntimeError("bad module name \"" + name + "\"", currentLine);
+            }
+            // 模块文件在进程内只编译一次, 各解释器共享编译结果
+            auto module = ModuleRegistry::instance().find(name);
+            if (!module) throw RuntimeError("can't find module \"" + name + "\"", currentLine);
+            it = modules.emplace(name, ModuleInstance{std::move(module), ModuleInstance::PENDING}).first;
+        }
+        if (!it->second.module) continue;
+        for (const auto& proc : it->second.module->procs) importedCommands[proc] = name + "::" + proc;
+        if (it->second.module->eager) loadModule(name);
+    }
+    return std::string();
+}
+
+bool CommandHandler::loadModule(const std::string& ns) {
+    auto it = modules.find(ns);
+    if (it == modules.end() || it->second.state != ModuleInstance::PENDING) return false;
+    if (!compiledEvaluator) {
+        throw RuntimeError("no script evaluator installed", currentLine);
+    }
+    
+    // 模块体可能在任意命令中途被触发, 执行完恢复当前命令的状态
+    ModuleInstance& instance = it->second;
+    int line = currentLine;
+    bool tail = tailPosition;
+    instance.state = ModuleInstance::LOADING;
+    try {
+        VariableManager::NamespaceScope scope(varManager, ns, true);
+        ExpressionParser::LoopScope barrier(exprParser, nullptr);
+        compiledEvaluator(*instance.module->body, false);
+    } catch (...) {
+        instance.state = ModuleInstance::PENDING;
+        currentLine = line;
+        tailPosition = tail;
+        throw;
+    }
+    instance.state = ModuleInstance::LOADED;
+    currentLine = line;
+    tailPosition = tail;
+    return true;
+}
+
+void CommandHandler::exportState(Table& image) const {
+    auto globals = std::make_shared<Table>();
+    auto fieldTables = std::make_shared<Table>();
+    varManager.exportGlobals(*globals, *fieldTables);
+    
+    // 多个闭包共享的单元只保存一次, 过程中按编号引用
+    auto procs = std::make_shared<Table>();
+    auto cells = std::make_shared<Table>();
+    std::map<const UpvalueCell*, size_t> cellIds;
+    for (const auto& entry : procedures) {
+        const Procedure& proc = *entry.second;
+        auto saved = std::make_shared<Table>();
+        saved->set("params", Tokenizer::joinList(proc.parameters));
+        saved->set("body", proc.mappedBody ? Value(proc.mappedBody) : Value(proc.body));
+        saved->set("ns", proc.ns);
+        if (proc.upvalues) {
+            auto captured = std::make_shared<Table>();
+            for (size_t i = 0; i < proc.upvalues->names.size(); i++) {
+                const auto& cell = proc.upvalues->cells[i];
+                auto id = cellIds.emplace(cell.get(), cellIds.size());
+                if (id.second) cells->set(std::to_string(id.first->second), cell->value());
+                captured->set(proc.upvalues->names[i], static_cast<double>(id.first->second));
+            }
+            saved->set("upvalues", captured);
+        }
+        procs->set(entry.first, saved);
+    }
+    
+    auto savedClasses = std::make_shared<Table>();
+    for (const auto& entry : classes) savedClasses->set(entry.first, entry.second);
+    
+    // 已执行的模块只记录状态, 它定义的过程和变量已经在上面; 未执行的保存源码
+    auto savedModules = std::make_shared<Table>();
+    for (const auto& entry : modules) {
+        auto saved = std::make_shared<Table>();
+        bool pending = entry.second.state != ModuleInstance::LOADED && entry.second.module;
+        saved->set("state", std::string(pending ? "pending" : "loaded"));
+        if (pending) {
+            saved->set("path", entry.second.module->path);
+            saved->set("source", entry.second.module->source);
+        }
+        savedModules->set(entry.first, saved);
+    }
+    
+    auto imports = std::make_shared<Table>();
+    for (const auto& entry : importedCommands) imports->set(entry.first, entry.second);
+    
+    image.set("globals", globals);
+    image.set("fieldTables", fieldTables);
+    image.set("procs", procs);
+    image.set("cells", cells);
+    image.set("classes", savedClasses);
+    image.set("modules", savedModules);
+    image.set("imports", imports);
+}
+
+void CommandHandler::importState(const Table& image) {
+    auto globals = imageSection(image, "globals");
+    auto fieldTables = imageSection(image, "fieldTables");
+    auto procs = imageSection(image, "procs");
+    auto cells = imageSection(image, "cells");
+    auto savedClasses = imageSection(image, "classes");
+    auto savedModules = imageSection(image, "modules");
+    auto imports = imageSection(image, "imports");
+    
+    varManager.importGlobals(*globals, *fieldTables);
+    
+    std::map<std::string, std::shared_ptr<UpvalueCell>> restoredCells;
+    for (const auto& entry : procs->fields) {
+        const auto* saved = std::get_if<std::shared_ptr<Table>>(&entry.second);
+        if (!saved || !*saved) throw RuntimeError("image has invalid procedure \"" + entry.first + "\"");
+        auto proc = std::make_shared<Procedure>();
+        proc->parameters = Tokenizer::splitList(imageField(**saved, "params"));
+        // 长过程体解码为引用映射页面的 rope, 保留这个视图而不展开成字符串
+        auto body = (*saved)->fields.find("body");
+        const auto* rope = body != (*saved)->fields.end() ? std::get_if<std::shared_ptr<Rope>>(&body->second) : nullptr;
+        std::string_view mapped;
+        if (rope && *rope && (*rope)->ownedLength() == 0 && (*rope)->flat(mapped)) {
+            proc->mappedBody = *rope;
+        } else {
+            proc->body = imageField(**saved, "body");
+        }
+        proc->ns = imageField(**saved, "ns");
+        
+        auto captured = (*saved)->fields.find("upvalues");
+        if (captured != (*saved)->fields.end()) {
+            const auto* names = std::get_if<std::shared_ptr<Table>>(&captured->second);
+            if (!names || !*names) throw RuntimeError("image has invalid procedure \"" + entry.first + "\"");
+            auto upvalues = std::make_shared<Upvalues>();
+            for (const auto& upvalue : (*names)->fields) {
+                std::string id = toString(upvalue.second);
+                auto& cell = restoredCells[id];
+                if (!cell) {
+                    auto value = cells->fields.find(id);
+                    if (value == cells->fields.end()) {
+                        throw RuntimeError("image has invalid procedure \"" + entry.first + "\"");
+                    }
+                    cell = std::make_shared<UpvalueCell>(value->second);
+                }
+                upvalues->names.push_back(upvalue.first);
+                upvalues->cells.push_back(cell);
+            }
+            proc->upvalues = std::move(upvalues);
+        }
+        defineProcedure(entry.first, std::move(proc));
+    }
+    
+    for (const auto& entry : savedClasses->fields) {
+        if (const auto* table = std::get_if<std::shared_ptr<Table>>(&entry.second)) classes[entry.first] = *table;
+    }
+    
+    for (const auto& entry : savedModules->fields) {
+        const auto* saved = std::get_if<std::shared_ptr<Table>>(&entry.second);
+        if (!saved || !*saved) throw RuntimeError("image has invalid module \"" + entry.first + "\"");
+        if (imageField(**saved, "state") != "pending") {
+            modules[entry.first] = ModuleInstance{nullptr, ModuleInstance::LOADED};
+            continue;
+        }
+        // 模块文件还在原处时与进程中的其他解释器共享编译结果
+        std::string path = imageField(**saved, "path");
+        auto module = path.empty() ? nullptr : ModuleRegistry::instance().find(entry.first);
+        if (!module || module->path != path) {
+            module = ModuleRegistry::compile(entry.first, imageField(**saved, "source"), path);
+        }
+        modules[entry.first] = ModuleInstance{std::move(module), ModuleInstance::PENDING};
+    }
+    
+    for (const auto& entry : imports->fields) importedCommands[entry.first] = toString(entry.second);
+}
+
+Value CommandHandler::handleExpr(const std::vector<Value>& args) {
+    if (args.empty()) {
+        throw RuntimeError("wrong # args: should be \"expr arg ?arg ...?\"", currentLine);
+    }
+    if (args.size() == 1) return exprParser.evaluate(toString(args[0]), currentLine);
+    std::string text;
+    for (const auto& arg : args) {
+        if (!text.empty()) text += ' ';
+        text += toString(arg);
+    }
+    return exprParser.evaluate(text, currentLine);
+}
+
+// if expr1 ?then? body1 elseif expr2 ?then? body2 ... ?else? ?bodyN?
+Value CommandHandler::handleIf(const std::vector<Value>& args) {
+    bool tail = tailPosition;
+    std::vector<std::string> words;
+    words.reserve(args.size());
+    for (const auto& arg : args) words.push_back(toString(arg));
+    
+    std::shared_ptr<const Optimizer::IfPlan> plan;
+    if (exprParser.getOptimizationLevel() == 0) {
+        plan = Optimizer::planIf(words, exprParser, currentLine);
+    } else {
+        std::string key;
+        for (const auto& word : words) key.append(word).push_back('\0');
+        if (const auto* cached = ifPlanCache.find(key)) {
+            plan = *cached;
+        } else {
+            plan = ifPlanCache.insert(key, Optimizer::planIf(words, exprParser, currentLine));
+        }
+    }
+    
+    for (const auto& clause : plan->clauses) {
+        Value condition = clause.compiled ? exprParser.evaluate(clause.compiled, currentLine)
+                                          : exprParser.evaluate(clause.condition, currentLine);
+        if (exprParser.isTruthy(condition)) return evalScript(clause.body, tail);
+    }
+    if (plan->hasElse) return evalScript(plan->elseBody, tail);
+    return std::string();
+}
+
+std::shared_ptr<const Optimizer::LoopPlan> CommandHandler::loopPlan(const std::string& test, const std::string& next,
+                                                                    const std::string& body, bool isFor) {
+    if (exprParser.getOptimizationLevel() == 0) return Optimizer::planLoop(test, next, body, isFor, exprParser);
+    std::string key = (isFor ? "f" : "w") + test + '\0' + next + '\0' + body;
+    if (const auto* cached = loopPlanCache.find(key)) return *cached;
+    return loopPlanCache.insert(key, Optimizer::planLoop(test, next, body, isFor, exprParser));
+}
+
+Value CommandHandler::handleWhile(const std::vector<Value>& args) {
+    if (args.size() != 2) {
+        throw RuntimeError("wrong # args: should be \"while test command\"", currentLine);
+    }
+    auto plan = loopPlan(toString(args[0]), "", toString(args[1]), false);
+    return runLoop(*plan);
+}
+
+Value CommandHandler::handleFor(const std::vector<Value>& args) {
+    if (args.size() != 4) {
+        throw RuntimeError("wrong # args: should be \"for start test next command\"", currentLine);
+    }
+    evalScript(toString(args[0]));
+    auto plan = loopPlan(toString(args[1]), toString(args[2]), toString(args[3]), true);
+    return runLoop(*plan);
+}
+
+Value CommandHandler::runLoop(const Optimizer::LoopPlan& plan) {
+    loopStack.push(plan.isFor ? "for" : "while");
+    struct LoopGuard {
+        std::stack<std::string>& loops;
+        ~LoopGuard() { loops.pop(); }
+    } guard{loopStack};
+    
+    // -O2 时循环期间缓存不读取被写变量的子表达式
+    std::unique_ptr<ExpressionParser::LoopScope> scope;
+    if (plan.written) scope = std::make_unique<ExpressionParser::LoopScope>(exprParser, plan.written.get());
+    
+    while (loopTest(plan)) {
+        try {
+            evalScript(plan.body);
+        } catch (const LoopBreak&) {
+            break;
+        } catch (const LoopContinue&) {
+        }
+        if (plan.isFor) loopNext(plan);
+    }
+    return std::string();
+}
+
+bool CommandHandler::loopTest(const Optimizer::LoopPlan& plan) {
+    if (plan.fused) {
+        // 计数器和上界都是数值时直接比较, 否则退回一般的条件求值
+        const Value* counter = varManager.lookup(plan.counter);
+        double current, bound;
+        if (counter && ExpressionParser::toNumber(*counter, current) &&
+            ExpressionParser::toNumber(exprParser.evaluate(plan.bound, currentLine), bound)) {
+            return ExpressionParser::compareNumbers(plan.compare, current, bound);
+        }
+    }
+    Value condition = plan.compiled ? exprParser.evaluate(plan.compiled, currentLine)
+                                    : exprParser.evaluate(plan.test, currentLine);
+    return exprParser.isTruthy(condition);
+}
+
+void CommandHandler::loopNext(const Optimizer::LoopPlan& plan) {
+    if (plan.fused) {
+        Value* counter = varManager.lookup(plan.counter);
+        if (counter && std::holds_alternative<double>(*counter)) {
+            std::get<double>(*counter) += plan.step;
+            return;
+        }
+    }
+    evalScript(plan.next);
+}
+
+// incr varName ?increment?
+Value CommandHandler::handleIncr(const std::vector<Value>& args, const CompiledCommand* words) {
+    if (args.empty() || args.size() > 2) {
+        throw RuntimeError("wrong # args: should be \"incr varName ?increment?\"", currentLine);
+    }
+    auto integer = [this](const Value& value) {
+        double number;
+        if (!ExpressionParser::toNumber(value, number) || number != std::floor(number)) {
+            throw RuntimeError("expected integer but got \"" + toString(value) + "\"", currentLine);
+        }
+        return number;
+    };
+    double increment = args.size() == 2 ? integer(args[1]) : 1.0;
+    std::string name = toString(args[0]);
+    int upvalue = nameUpvalue(words, args.size());
+    
+    // 已经是数值的变量原地更新
+    if (Value* slot = varManager.lookup(name, -1, upvalue)) {
+        if (std::holds_alternative<double>(*slot)) {
+            std::get<double>(*slot) += increment;
+            return *slot;
+        }
+        double result = integer(*slot) + increment;
+        varManager.set(name, result, currentLine, upvalue);
+        return result;
+    }
+    double result = increment;
+    try {
+        result += integer(varManager.get(name, currentLine));
+    } catch (const UndefinedVariable&) {
+    }
+    varManager.set(name, result, currentLine);
+    return result;
+}
+
+Value CommandHandler::handleLoopControl(const std::string& cmd, const std::vector<Value>& args) {
+    if (!args.empty()) {
+        throw RuntimeError("wrong # args: should be \"" + cmd + "\"", currentLine);
+    }
+    if (loopStack.empty()) {
+        throw RuntimeError("invoked \"" + cmd + "\" outside of a loop", currentLine);
+    }
+    if (cmd == "break") throw LoopBreak{};
+    throw LoopContinue{};
+}
+
+Value CommandHandler::handleSet(const std::vector<Value>& args, const CompiledCommand* words) {
+    if (args.empty() || args.size() > 2) {
+        throw RuntimeError("wrong # args: should be \"set varName ?newValue?\"", currentLine);
+    }
+    std::string name = toString(args[0]);
+    int upvalue = nameUpvalue(words, args.size());
+    if (args.size() == 1) {
+        if (const Value* cell = upvalue >= 0 ? varManager.lookup(name, -1, upvalue) : nullptr) return *cell;
+        return varManager.get(name, currentLine);
+    }
+    varManager.set(name, args[1], currentLine, upvalue);
+    return args[1];
+}
+
+Value CommandHandler::handlePuts(const std::vector<Value>& args) {
+    bool newline = true;
+    size_t i = 0;
+    if (!args.empty() && toString(args[0]) == "-nonewline") {
+        newline = false;
+        i++;
+    }
+    if (args.size() - i != 1) {
+        throw RuntimeError("wrong # args: should be \"puts ?-nonewline? string\"", currentLine);
+    }
+    // rope 直接分块输出, 不展开成连续字符串
+    if (std::holds_alternative<std::shared_ptr<Rope>>(args[i])) {
+        std::get<std::shared_ptr<Rope>>(args[i])->write(std::cout);
+    } else {
+        std::cout << toString(args[i]);
+    }
+    if (newline) std::cout << std::endl;
+    return std::string();
+}
+
+Value CommandHandler::handleAppend(const std::vector<Value>& args) {
+    if (args.empty()) {
+        throw RuntimeError("wrong # args: should be \"append varName ?value ...?\"", currentLine);
+    }
+    std::string name = toString(args[0]);
+    
+    Value* slot = varManager.lookup(name);
+    if (!slot) {
+        // 表字段等无法直接取得存储槽的变量, 退回到读-改-写
+        std::string current;
+        try {
+            current = toString(varManager.get(name, currentLine));
+        } catch (const UndefinedVariable&) {
+        }
+        for (size_t i = 1; i < args.size(); i++) current += toString(args[i]);
+        varManager.set(name, current, currentLine);
+        return current;
+    }
+    
+    size_t added = 0;
+    for (size_t i = 1; i < args.size(); i++) added += valueLength(args[i]);
+    
+    // 先按新增长度记账, 超过内存限制时变量保持不变; 追加完成后按实际占用修正。
+    // 多记的 sizeof(std::string) 覆盖短字符串从对象内部搬到堆上的那一次
+    size_t charged = added + sizeof(std::string);
+    memory.charge(MemoryAccount::STRINGS, charged);
+    size_t before = MemoryAccount::footprint(*slot);
+    appendInPlace(*slot, args, added);
+    size_t actual = MemoryAccount::footprint(*slot);
+    if (actual > before + charged && actual - (before + charged) > memory.headroom()) {
+        // 字符串扩容留出的空余容量会越过硬限制时退还空余部分
+        if (auto* text = std::get_if<std::string>(slot)) text->shrink_to_fit();
+        actual = MemoryAccount::footprint(*slot);
+    }
+    memory.adjust(MemoryAccount::STRINGS, before + charged, actual);
+    return *slot;
+}
+
+void CommandHandler::appendInPlace(Value& slot, const std::vector<Value>& args, size_t added) {
+    if (!std::holds_alternative<std::shared_ptr<Rope>>(slot)) {
+        if (!std::holds_alternative<std::string>(slot)) slot = toString(slot);
+        std::string& text = std::get<std::string>(slot);
+        if (text.length() + added < Rope::LEAF_SIZE) {
+            // 小字符串原地追加
+            for (size_t i = 1; i < args.size(); i++) text += toString(args[i]);
+            return;
+        }
+        slot = std::make_shared<Rope>(text);
+    }
+    
+    auto& rope = std::get<std::shared_ptr<Rope>>(slot);
+    if (rope.use_count() > 1) {
+        // 写时复制: 只复制构建缓冲区, 树节点仍然共享
+        rope = std::make_shared<Rope>(*rope);
+    }
+    for (size_t i = 1; i < args.size(); i++) {
+        if (std::holds_alternative<std::shared_ptr<Rope>>(args[i])) {
+            rope->append(*std::get<std::shared_ptr<Rope>>(args[i]));
+        } else if (std::holds_alternative<std::string>(args[i])) {
+            rope->append(std::get<std::string>(args[i]));
+        } else {
+            rope->append(toString(args[i]));
+        }
+    }
+}
+
+Value CommandHandler::handleString(const std::vector<Value>& args) {
+    if (args.empty()) {
+        throw RuntimeError("wrong # args: should be \"string subcommand ?arg ...?\"", currentLine);
+    }
+    std::string sub = toString(args[0]);
+    
+    auto requireArgs = [&](size_t min, size_t max, const char* usage) {
+        if (args.size() < min || args.size() > max) {
+            throw RuntimeError(std::string("wrong # args: should be \"string ") + usage + "\"", currentLine);
+        }
     };
     
-    struct DebugInfo {
-        bool breakpointsEnabled = false;
-        std::map<int, std::string> breakpoints; // 行号 -> 条件
-        bool stepMode = false;
+    if (sub == "length") {
+        requireArgs(2, 2, "length string");
+        return static_cast<double>(valueLength(args[1]));
+    }
+    
+    if (sub == "index") {
+        requireArgs(3, 3, "index string charIndex");
+        size_t length = valueLength(args[1]);
+        long long index = parseIndex(toString(args[2]), length, currentLine);
+        if (index < 0 || static_cast<size_t>(index) >= length) return std::string();
+        if (std::holds_alternative<std::shared_ptr<Rope>>(args[1])) {
+            return std::string(1, std::get<std::shared_ptr<Rope>>(args[1])->at(index));
+        }
+        return std::string(1, toString(args[1])[index]);
+    }
+    
+    if (sub == "range") {
+        requireArgs(4, 4, "range string first last");
+        size_t length = valueLength(args[1]);
+        long long first = std::max(0LL, parseIndex(toString(args[2]), length, currentLine));
+        long long last = std::min(static_cast<long long>(length) - 1,
+                                  parseIndex(toString(args[3]), length, currentLine));
+        if (first > last) return std::string();
+        size_t count = static_cast<size_t>(last - first + 1);
+        if (std::holds_alternative<std::shared_ptr<Rope>>(args[1])) {
+            const Rope& rope = *std::get<std::shared_ptr<Rope>>(args[1]);
+            if (count < Rope::LEAF_SIZE) return rope.substr(first, count);
+            return std::make_shared<Rope>(rope.slice(first, count));
+        }
+        return toString(args[1]).substr(first, count);
+    }
+    
+    if (sub == "cat") {
+        size_t total = 0;
+        for (size_t i = 1; i < args.size(); i++) total += valueLength(args[i]);
+        if (total < Rope::LEAF_SIZE) {
+            std::string result;
+            result.reserve(total);
+            for (size_t i = 1; i < args.size(); i++) result += toString(args[i]);
+            return result;
+        }
+        auto rope = std::make_shared<Rope>();
+        for (size_t i = 1; i < args.size(); i++) {
+            if (std::holds_alternative<std::shared_ptr<Rope>>(args[i])) {
+                rope->append(*std::get<std::shared_ptr<Rope>>(args[i]));
+            } else {
+                rope->append(toString(args[i]));
+            }
+        }
+        return rope;
+    }
+    
+    if (sub == "toupper" || sub == "tolower") {
+        requireArgs(2, 2, "toupper|tolower string");
+        std::string text = toString(args[1]);
+        bool upper = sub == "toupper";
+        for (auto& c : text) {
+            c = upper ? toupper(static_cast<unsigned char>(c)) : tolower(static_cast<unsigned char>(c));
+        }
+        return text;
+    }
+    
+    if (sub == "repeat") {
+        requireArgs(3, 3, "repeat string count");
+        std::string text = toString(args[1]);
+        long long count = parseIndex(toString(args[2]), 0, currentLine);
+        std::string result;
+        if (count <= 0 || text.empty()) return result;
+        // 结果在存入变量前就已分配, 先确认长度的乘积不会溢出, 再确认它不会越过硬限制
+        if (static_cast<unsigned long long>(count) > result.max_size() / text.length()) {
+            throw MemoryLimitError("result of string repeat is too large", currentLine);
+        }
+        memory.check(text.length() * static_cast<size_t>(count));
+        result.reserve(text.length() * static_cast<size_t>(count));
+        for (long long i = 0; i < count; i++) result += text;
+        return result;
+    }
+    
+    if (sub == "reverse") {
+        requireArgs(2, 2, "reverse string");
+        std::string text = toString(args[1]);
+        std::reverse(text.begin(), text.end());
+        return text;
+    }
+    
+    if (sub == "equal" || sub == "compare") {
+        requireArgs(3, 3, "equal|compare string1 string2");
+        int cmp = toString(args[1]).compare(toString(args[2]));
+        if (sub == "equal") return cmp == 0;
+        return static_cast<double>((cmp > 0) - (cmp < 0));
+    }
+    
+    if (sub == "first" || sub == "last") {
+        requireArgs(3, 4, "first|last needleString haystackString ?index?");
+        std::string needle = toString(args[1]);
+        std::string haystack = toString(args[2]);
+        size_t found;
+        if (sub == "first") {
+            long long start = args.size() == 4 ? parseIndex(toString(args[3]), haystack.length(), currentLine) : 0;
+            found = StringKernels::find(haystack, needle, static_cast<size_t>(std::max(0LL, start)));
+        } else {
+            long long last = args.size() == 4 ? parseIndex(toString(args[3]), haystack.length(), currentLine)
+                                              : static_cast<long long>(haystack.length());
+            // 只考虑 lastIndex 及之前的字符, 匹配必须整个落在其中, 所以起点最多到 lastIndex - len + 1
+            long long start = last - static_cast<long long>(needle.length()) + 1;
+            found = start < 0 ? StringKernels::npos : StringKernels::rfind(haystack, needle, static_cast<size_t>(start));
+        }
+        return found == StringKernels::npos ? -1.0 : static_cast<double>(found);
+    }
+    
+    if (sub == "trim" || sub == "trimleft" || sub == "trimright") {
+        requireArgs(2, 3, "trim string ?chars?");
+        std::string text = toString(args[1]);
+        bool left = sub != "trimright", right = sub != "trimleft";
+        if (args.size() == 2) {
+            return std::string(StringKernels::trim(text, StringKernels::whitespace(), left, right));
+        }
+        StringKernels::CharSet chars(toString(args[2]));
+        return std::string(StringKernels::trim(text, chars, left, right));
+    }
+    
+    if (sub == "map") {
+        bool nocase = args.size() == 4 && toString(args[1]) == "-nocase";
+        requireArgs(nocase ? 4 : 3, nocase ? 4 : 3, "map ?-nocase? charMap string");
+        auto elements = Tokenizer::splitList(toString(args[nocase ? 2 : 1]));
+        if (elements.size() % 2 != 0) {
+            throw RuntimeError("char map list unbalanced", currentLine);
+        }
+        std::vector<std::pair<std::string, std::string>> mapping;
+        for (size_t i = 0; i < elements.size(); i += 2) {
+            mapping.emplace_back(elements[i], elements[i + 1]);
+        }
+        return StringKernels::map(toString(args.back()), mapping, nocase);
+    }
+    
+    if (sub == "match") {
+        bool nocase = false, useRegexp = false;
+        size_t i = 1;
+        for (; i + 2 < args.size(); i++) {
+            std::string option = toString(args[i]);
+            if (option == "-nocase") nocase = true;
+            else if (option == "-regexp") useRegexp = true;
+            else break;
+        }
+        if (args.size() - i != 2) {
+            throw RuntimeError("wrong # args: should be \"string match ?-nocase? ?-regexp? pattern string\"",
+                               currentLine);
+        }
+        std::string pattern = toString(args[i]);
+        if (useRegexp) return regex(pattern, nocase)->search(toString(args[i + 1]));
+        return globPattern(pattern, nocase)->matches(toString(args[i + 1]));
+    }
+    
+    throw RuntimeError("unknown or ambiguous subcommand \"" + sub + "\"", currentLine);
+}
+
+Value CommandHandler::handleSplit(const std::vector<Value>& args) {
+    if (args.empty() || args.size() > 2) {
+        throw RuntimeError("wrong # args: should be \"split string ?splitChars?\"", currentLine);
+    }
+    std::string text = toString(args[0]);
+    if (args.size() == 1) {
+        return Tokenizer::joinList(StringKernels::split(text, StringKernels::whitespace()));
+    }
+    StringKernels::CharSet chars(toString(args[1]));
+    return Tokenizer::joinList(StringKernels::split(text, chars));
+}
+
+Value CommandHandler::handleSwitch(const std::vector<Value>& args, const CompiledCommand* words) {
+    bool tail = tailPosition;
+    enum { EXACT, GLOB, REGEXP } mode = EXACT;
+    size_t i = 0;
+    
+    while (i < args.size()) {
+        std::string option = toString(args[i]);
+        if (option.empty() || option[0] != '-') break;
+        i++;
+        if (option == "--") break;
+        if (option == "-exact") mode = EXACT;
+        else if (option == "-glob") mode = GLOB;
+        else if (option == "-regexp") mode = REGEXP;
+        else throw RuntimeError("bad option \"" + option + "\": must be -exact, -glob, -regexp, or --", currentLine);
+    }
+    
+    if (args.size() - i < 2) {
+        throw RuntimeError("wrong # args: should be \"switch ?options? string pattern body ... ?default body?\"",
+                           currentLine);
+    }
+    std::string subject = toString(args[i++]);
+    
+    bool single = args.size() - i == 1;
+    auto arms = [&]() {
+        if (single) return Tokenizer::splitList(toString(args[i]));
+        std::vector<std::string> words;
+        for (size_t k = i; k < args.size(); k++) words.push_back(toString(args[k]));
+        return words;
     };
     
-    struct TryCatchBlock {
-        std::string catchVar;
-        int catchLine;
+    if (mode == REGEXP) {
+        std::vector<std::string> words = arms();
+        if (words.size() % 2 != 0) {
+            throw RuntimeError("extra switch pattern with no body", currentLine);
+        }
+        for (size_t k = 0; k < words.size(); k += 2) {
+            const std::string& pattern = words[k];
+            bool matched = pattern == "default" && k + 2 == words.size();
+            if (!matched && !regex(pattern, false)->search(subject)) continue;
+            
+            // 主体为 "-" 时穿透到下一个分支
+            while (k + 2 < words.size() && words[k + 1] == "-") k += 2;
+            if (words[k + 1] == "-") {
+                throw RuntimeError("no body specified for pattern \"" + words[k] + "\"", currentLine);
+            }
+            return evalScript(words[k + 1], tail);
+        }
+        return std::string();
+    }
+    
+    // -exact 与 -glob 编译成跳转表, 选择分支不再逐个比较。
+    // 分支全部写在常量单词里时以第一个分支单词为键, 命中缓存不必再看分支文本
+    SwitchTable::Mode tableMode = mode == GLOB ? SwitchTable::GLOB : SwitchTable::EXACT;
+    std::shared_ptr<const SwitchTable> table;
+    bool constant = words && words->words.size() == args.size() + 1;
+    for (size_t k = i; constant && k < args.size(); k++) constant = words->words[k + 1]->isConstant();
+    if (constant) {
+        const auto& first = words->words[i + 1];
+        const SwitchEntry* entry = switchCache.find(first.get());
+        if (entry && entry->mode == tableMode) {
+            table = entry->table;
+        } else {
+            table = compileSwitch(arms(), tableMode);
+            if (const SwitchEntry* stale = switchCache.find(first.get())) {
+                // 同一单词换了匹配方式, 旧的分支表被替换
+                memory.release(MemoryAccount::CODE, stale->table->memoryUsage());
+                switchCacheBytes -= stale->table->memoryUsage();
+            }
+            switchCache.insert(first.get(), SwitchEntry{first, tableMode, table});
+        }
+    } else {
+        std::string key(1, static_cast<char>('0' + mode));
+        if (single) {
+            key += toString(args[i]);
+        } else {
+            for (size_t k = i; k < args.size(); k++) {
+                key += '\0';
+                key += toString(args[k]);
+            }
+        }
+        table = switchTextCache.getOrCreate(key, [&]() { return compileSwitch(arms(), tableMode); });
+    }
+    const std::string* body = table->select(subject);
+    return body ? evalScript(*body, tail) : Value(std::string());
+}
+
+// 两个缓存中任一个将满时一起清空并退还记账, 不必逐个跟踪被淘汰的条目
+std::shared_ptr<const SwitchTable> CommandHandler::compileSwitch(const std::vector<std::string>& arms,
+                                                                 SwitchTable::Mode mode) {
+    // glob 分支与 string match 等命令共用同一个模式缓存
+    auto table = std::make_shared<const SwitchTable>(arms, mode, [this](const std::string& pattern) {
+        return globPattern(pattern, false);
+    });
+    if (switchCache.full() || switchTextCache.full()) {
+        switchCache.clear();
+        switchTextCache.clear();
+        memory.release(MemoryAccount::CODE, switchCacheBytes);
+        switchCacheBytes = 0;
+    }
+    memory.charge(MemoryAccount::CODE, table->memoryUsage());
+    switchCacheBytes += table->memoryUsage();
+    return table;
+}
+
+Value CommandHandler::handleRegexp(const std::vector<Value>& args) {
+    bool nocase = false, all = false, indices = false, inlineResult = false;
+    long long start = 0;
+    size_t i = 0;
+    
+    for (; i < args.size(); i++) {
+        std::string option = toString(args[i]);
+        if (option.empty() || option[0] != '-') break;
+        if (option == "--") {
+            i++;
+            break;
+        }
+        if (option == "-nocase") nocase = true;
+        else if (option == "-all") all = true;
+        else if (option == "-indices") indices = true;
+        else if (option == "-inline") inlineResult = true;
+        else if (option == "-start" && i + 1 < args.size()) start = parseIndex(toString(args[++i]), 0, currentLine);
+        else throw RuntimeError("bad option \"" + option + "\": must be -all, -indices, -inline, -nocase, -start, or --",
+                                currentLine);
+    }
+    if (args.size() - i < 2) {
+        throw RuntimeError("wrong # args: should be \"regexp ?-option ...? exp string ?matchVar? ?subMatchVar ...?\"",
+                           currentLine);
+    }
+    
+    auto re = regex(toString(args[i]), nocase);
+    std::string text = toString(args[i + 1]);
+    size_t firstVar = i + 2;
+    if (inlineResult && firstVar < args.size()) {
+        throw RuntimeError("regexp match variables not allowed when using -inline", currentLine);
+    }
+    size_t from = static_cast<size_t>(std::max(0LL, start));
+    
+    // 不需要匹配位置时只判断是否匹配, 完全走 DFA
+    if (!all && !inlineResult && firstVar == args.size()) {
+        return re->search(text, from) ? 1.0 : 0.0;
+    }
+    
+    auto describe = [&](const Regex::Captures& captures, size_t group) -> std::string {
+        long long begin = group < captures.size() ? captures[group].first : -1;
+        long long end = group < captures.size() ? captures[group].second : -1;
+        if (indices) return std::to_string(begin) + " " + std::to_string(begin < 0 ? -1 : end - 1);
+        return begin < 0 ? std::string() : text.substr(begin, end - begin);
     };
     
-    VariableManager& varManager;
-    ExpressionParser& exprParser;
-    DebugInfo debugInfo;
-    int currentLine = -1;
-    CallStack& callStack;
-    
-    std::map<std::string, Procedure> procedures;
-    std::map<std::string, std::shared_ptr<Table>> classes;
-    std::stack<TryCatchBlock> tryStack;
-    std::stack<std::string> loopStack;
-    
-public:
-    CommandHandler(VariableManager& vm, ExpressionParser& ep, CallStack& cs) 
-        : varManager(vm), exprParser(ep), callStack(cs) {}
-    
-    void setLineNumber(int line) { currentLine = line; }
-    
-    Value executeCommand(const std::string& cmd, const std::vector<std::string>& args);
-    
-private:
-    bool shouldBreak();
-    void enterDebugMode(const std::string& cmd, const std::vector<std::string>& args);
-    void handleDebugCommand(const std::string& cmd);
-    void printBacktrace();
-    void printVariables(const std::string& filter);
-    
-    Value handleSet(const std::vector<std::string>& args);
-    Value handleExpr(const std::vector<std::string>& args);
-    Value handlePuts(const std::vector<std::string>& args);
-    Value handleProc(const std::vector<std::string>& args);
-    Value handleIf(const std::vector<std::string>& args);
-    Value handleFor(const std::vector<std::string>& args);
-    Value handleIncr(const std::vector<std::string>& args);
-    Value handleReturn(const std::vector<std::string>& args);
-    Value handleString(const std::vector<std::string>& args);
-    Value handleWhile(const std::vector<std::string>& args);
-    Value handleSwitch(const std::vector<std::string>& args);
-    Value handleClass(const std::vector<std::string>& args);
-    Value handleNew(const std::vector<std::string>& args);
-    Value handleSetMetatable(const std::vector<std::string>& args);
-    Value handleTry(const std::vector<std::string>& args);
-    Value handleTable(const std::vector<std::string>& args);
-    Value handleBreakpoint(const std::vector<std::string>& args);
-    Value handleStep(const std::vector<std::string>& args);
-    Value handleMath(const std::vector<std::string>& args);
-    Value handleFile(const std::vector<std::string>& args);
-    Value handleModule(const std::vector<std::string>& args);
-    Value handleImport(const std::vector<std::string>& args);
-    Value executeProcedure(const std::string& name, const std::vector<std::string>& args);
-};
-
-#endif // COMMAND_HANDLER_H
-Value CommandHandler::executeCommand(const std::string& cmd, const std::vector<std::string>& args) {
-    if (cmd == "print") {
-        for (const auto& arg : args) {
-            std::cout << arg << " ";
+    std::vector<std::string> inlined;
+    Regex::Captures captures, last;
+    double count = 0;
+    while (from <= text.length() && re->exec(text, from, captures)) {
+        count++;
+        if (inlineResult) {
+            for (size_t g = 0; g <= re->groupCount(); g++) inlined.push_back(describe(captures, g));
         }
-        std::cout << std::endl;
-        return 0.0;
+        last = captures;
+        if (!all) break;
+        // 空匹配时至少前进一个字符
+        size_t end = static_cast<size_t>(captures[0].second);
+        from = end > static_cast<size_t>(captures[0].first) ? end : end + 1;
     }
-    return 0.0;
+    
+    if (inlineResult) return Tokenizer::joinList(inlined);
+    
+    for (size_t v = firstVar; v < args.size(); v++) {
+        size_t group = v - firstVar;
+        std::string value = count > 0 ? describe(last, group) : (indices ? "-1 -1" : "");
+        varManager.set(toString(args[v]), value, currentLine);
+    }
+    return count;
+}
+
+Value CommandHandler::handleRegsub(const std::vector<Value>& args) {
+    bool nocase = false, all = false;
+    long long start = 0;
+    size_t i = 0;
+    
+    for (; i < args.size(); i++) {
+        std::string option = toString(args[i]);
+        if (option.empty() || option[0] != '-') break;
+        if (option == "--") {
+            i++;
+            break;
+        }
+        if (option == "-nocase") nocase = true;
+        else if (option == "-all") all = true;
+        else if (option == "-start" && i + 1 < args.size()) start = parseIndex(toString(args[++i]), 0, currentLine);
+        else throw RuntimeError("bad option \"" + option + "\": must be -all, -nocase, -start, or --", currentLine);
+    }
+    if (args.size() - i < 3 || args.size() - i > 4) {
+        throw RuntimeError("wrong # args: should be \"regsub ?-option ...? exp string subSpec ?varName?\"",
+                           currentLine);
+    }
+    
+    auto re = regex(toString(args[i]), nocase);
+    std::string text = toString(args[i + 1]);
+    std::string subSpec = toString(args[i + 2]);
+    
+    std::string result;
+    Regex::Captures captures;
+    size_t from = static_cast<size_t>(std::max(0LL, start));
+    size_t copied = 0;
+    double count = 0;
+    
+    while (from <= text.length() && re->exec(text, from, captures)) {
+        count++;
+        size_t matchStart = static_cast<size_t>(captures[0].first);
+        size_t matchEnd = static_cast<size_t>(captures[0].second);
+        result.append(text, copied, matchStart - copied);
+        
+        // & 和 \0 为整个匹配, \1-\9 为分组
+        for (size_t k = 0; k < subSpec.length(); k++) {
+            char c = subSpec[k];
+            int group = -1;
+            if (c == '&') {
+                group = 0;
+            } else if (c == '\\' && k + 1 < subSpec.length()) {
+                char next = subSpec[++k];
+                if (isdigit(static_cast<unsigned char>(next))) group = next - '0';
+                else result += next;
+            } else {
+                result += c;
+            }
+            if (group >= 0 && static_cast<size_t>(group) < captures.size() && captures[group].first >= 0) {
+                result.append(text, captures[group].first, captures[group].second - captures[group].first);
+            }
+        }
+        
+        copied = matchEnd;
+        if (!all) break;
+        if (matchEnd == matchStart) {
+            if (matchEnd < text.length()) result += text[matchEnd];
+            copied = matchEnd + 1;
+        }
+        from = copied;
+    }
+    if (copied < text.length()) result.append(text, copied, std::string::npos);
+    
+    if (args.size() - i == 4) {
+        varManager.set(toString(args[i + 3]), result, currentLine);
+        return count;
+    }
+    return result;
 }
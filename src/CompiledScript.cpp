@@ -0,0 +1,55 @@
+#include "CompiledScript.h"
+#include "Tokenizer.h"
+#include "MemoryAccount.h"
+#include <sstream>
+
+std::shared_ptr<const CompiledCommand> CompiledCommand::compile(const std::string& line, int lineNumber,
+                                                                const Upvalues* upvalues) {
+    auto compiled = std::make_shared<CompiledCommand>();
+    for (const auto& token : Tokenizer::tokenize(line, lineNumber)) {
+        compiled->words.push_back(SubstTemplate::compile(token, upvalues));
+    }
+    
+    compiled->codeBytes = sizeof(CompiledCommand) + MemoryAccount::footprint(line) +
+                          compiled->words.capacity() * sizeof(compiled->words[0]);
+    for (const auto& word : compiled->words) compiled->codeBytes += word->memoryUsage();
+    return compiled;
+}
+
+std::shared_ptr<const CompiledScript> CompiledScript::compile(const std::string& script,
+                                                              const CommandCompiler& compileCommand) {
+    auto compiled = std::make_shared<CompiledScript>();
+    std::istringstream iss(script);
+    std::string line, pending;
+    int lineNumber = 0, startLine = 0;
+    
+    // 括号或引号未闭合时把后续行拼接到同一条命令中
+    while (std::getline(iss, line)) {
+        lineNumber++;
+        if (pending.empty()) {
+            startLine = lineNumber;
+            pending = line;
+        } else {
+            pending += '\n' + line;
+        }
+        size_t first = pending.find_first_not_of(" \t");
+        bool comment = first != std::string::npos && pending[first] == '#';
+        if (!comment && !Tokenizer::isComplete(pending)) continue;
+        
+        auto command = compileCommand(pending);
+        if (!command->words.empty()) compiled->commands.emplace_back(startLine, command);
+        pending.clear();
+    }
+    if (!pending.empty()) {
+        auto command = compileCommand(pending);
+        if (!command->words.empty()) compiled->commands.emplace_back(startLine, command);
+    }
+    
+    compiled->codeBytes = sizeof(CompiledScript) + MemoryAccount::footprint(script) +
+                          compiled->commands.capacity() * sizeof(compiled->commands[0]);
+    return compiled;
+}
+
+std::shared_ptr<const CompiledScript> CompiledScript::compile(const std::string& script) {
+    return compile(script, [](const std::string& line) { return CompiledCommand::compile(line); });
+}
@@ -1,63 +1,897 @@
-#ifndef EXPRESSION_PARSER_H
-#define EXPRESSION_PARSER_H
-
-#include <vector>
-#include <string>
-#include <variant>
-#include <memory>
-#include <unordered_map>
-#include <stack>
-#include <functional>
-
-#include "Table.h"
-#include "VariableManager.h"
-#include "InterpreterException.h"
-
-class ExpressionParser {
-private:
-    VariableManager& varManager;
-    int currentLine = -1;
-    
-    enum TokenType { NUMBER, OPERATOR, VARIABLE, STRING, BRACE, BRACKET, END, IDENTIFIER };
-    
-    struct Token {
-        TokenType type;
-        std::string value;
-        double numValue = 0.0;
+#include "ExpressionParser.h"
+#include "Tokenizer.h"
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+namespace {
+
+struct BinaryOperator {
+    const char* symbol;
+    ExpressionParser::Op op;
+    int precedence;
+};
+
+// 优先级从低到高, ** 为右结合
+const BinaryOperator BINARY_OPERATORS[] = {
+    {"||", ExpressionParser::OR, 1},
+    {"&&", ExpressionParser::AND, 2},
+    {"|", ExpressionParser::BIT_OR, 3},
+    {"^", ExpressionParser::BIT_XOR, 4},
+    {"&", ExpressionParser::BIT_AND, 5},
+    {"eq", ExpressionParser::STR_EQ, 6},
+    {"ne", ExpressionParser::STR_NE, 6},
+    {"==", ExpressionParser::EQ, 7},
+    {"!=", ExpressionParser::NE, 7},
+    {"<", ExpressionParser::LT, 8},
+    {">", ExpressionParser::GT, 8},
+    {"<=", ExpressionParser::LE, 8},
+    {">=", ExpressionParser::GE, 8},
+    {"<<", ExpressionParser::SHL, 9},
+    {">>", ExpressionParser::SHR, 9},
+    {"+", ExpressionParser::ADD, 10},
+    {"-", ExpressionParser::SUB, 10},
+    {"*", ExpressionParser::MUL, 11},
+    {"/", ExpressionParser::DIV, 11},
+    {"%", ExpressionParser::MOD, 11},
+    {"**", ExpressionParser::POW, 12},
+};
+
+const int POW_PRECEDENCE = 12;
+
+// 按长度从长到短匹配, 保证 ** 不会被拆成两个 *
+const char* const OPERATOR_SYMBOLS[] = {
+    "**", "<<", ">>", "<=", ">=", "==", "!=", "&&", "||",
+    "+", "-", "*", "/", "%", "<", ">", "!", "~", "&", "|", "^", "?", ":", "(", ")", ","
+};
+
+const char* opSymbol(ExpressionParser::Op op) {
+    switch (op) {
+        case ExpressionParser::NEG: return "-";
+        case ExpressionParser::PLUS: return "+";
+        case ExpressionParser::NOT: return "!";
+        case ExpressionParser::BIT_NOT: return "~";
+        default: break;
+    }
+    for (const auto& entry : BINARY_OPERATORS) {
+        if (entry.op == op) return entry.symbol;
+    }
+    return "?";
+}
+
+bool isComparison(ExpressionParser::Op op) {
+    return op == ExpressionParser::EQ || op == ExpressionParser::NE || op == ExpressionParser::LT ||
+           op == ExpressionParser::GT || op == ExpressionParser::LE || op == ExpressionParser::GE;
+}
+
+bool equalsIgnoreCase(const std::string& text, const char* word) {
+    size_t length = strlen(word);
+    if (text.length() != length) return false;
+    for (size_t i = 0; i < length; i++) {
+        if (tolower(static_cast<unsigned char>(text[i])) != word[i]) return false;
+    }
+    return true;
+}
+
+bool isNameChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// 与 SubstTemplate 相同的变量名规则: name, ns::name, table.field, table(key)
+size_t scanVariableName(const std::string& text, size_t pos) {
+    while (pos < text.length()) {
+        if (isNameChar(text[pos])) {
+            pos++;
+        } else if (text[pos] == ':' && pos + 2 < text.length() && text[pos + 1] == ':' && isNameChar(text[pos + 2])) {
+            pos += 2;
+        } else if (text[pos] == '.' && pos + 1 < text.length() && isNameChar(text[pos + 1])) {
+            pos++;
+        } else if (text[pos] == '(') {
+            size_t close = text.find(')', pos);
+            if (close == std::string::npos) break;
+            return close + 1;
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
+
+// 跳过配对的括号块, 返回右括号之后的位置, 未闭合时返回 npos
+size_t skipBalanced(const std::string& text, size_t pos, char open, char close) {
+    int depth = 0;
+    while (pos < text.length()) {
+        char c = text[pos];
+        if (c == '\\' && pos + 1 < text.length()) {
+            pos += 2;
+            continue;
+        }
+        if (c == open) depth++;
+        else if (c == close && --depth == 0) return pos + 1;
+        pos++;
+    }
+    return std::string::npos;
+}
+
+void mergeVariables(std::vector<std::string>& into, const std::vector<std::string>& from) {
+    if (from.empty()) return;
+    std::vector<std::string> merged;
+    merged.reserve(into.size() + from.size());
+    std::set_union(into.begin(), into.end(), from.begin(), from.end(), std::back_inserter(merged));
+    into.swap(merged);
+}
+
+} // namespace
+
+ExpressionParser::LoopScope::LoopScope(ExpressionParser& parser, const std::unordered_set<std::string>* written)
+    : parser(parser) {
+    parser.loops.push_back({written, {}});
+}
+
+ExpressionParser::LoopScope::~LoopScope() {
+    parser.loops.pop_back();
+}
+
+void ExpressionParser::setOptimizationLevel(int level) {
+    optimizationLevel = std::max(0, std::min(level, 2));
+    compiledCache.clear();
+}
+
+// ---------------------------------------------------------------------------
+// 词法分析
+
+void ExpressionParser::tokenizeExpression(const std::string& expr) {
+    tokens.clear();
+    currentToken = 0;
+    size_t pos = 0;
+
+    while (pos < expr.length()) {
+        char c = expr[pos];
+        if (isspace(static_cast<unsigned char>(c))) {
+            pos++;
+            continue;
+        }
+
+        if (isdigit(static_cast<unsigned char>(c)) ||
+            (c == '.' && pos + 1 < expr.length() && isdigit(static_cast<unsigned char>(expr[pos + 1])))) {
+            char* end = nullptr;
+            double value = std::strtod(expr.c_str() + pos, &end);
+            size_t length = end - (expr.c_str() + pos);
+            if (pos + length < expr.length() && isNameChar(expr[pos + length])) {
+                throw RuntimeError("invalid number in expression \"" + expr + "\"", currentLine);
+            }
+            tokens.push_back({NUMBER, expr.substr(pos, length), value});
+            pos += length;
+            continue;
+        }
+
+        if (c == '$') {
+            size_t end;
+            if (pos + 1 < expr.length() && expr[pos + 1] == '{') {
+                end = expr.find('}', pos + 2);
+                if (end == std::string::npos) {
+                    throw RuntimeError("missing close-brace for variable name", currentLine);
+                }
+                end++;
+            } else {
+                end = scanVariableName(expr, pos + 1);
+            }
+            if (end == pos + 1) {
+                throw RuntimeError("invalid character \"$\" in expression \"" + expr + "\"", currentLine);
+            }
+            tokens.push_back({VARIABLE, expr.substr(pos, end - pos)});
+            pos = end;
+            continue;
+        }
+
+        if (c == '"' || c == '{' || c == '[') {
+            size_t end;
+            if (c == '"') {
+                end = pos + 1;
+                while (end < expr.length() && expr[end] != '"') {
+                    if (expr[end] == '\\' && end + 1 < expr.length()) end += 2;
+                    else if (expr[end] == '[') {
+                        size_t close = Tokenizer::matchBracket(expr, end);
+                        end = close == std::string::npos ? expr.length() : close + 1;
+                    } else {
+                        end++;
+                    }
+                }
+                end = end < expr.length() ? end + 1 : std::string::npos;
+            } else if (c == '{') {
+                end = skipBalanced(expr, pos, '{', '}');
+            } else {
+                end = Tokenizer::matchBracket(expr, pos);
+                if (end != std::string::npos) end++;
+            }
+            if (end == std::string::npos) {
+                throw RuntimeError(std::string("missing close ") + (c == '"' ? "quote" : c == '{' ? "brace" : "bracket") +
+                                   " in expression \"" + expr + "\"", currentLine);
+            }
+            tokens.push_back({c == '"' ? STRING : c == '{' ? BRACE : BRACKET, expr.substr(pos, end - pos)});
+            pos = end;
+            continue;
+        }
+
+        if (isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            size_t end = pos;
+            while (end < expr.length() && isNameChar(expr[end])) end++;
+            std::string word = expr.substr(pos, end - pos);
+            tokens.push_back({word == "eq" || word == "ne" ? OPERATOR : IDENTIFIER, word});
+            pos = end;
+            continue;
+        }
+
+        bool matched = false;
+        for (const char* symbol : OPERATOR_SYMBOLS) {
+            size_t length = strlen(symbol);
+            if (expr.compare(pos, length, symbol) == 0) {
+                tokens.push_back({OPERATOR, symbol});
+                pos += length;
+                matched = true;
+                break;
+            }
+        }
+        if (!matched) {
+            throw RuntimeError(std::string("invalid character \"") + c + "\" in expression \"" + expr + "\"",
+                               currentLine);
+        }
+    }
+
+    tokens.push_back({END, ""});
+}
+
+const ExpressionParser::Token& ExpressionParser::peek() const {
+    return tokens[currentToken];
+}
+
+ExpressionParser::Token ExpressionParser::consume() {
+    Token token = tokens[currentToken];
+    if (token.type != END) currentToken++;
+    return token;
+}
+
+bool ExpressionParser::peekOperator(const char* op) const {
+    return peek().type == OPERATOR && peek().value == op;
+}
+
+void ExpressionParser::expectOperator(const char* op) {
+    if (!peekOperator(op)) {
+        std::string found = peek().type == END ? "end of expression" : "\"" + peek().value + "\"";
+        throw RuntimeError(std::string("syntax error in expression: expected \"") + op + "\" but found " + found,
+                           currentLine);
+    }
+    consume();
+}
+
+// ---------------------------------------------------------------------------
+// 语法分析: 递归下降, 二元运算按优先级爬升
+
+ExpressionParser::NodePtr ExpressionParser::parse(const std::string& expr) {
+    tokenizeExpression(expr);
+    if (peek().type == END) {
+        throw RuntimeError("empty expression", currentLine);
+    }
+    NodePtr root = parseTernary();
+    if (peek().type != END) {
+        throw RuntimeError("syntax error in expression \"" + expr + "\": unexpected \"" + peek().value + "\"",
+                           currentLine);
+    }
+    tokens.clear();
+    return root;
+}
+
+ExpressionParser::NodePtr ExpressionParser::parseTernary() {
+    NodePtr condition = parseExpression(1);
+    if (!peekOperator("?")) return condition;
+    consume();
+    NodePtr whenTrue = parseTernary();
+    expectOperator(":");
+    NodePtr whenFalse = parseTernary();
+    return makeTernary(condition, whenTrue, whenFalse);
+}
+
+ExpressionParser::NodePtr ExpressionParser::parseExpression(int precedence) {
+    NodePtr left = parseUnary();
+    while (peek().type == OPERATOR) {
+        const BinaryOperator* found = nullptr;
+        for (const auto& entry : BINARY_OPERATORS) {
+            if (peek().value == entry.symbol) {
+                found = &entry;
+                break;
+            }
+        }
+        if (!found || found->precedence < precedence) break;
+        consume();
+        int next = found->precedence == POW_PRECEDENCE ? found->precedence : found->precedence + 1;
+        NodePtr right = parseExpression(next);
+        left = makeBinary(found->op, left, right);
+    }
+    return left;
+}
+
+ExpressionParser::NodePtr ExpressionParser::parseUnary() {
+    if (peek().type == OPERATOR) {
+        Op op;
+        if (peek().value == "-") op = NEG;
+        else if (peek().value == "+") op = PLUS;
+        else if (peek().value == "!") op = NOT;
+        else if (peek().value == "~") op = BIT_NOT;
+        else return parsePrimary();
+        consume();
+        // 一元运算符比 ** 绑定得松: -2**2 为 -4
+        NodePtr operand = peek().type == OPERATOR ? parseUnary() : parseExpression(POW_PRECEDENCE);
+        return makeUnary(op, operand);
+    }
+    return parsePrimary();
+}
+
+ExpressionParser::NodePtr ExpressionParser::parsePrimary() {
+    Token token = consume();
+    switch (token.type) {
+        case NUMBER:
+            return makeConstant(token.numValue);
+        case BRACE:
+            return makeConstant(token.value.substr(1, token.value.length() - 2));
+        case STRING:
+        case VARIABLE:
+            return makeWord(token.value);
+        case BRACKET: {
+            auto node = std::make_shared<Node>();
+            node->kind = Node::COMMAND;
+            node->text = token.value.substr(1, token.value.length() - 2);
+            node->pure = false;
+            return node;
+        }
+        case IDENTIFIER: {
+            if (peekOperator("(")) {
+                consume();
+                std::vector<NodePtr> args;
+                if (!peekOperator(")")) {
+                    args.push_back(parseTernary());
+                    while (peekOperator(",")) {
+                        consume();
+                        args.push_back(parseTernary());
+                    }
+                }
+                expectOperator(")");
+                return makeFunction(token.value, std::move(args));
+            }
+            static const char* const BOOLEANS[] = {"true", "false", "yes", "no", "on", "off"};
+            for (const char* word : BOOLEANS) {
+                if (equalsIgnoreCase(token.value, word)) return makeConstant(token.value);
+            }
+            throw RuntimeError("invalid bareword \"" + token.value + "\"", currentLine);
+        }
+        case OPERATOR:
+            if (token.value == "(") {
+                NodePtr inner = parseTernary();
+                expectOperator(")");
+                return inner;
+            }
+            throw RuntimeError("syntax error in expression: unexpected \"" + token.value + "\"", currentLine);
+        default:
+            throw RuntimeError("syntax error in expression: missing operand", currentLine);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// 节点构造, -O1 起在这里折叠常量
+
+ExpressionParser::NodePtr ExpressionParser::makeConstant(Value value) const {
+    auto node = std::make_shared<Node>();
+    node->kind = Node::CONSTANT;
+    node->constant = std::move(value);
+    return node;
+}
+
+ExpressionParser::NodePtr ExpressionParser::makeWord(const std::string& word) const {
+    auto tmpl = SubstTemplate::compile(word);
+    if (tmpl->isConstant()) return makeConstant(*tmpl->constantValue());
+
+    auto node = std::make_shared<Node>();
+    const auto& segments = tmpl->getSegments();
+    // 单独的 $name 直接查变量, 不经过模板
+    if (segments.size() == 1 && segments[0].kind == SubstTemplate::VARIABLE && word.front() == '$') {
+        node->kind = Node::VARIABLE;
+        node->text = segments[0].text;
+        node->symbol = segments[0].symbol;
+        node->variables.push_back(node->text);
+        return node;
+    }
+
+    node->kind = Node::TEMPLATE;
+    node->word = tmpl;
+    for (const auto& segment : segments) {
+        if (segment.kind == SubstTemplate::VARIABLE) node->variables.push_back(segment.text);
+        if (segment.kind == SubstTemplate::COMMAND) node->pure = false;
+    }
+    std::sort(node->variables.begin(), node->variables.end());
+    node->variables.erase(std::unique(node->variables.begin(), node->variables.end()), node->variables.end());
+    return node;
+}
+
+namespace {
+
+// 子表达式读取的变量都可能被循环体改写时才值得缓存; 表字段可能经由别名修改, 不参与
+bool canHoist(const ExpressionParser::Node& node) {
+    if (!node.pure || node.variables.empty()) return false;
+    for (const auto& name : node.variables) {
+        if (name.find_first_of(".(") != std::string::npos) return false;
+    }
+    return true;
+}
+
+void inheritOperands(ExpressionParser::Node& node) {
+    for (const auto& operand : node.operands) {
+        mergeVariables(node.variables, operand->variables);
+        node.pure = node.pure && operand->pure;
+    }
+    node.hoistable = canHoist(node);
+}
+
+bool allConstant(const std::vector<ExpressionParser::NodePtr>& operands) {
+    for (const auto& operand : operands) {
+        if (operand->kind != ExpressionParser::Node::CONSTANT) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+ExpressionParser::NodePtr ExpressionParser::makeUnary(Op op, NodePtr operand) const {
+    if (optimizationLevel >= 1 && operand->kind == Node::CONSTANT) {
+        try {
+            return makeConstant(applyUnaryOp(op, operand->constant));
+        } catch (const InterpreterException&) {
+            // 折叠失败的表达式保留原样, 错误留到运行时报告
+        }
+    }
+    auto node = std::make_shared<Node>();
+    node->kind = Node::UNARY;
+    node->op = op;
+    node->operands.push_back(std::move(operand));
+    inheritOperands(*node);
+    return node;
+}
+
+ExpressionParser::NodePtr ExpressionParser::makeBinary(Op op, NodePtr left, NodePtr right) const {
+    if (optimizationLevel >= 1 && left->kind == Node::CONSTANT) {
+        try {
+            if (right->kind == Node::CONSTANT) {
+                return makeConstant(applyBinaryOp(op, left->constant, right->constant));
+            }
+            // 短路运算的左侧为常量时, 结果可能已经确定
+            if (op == AND && !isTruthy(left->constant)) return makeConstant(0.0);
+            if (op == OR && isTruthy(left->constant)) return makeConstant(1.0);
+        } catch (const InterpreterException&) {
+        }
+    }
+
+    auto node = std::make_shared<Node>();
+    // 变量与数值常量比较是循环条件里最常见的形式, 融合为一个节点
+    double number;
+    if (optimizationLevel >= 2 && isComparison(op) && left->kind == Node::VARIABLE &&
+        right->kind == Node::CONSTANT && toNumber(right->constant, number)) {
+        node->kind = Node::COMPARE_VAR_CONST;
+        node->op = op;
+        node->text = left->text;
+        node->symbol = left->symbol;
+        node->constant = number;
+        node->variables = left->variables;
+        node->hoistable = canHoist(*node);
+        return node;
+    }
+
+    node->kind = Node::BINARY;
+    node->op = op;
+    node->operands.push_back(std::move(left));
+    node->operands.push_back(std::move(right));
+    inheritOperands(*node);
+    return node;
+}
+
+ExpressionParser::NodePtr ExpressionParser::makeTernary(NodePtr condition, NodePtr whenTrue, NodePtr whenFalse) const {
+    if (optimizationLevel >= 1 && condition->kind == Node::CONSTANT) {
+        try {
+            return isTruthy(condition->constant) ? whenTrue : whenFalse;
+        } catch (const InterpreterException&) {
+        }
+    }
+    auto node = std::make_shared<Node>();
+    node->kind = Node::TERNARY;
+    node->operands = {std::move(condition), std::move(whenTrue), std::move(whenFalse)};
+    inheritOperands(*node);
+    return node;
+}
+
+ExpressionParser::NodePtr ExpressionParser::makeFunction(const std::string& name, std::vector<NodePtr> args) const {
+    if (optimizationLevel >= 1 && allConstant(args)) {
+        try {
+            std::vector<Value> values;
+            for (const auto& arg : args) values.push_back(arg->constant);
+            return makeConstant(applyFunction(name, values));
+        } catch (const InterpreterException&) {
+        }
+    }
+    auto node = std::make_shared<Node>();
+    node->kind = Node::FUNCTION;
+    node->text = name;
+    node->operands = std::move(args);
+    inheritOperands(*node);
+    return node;
+}
+
+// ---------------------------------------------------------------------------
+// 编译与求值
+
+ExpressionParser::NodePtr ExpressionParser::compile(const std::string& expr) {
+    if (optimizationLevel == 0) return parse(expr);
+    if (const NodePtr* cached = compiledCache.find(expr)) return *cached;
+    return compiledCache.insert(expr, parse(expr));
+}
+
+Value ExpressionParser::evaluate(const std::string& expr, int line) {
+    int savedLine = currentLine;
+    currentLine = line;
+    try {
+        NodePtr node = compile(expr);
+        Value result = eval(*node);
+        currentLine = savedLine;
+        return result;
+    } catch (...) {
+        currentLine = savedLine;
+        throw;
+    }
+}
+
+Value ExpressionParser::evaluate(const NodePtr& expr, int line) {
+    int savedLine = currentLine;
+    currentLine = line;
+    try {
+        Value result = eval(*expr);
+        currentLine = savedLine;
+        return result;
+    } catch (...) {
+        currentLine = savedLine;
+        throw;
+    }
+}
+
+Value ExpressionParser::eval(const Node& node) {
+    if (node.hoistable && !loops.empty() && loops.back().written) {
+        LoopFrame& frame = loops.back();
+        auto it = frame.hoisted.find(&node);
+        if (it != frame.hoisted.end()) {
+            if (it->second.invariant) return it->second.value;
+            return evalUncached(node);
+        }
+        bool invariant = true;
+        for (const auto& name : node.variables) {
+            if (frame.written->count(name)) {
+                invariant = false;
+                break;
+            }
+        }
+        Value value = evalUncached(node);
+        // 求值过程中可能进入了内层循环, 重新取当前帧
+        loops.back().hoisted.emplace(&node, HoistedValue{node.shared_from_this(), invariant, invariant ? value : Value()});
+        return value;
+    }
+    return evalUncached(node);
+}
+
+Value ExpressionParser::evalUncached(const Node& node) {
+    switch (node.kind) {
+        case Node::CONSTANT:
+            return node.constant;
+        case Node::VARIABLE:
+            if (const Value* slot = varManager.lookup(node.text, node.symbol)) return *slot;
+            return varManager.get(node.text, currentLine);
+        case Node::TEMPLATE:
+            if (!commandEvaluator && !node.pure) {
+                throw RuntimeError("no command evaluator installed", currentLine);
+            }
+            return node.word->evaluate(varManager, commandEvaluator, currentLine);
+        case Node::COMMAND:
+            if (!commandEvaluator) {
+                throw RuntimeError("no command evaluator installed", currentLine);
+            }
+            return commandEvaluator(node.text);
+        case Node::UNARY:
+            return applyUnaryOp(node.op, eval(*node.operands[0]));
+        case Node::BINARY: {
+            if (node.op == AND || node.op == OR) {
+                bool left = isTruthy(eval(*node.operands[0]));
+                if (node.op == AND && !left) return 0.0;
+                if (node.op == OR && left) return 1.0;
+                return isTruthy(eval(*node.operands[1])) ? 1.0 : 0.0;
+            }
+            Value left = eval(*node.operands[0]);
+            return applyBinaryOp(node.op, left, eval(*node.operands[1]));
+        }
+        case Node::TERNARY:
+            return isTruthy(eval(*node.operands[0])) ? eval(*node.operands[1]) : eval(*node.operands[2]);
+        case Node::FUNCTION: {
+            std::vector<Value> args;
+            args.reserve(node.operands.size());
+            for (const auto& operand : node.operands) args.push_back(eval(*operand));
+            return applyFunction(node.text, args);
+        }
+        case Node::COMPARE_VAR_CONST: {
+            const Value* slot = varManager.lookup(node.text, node.symbol);
+            if (slot && std::holds_alternative<double>(*slot)) {
+                return compareNumbers(node.op, std::get<double>(*slot), std::get<double>(node.constant)) ? 1.0 : 0.0;
+            }
+            Value left = slot ? *slot : varManager.get(node.text, currentLine);
+            return applyBinaryOp(node.op, left, node.constant);
+        }
+    }
+    return std::string();
+}
+
+// ---------------------------------------------------------------------------
+// 运算
+
+bool ExpressionParser::toNumber(const Value& value, double& number) {
+    if (std::holds_alternative<double>(value)) {
+        number = std::get<double>(value);
+        return true;
+    }
+    if (std::holds_alternative<bool>(value)) {
+        number = std::get<bool>(value) ? 1.0 : 0.0;
+        return true;
+    }
+    std::string text;
+    if (std::holds_alternative<std::string>(value)) {
+        text = std::get<std::string>(value);
+    } else if (std::holds_alternative<std::shared_ptr<Rope>>(value)) {
+        text = std::get<std::shared_ptr<Rope>>(value)->str();
+    } else {
+        return false;
+    }
+
+    size_t begin = 0, end = text.length();
+    while (begin < end && isspace(static_cast<unsigned char>(text[begin]))) begin++;
+    while (end > begin && isspace(static_cast<unsigned char>(text[end - 1]))) end--;
+    if (begin == end) return false;
+    // strtod 也接受 inf 和 nan, 这里只认数字开头的文本
+    size_t digit = begin + (text[begin] == '+' || text[begin] == '-');
+    if (digit >= end || !(isdigit(static_cast<unsigned char>(text[digit])) || text[digit] == '.')) return false;
+
+    const char* start = text.c_str() + begin;
+    char* stop = nullptr;
+    double parsed = std::strtod(start, &stop);
+    if (stop != text.c_str() + end) return false;
+    number = parsed;
+    return true;
+}
+
+bool ExpressionParser::compareNumbers(Op op, double left, double right) {
+    switch (op) {
+        case EQ: return left == right;
+        case NE: return left != right;
+        case LT: return left < right;
+        case GT: return left > right;
+        case LE: return left <= right;
+        case GE: return left >= right;
+        default: return false;
+    }
+}
+
+bool ExpressionParser::isTruthy(const Value& val) const {
+    if (std::holds_alternative<bool>(val)) return std::get<bool>(val);
+    if (std::holds_alternative<std::nullptr_t>(val)) return false;
+    if (std::holds_alternative<std::shared_ptr<Table>>(val)) return true;
+    double number;
+    if (toNumber(val, number)) return number != 0.0;
+
+    std::string text = valueToString(val);
+    for (const char* word : {"true", "yes", "on"}) {
+        if (equalsIgnoreCase(text, word)) return true;
+    }
+    for (const char* word : {"false", "no", "off"}) {
+        if (equalsIgnoreCase(text, word)) return false;
+    }
+    throw RuntimeError("expected boolean value but got \"" + text + "\"", currentLine);
+}
+
+namespace {
+
+double numericOperand(const Value& value, ExpressionParser::Op op, int line) {
+    double number;
+    if (!ExpressionParser::toNumber(value, number)) {
+        throw RuntimeError("can't use non-numeric string \"" + ExpressionParser::valueToString(value) +
+                           "\" as operand of \"" + opSymbol(op) + "\"", line);
+    }
+    return number;
+}
+
+long long integerOperand(const Value& value, ExpressionParser::Op op, int line) {
+    double number = numericOperand(value, op, line);
+    if (!std::isfinite(number) || number != std::floor(number) || std::fabs(number) >= 9.2e18) {
+        throw RuntimeError("can't use floating-point value \"" + ExpressionParser::valueToString(value) +
+                           "\" as operand of \"" + opSymbol(op) + "\"", line);
+    }
+    return static_cast<long long>(number);
+}
+
+} // namespace
+
+Value ExpressionParser::applyUnaryOp(Op op, const Value& operand) const {
+    switch (op) {
+        case NEG: return -numericOperand(operand, op, currentLine);
+        case PLUS: return numericOperand(operand, op, currentLine);
+        case NOT: return isTruthy(operand) ? 0.0 : 1.0;
+        case BIT_NOT: return static_cast<double>(~integerOperand(operand, op, currentLine));
+        default: break;
+    }
+    throw RuntimeError(std::string("unknown unary operator \"") + opSymbol(op) + "\"", currentLine);
+}
+
+Value ExpressionParser::applyBinaryOp(Op op, const Value& left, const Value& right) const {
+    switch (op) {
+        case OR: return isTruthy(left) || isTruthy(right) ? 1.0 : 0.0;
+        case AND: return isTruthy(left) && isTruthy(right) ? 1.0 : 0.0;
+        case STR_EQ: return valueToString(left) == valueToString(right) ? 1.0 : 0.0;
+        case STR_NE: return valueToString(left) != valueToString(right) ? 1.0 : 0.0;
+        case EQ: case NE: case LT: case GT: case LE: case GE: {
+            // 两边都是数字时按数值比较, 否则按字符串比较
+            double a, b;
+            if (toNumber(left, a) && toNumber(right, b)) return compareNumbers(op, a, b) ? 1.0 : 0.0;
+            int cmp = valueToString(left).compare(valueToString(right));
+            return compareNumbers(op, cmp, 0) ? 1.0 : 0.0;
+        }
+        case ADD: return numericOperand(left, op, currentLine) + numericOperand(right, op, currentLine);
+        case SUB: return numericOperand(left, op, currentLine) - numericOperand(right, op, currentLine);
+        case MUL: return numericOperand(left, op, currentLine) * numericOperand(right, op, currentLine);
+        case DIV: {
+            double a = numericOperand(left, op, currentLine);
+            double b = numericOperand(right, op, currentLine);
+            if (b == 0.0) throw RuntimeError("divide by zero", currentLine);
+            return a / b;
+        }
+        case POW: {
+            double a = numericOperand(left, op, currentLine);
+            double b = numericOperand(right, op, currentLine);
+            if (a == 0.0 && b < 0.0) throw RuntimeError("exponentiation of zero by negative power", currentLine);
+            return std::pow(a, b);
+        }
+        default: break;
+    }
+
+    long long a = integerOperand(left, op, currentLine);
+    long long b = integerOperand(right, op, currentLine);
+    switch (op) {
+        case MOD: {
+            if (b == 0) throw RuntimeError("divide by zero", currentLine);
+            if (b == -1) return 0.0;
+            // 余数与除数同号
+            long long r = a % b;
+            if (r != 0 && (r < 0) != (b < 0)) r += b;
+            return static_cast<double>(r);
+        }
+        case BIT_OR: return static_cast<double>(a | b);
+        case BIT_XOR: return static_cast<double>(a ^ b);
+        case BIT_AND: return static_cast<double>(a & b);
+        case SHL: case SHR: {
+            if (b < 0) throw RuntimeError("negative shift argument", currentLine);
+            if (op == SHR) return static_cast<double>(b >= 64 ? (a < 0 ? -1 : 0) : a >> b);
+            if (b >= 64) return 0.0;
+            return static_cast<double>(static_cast<long long>(static_cast<unsigned long long>(a) << b));
+        }
+        default: break;
+    }
+    throw RuntimeError(std::string("unknown operator \"") + opSymbol(op) + "\"", currentLine);
+}
+
+Value ExpressionParser::applyFunction(const std::string& name, const std::vector<Value>& args) const {
+    struct UnaryFunction {
+        const char* name;
+        double (*fn)(double);
     };
-    
-    std::vector<Token> tokens;
-    size_t currentToken = 0;
-    
-    std::unordered_map<std::string, int> opPrecedence = {
-        {"||", 1}, {"&&", 2},
-        {"==", 3}, {"!=", 3}, {"<", 4}, {">", 4}, {"<=", 4}, {">=", 4},
-        {"|", 5}, {"^", 6}, {"&", 7},
-        {"<<", 8}, {">>", 8},
-        {"+", 9}, {"-", 9},
-        {"*", 10}, {"/", 10}, {"%", 10},
-        {"!", 11}, {"~", 11},
-        {"^", 12}
+    static const UnaryFunction UNARY_FUNCTIONS[] = {
+        {"abs", [](double x) { return std::fabs(x); }},
+        {"ceil", [](double x) { return std::ceil(x); }},
+        {"floor", [](double x) { return std::floor(x); }},
+        {"round", [](double x) { return std::round(x); }},
+        {"int", [](double x) { return std::trunc(x); }},
+        {"double", [](double x) { return x; }},
+        {"sqrt", [](double x) { return std::sqrt(x); }},
+        {"exp", [](double x) { return std::exp(x); }},
+        {"log", [](double x) { return std::log(x); }},
+        {"log10", [](double x) { return std::log10(x); }},
+        {"sin", [](double x) { return std::sin(x); }},
+        {"cos", [](double x) { return std::cos(x); }},
+        {"tan", [](double x) { return std::tan(x); }},
+        {"asin", [](double x) { return std::asin(x); }},
+        {"acos", [](double x) { return std::acos(x); }},
+        {"atan", [](double x) { return std::atan(x); }},
     };
-    
-    void tokenizeExpression(const std::string& expr);
-    
-    const Token& peek() const;
-    Token consume();
-    
-    Value parsePrimary();
-    Value parseExpression(int precedence = 0);
-    
-    Value applyUnaryOp(const std::string& op, const Value& operand);
-    Value applyBinaryOp(const std::string& op, const Value& left, const Value& right);
-    bool isTruthy(const Value& val) const;
-    
-public:
-    ExpressionParser(VariableManager& vm) : varManager(vm) {}
-    
-    Value evaluate(const std::string& expr, int line = -1);
-    
-    static std::string valueToString(const Value& value);
-};
+    struct BinaryFunction {
+        const char* name;
+        double (*fn)(double, double);
+    };
+    static const BinaryFunction BINARY_FUNCTIONS[] = {
+        {"atan2", [](double y, double x) { return std::atan2(y, x); }},
+        {"pow", [](double x, double y) { return std::pow(x, y); }},
+        {"fmod", [](double x, double y) { return std::fmod(x, y); }},
+        {"hypot", [](double x, double y) { return std::hypot(x, y); }},
+    };
+
+    auto argument = [&](size_t i) {
+        double number;
+        if (!toNumber(args[i], number)) {
+            throw RuntimeError("expected floating-point number but got \"" + valueToString(args[i]) + "\"",
+                               currentLine);
+        }
+        return number;
+    };
+    auto checkCount = [&](size_t count) {
+        if (args.size() < count) {
+            throw RuntimeError("too few arguments for math function \"" + name + "\"", currentLine);
+        }
+        if (args.size() > count) {
+            throw RuntimeError("too many arguments for math function \"" + name + "\"", currentLine);
+        }
+    };
+
+    for (const auto& entry : UNARY_FUNCTIONS) {
+        if (name == entry.name) {
+            checkCount(1);
+            return entry.fn(argument(0));
+        }
+    }
+    for (const auto& entry : BINARY_FUNCTIONS) {
+        if (name == entry.name) {
+            checkCount(2);
+            return entry.fn(argument(0), argument(1));
+        }
+    }
+    if (name == "min" || name == "max") {
+        if (args.empty()) {
+            throw RuntimeError("too few arguments for math function \"" + name + "\"", currentLine);
+        }
+        double result = argument(0);
+        for (size_t i = 1; i < args.size(); i++) {
+            double value = argument(i);
+            result = name == "min" ? std::min(result, value) : std::max(result, value);
+        }
+        return result;
+    }
+    throw RuntimeError("unknown math function \"" + name + "\"", currentLine);
+}
 
-#endif // EXPRESSION_PARSER_H
+std::string ExpressionParser::valueToString(const Value& value) {
+    if (std::holds_alternative<std::string>(value)) {
+        return std::get<std::string>(value);
+    }
+    if (std::holds_alternative<double>(value)) {
+        double num = std::get<double>(value);
+        if (std::isfinite(num) && num == std::floor(num) && std::fabs(num) < 1e15) {
+            return std::to_string(static_cast<long long>(num));
+        }
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.15g", num);
+        if (std::strtod(buf, nullptr) != num) {
+            snprintf(buf, sizeof(buf), "%.17g", num);
+        }
+        return buf;
+    }
+    if (std::holds_alternative<std::shared_ptr<Rope>>(value)) {
+        return std::get<std::shared_ptr<Rope>>(value)->str();
+    }
+    if (std::holds_alternative<bool>(value)) {
+        return std::get<bool>(value) ? "true" : "false";
+    }
+    if (std::holds_alternative<std::shared_ptr<Table>>(value)) {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "table: %p", static_cast<void*>(std::get<std::shared_ptr<Table>>(value).get()));
+        return buf;
+    }
+    return "";
+}
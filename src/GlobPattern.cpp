@@ -0,0 +1,137 @@
+#include "GlobPattern.h"
+#include "StringKernels.h"
+#include <cctype>
+#include <utility>
+
+namespace {
+
+char fold(char c, bool nocase) {
+    return nocase ? static_cast<char>(tolower(static_cast<unsigned char>(c))) : c;
+}
+
+} // namespace
+
+GlobPattern::GlobPattern(const std::string& pattern, bool nocase) : nocase(nocase) {
+    std::string pending;
+    auto flushLiteral = [&]() {
+        if (pending.empty()) return;
+        tokens.push_back({LITERAL, pending, {}});
+        pending.clear();
+    };
+    
+    for (size_t i = 0; i < pattern.length(); i++) {
+        char c = pattern[i];
+        if (c == '\\' && i + 1 < pattern.length()) {
+            pending += fold(pattern[++i], nocase);
+        } else if (c == '*') {
+            flushLiteral();
+            // 连续的星号等价于一个
+            if (tokens.empty() || tokens.back().kind != ANY_SEQUENCE) {
+                tokens.push_back({ANY_SEQUENCE, "", {}});
+            }
+        } else if (c == '?') {
+            flushLiteral();
+            tokens.push_back({ANY_CHAR, "", {}});
+        } else if (c == '[' && pattern.find(']', i + 1) != std::string::npos) {
+            flushLiteral();
+            Token token{CHAR_CLASS, "", {}};
+            size_t close = pattern.find(']', i + 1);
+            size_t j = i + 1;
+            while (j < close) {
+                if (pattern[j] == '\\' && j + 1 < close) j++;
+                unsigned char lo = static_cast<unsigned char>(pattern[j]);
+                unsigned char hi = lo;
+                if (j + 2 < close && pattern[j + 1] == '-') {
+                    hi = static_cast<unsigned char>(pattern[j + 2]);
+                    j += 2;
+                }
+                if (lo > hi) std::swap(lo, hi);
+                for (unsigned c2 = lo; c2 <= hi; c2++) {
+                    token.chars.set(c2);
+                    if (nocase) {
+                        token.chars.set(static_cast<unsigned char>(tolower(c2)));
+                        token.chars.set(static_cast<unsigned char>(toupper(c2)));
+                    }
+                }
+                j++;
+            }
+            tokens.push_back(token);
+            i = close;
+        } else {
+            pending += fold(c, nocase);
+        }
+    }
+    flushLiteral();
+    
+    for (const auto& token : tokens) {
+        if (token.kind != LITERAL) literal = false;
+    }
+    if (!tokens.empty() && tokens.front().kind == LITERAL) prefix = tokens.front().text;
+}
+
+bool GlobPattern::literalAt(const Token& token, std::string_view text, size_t pos) const {
+    if (token.text.length() > text.length() - pos) return false;
+    if (!nocase) return text.compare(pos, token.text.length(), token.text) == 0;
+    for (size_t k = 0; k < token.text.length(); k++) {
+        if (fold(text[pos + k], true) != token.text[k]) return false;
+    }
+    return true;
+}
+
+// 星号之后从 pos 开始重新尝试时的下一个候选位置:
+// 后面紧跟字面量时直接找到它的下一次出现, 否则只前进一个字符
+size_t GlobPattern::nextCandidate(size_t tokenIndex, std::string_view text, size_t pos) const {
+    if (pos > text.length()) return std::string::npos;
+    if (!nocase && tokenIndex < tokens.size() && tokens[tokenIndex].kind == LITERAL) {
+        return StringKernels::find(text, tokens[tokenIndex].text, pos);
+    }
+    return pos;
+}
+
+bool GlobPattern::matches(std::string_view text) const {
+    size_t t = 0, p = 0;
+    size_t starToken = std::string::npos, starText = 0;
+    
+    while (true) {
+        bool ok = false;
+        if (t == tokens.size()) {
+            if (p == text.length()) return true;
+        } else {
+            const Token& token = tokens[t];
+            switch (token.kind) {
+                case ANY_SEQUENCE:
+                    // 模式以星号结尾时剩余文本必然匹配
+                    if (t + 1 == tokens.size()) return true;
+                    starToken = t + 1;
+                    starText = nextCandidate(starToken, text, p);
+                    if (starText == std::string::npos) return false;
+                    p = starText;
+                    t = starToken;
+                    continue;
+                case LITERAL:
+                    ok = literalAt(token, text, p);
+                    if (ok) p += token.text.length();
+                    break;
+                case ANY_CHAR:
+                    ok = p < text.length();
+                    if (ok) p++;
+                    break;
+                case CHAR_CLASS:
+                    ok = p < text.length() && token.chars.test(static_cast<unsigned char>(text[p]));
+                    if (ok) p++;
+                    break;
+            }
+            if (ok) {
+                t++;
+                continue;
+            }
+        }
+        
+        // 回溯到最近一个星号, 让它多吞一个字符
+        if (starToken == std::string::npos) return false;
+        starText = nextCandidate(starToken, text, starText + 1);
+        if (starText == std::string::npos) return false;
+        p = starText;
+        t = starToken;
+    }
+}
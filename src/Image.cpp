@@ -0,0 +1,147 @@
+#include "Image.h"
+#include "TableCodec.h"
+#include "InterpreterException.h"
+#include <fstream>
+#include <sstream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define TCLUA_HAVE_MMAP 1
+#endif
+
+namespace {
+
+const char IMAGE_MAGIC[8] = {'T', 'C', 'L', 'U', 'A', 'I', 'M', 'G'};
+const unsigned char IMAGE_VERSION = 1;
+
+// 只读映射的镜像文件, 最后一个引用它的 rope 释放时解除映射;
+// 没有 mmap 的平台读入内存
+class Mapping {
+public:
+    explicit Mapping(const std::string& path) {
+#ifdef TCLUA_HAVE_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) fail(path);
+        struct stat info;
+        if (::fstat(fd, &info) != 0) {
+            ::close(fd);
+            fail(path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            void* mapped = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                ::close(fd);
+                fail(path);
+            }
+            base = static_cast<const char*>(mapped);
+        }
+        ::close(fd);
+#else
+        std::ifstream in(path, std::ios::binary);
+        if (!in) fail(path);
+        std::stringstream contents;
+        contents << in.rdbuf();
+        buffer = contents.str();
+        base = buffer.data();
+        length = buffer.size();
+#endif
+    }
+
+    ~Mapping() {
+#ifdef TCLUA_HAVE_MMAP
+        if (base) ::munmap(const_cast<char*>(base), length);
+#endif
+    }
+
+    Mapping(const Mapping&) = delete;
+    Mapping& operator=(const Mapping&) = delete;
+
+    std::string_view data() const { return std::string_view(base, length); }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+#ifndef TCLUA_HAVE_MMAP
+    std::string buffer;
+#endif
+
+    [[noreturn]] static void fail(const std::string& path) {
+        throw RuntimeError("cannot open image \"" + path + "\": " + std::strerror(errno));
+    }
+};
+
+} // namespace
+
+void Image::write(const std::string& path, const Value& root) {
+    std::string contents(IMAGE_MAGIC, sizeof(IMAGE_MAGIC));
+    contents += static_cast<char>(IMAGE_VERSION);
+    contents += TableCodec::encodeBinary(root);
+    
+#ifdef TCLUA_HAVE_MMAP
+    // 临时文件建在目标所在的目录, rename 才是原子的; 名字由 mkstemp 生成,
+    // 多个进程同时写同一个镜像时各写各的, 最后改名的一个生效
+    std::string temporary = path + ".XXXXXX";
+    int fd = ::mkstemp(&temporary[0]);
+    if (fd < 0) throw RuntimeError("cannot write image \"" + path + "\": " + std::strerror(errno));
+    
+    // mkstemp 创建的文件只有所有者可读, 镜像要能被其他工作进程映射
+    bool written = ::fchmod(fd, 0644) == 0;
+    for (size_t offset = 0; written && offset < contents.size();) {
+        ssize_t count = ::write(fd, contents.data() + offset, contents.size() - offset);
+        if (count < 0 && errno == EINTR) continue;
+        if (count <= 0) written = false;
+        else offset += static_cast<size_t>(count);
+    }
+    // 改名之前落盘, 崩溃后不会留下指向不完整内容的镜像
+    written = written && ::fsync(fd) == 0;
+    int error = errno;
+    if (::close(fd) != 0 && written) {
+        written = false;
+        error = errno;
+    }
+    if (!written) {
+        ::unlink(temporary.c_str());
+        throw RuntimeError("cannot write image \"" + path + "\": " + std::strerror(error));
+    }
+#else
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out) throw RuntimeError("cannot write image \"" + path + "\": " + std::strerror(errno));
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+        if (!out.flush()) {
+            out.close();
+            std::remove(temporary.c_str());
+            throw RuntimeError("cannot write image \"" + path + "\"");
+        }
+    }
+#endif
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) {
+        int error = errno;
+        std::remove(temporary.c_str());
+        throw RuntimeError("cannot write image \"" + path + "\": " + std::strerror(error));
+    }
+}
+
+std::shared_ptr<Table> Image::read(const std::string& path) {
+    auto mapping = std::make_shared<const Mapping>(path);
+    std::string_view data = mapping->data();
+    if (data.size() <= sizeof(IMAGE_MAGIC) || std::memcmp(data.data(), IMAGE_MAGIC, sizeof(IMAGE_MAGIC)) != 0) {
+        throw RuntimeError("\"" + path + "\" is not a tclua image");
+    }
+    if (static_cast<unsigned char>(data[sizeof(IMAGE_MAGIC)]) != IMAGE_VERSION) {
+        throw RuntimeError("image \"" + path + "\" has unsupported version");
+    }
+    Value root = TableCodec::decodeBinary(data.substr(sizeof(IMAGE_MAGIC) + 1), mapping, BORROW_BYTES);
+    auto* table = std::get_if<std::shared_ptr<Table>>(&root);
+    if (!table || !*table) throw RuntimeError("image \"" + path + "\" has no interpreter state");
+    return *table;
+}
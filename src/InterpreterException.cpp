@@ -27,3 +27,6 @@ std::string RuntimeError::fullMessage() const {
     return "Runtime error: " + std::string(what()) + 
            (line > 0 ? " at line " + std::to_string(line) : "");
 }
+
+MemoryLimitError::MemoryLimitError(const std::string& msg, int ln)
+    : RuntimeError(msg, ln) {}
@@ -0,0 +1,118 @@
+#include "MemoryAccount.h"
+#include "InterpreterException.h"
+#include <algorithm>
+#include <cstdint>
+
+namespace {
+
+thread_local MemoryAccount* activeAccount = nullptr;
+
+} // namespace
+
+const char* MemoryAccount::categoryName(Category category) {
+    switch (category) {
+        case TABLES: return "tables";
+        case STRINGS: return "strings";
+        case FRAMES: return "frames";
+        case CODE: return "code";
+    }
+    return "unknown";
+}
+
+void MemoryAccount::setLimits(size_t softLimit, size_t hardLimit) {
+    usage.softLimit = softLimit;
+    usage.hardLimit = hardLimit;
+    softTripped = softLimit && usage.total > softLimit;
+}
+
+MemoryAccount::Stats MemoryAccount::stats() const {
+    return usage;
+}
+
+std::string MemoryAccount::describe(size_t bytes) const {
+    return "allocating " + std::to_string(bytes) + " bytes with " + std::to_string(usage.total) + " in use";
+}
+
+void MemoryAccount::charge(Category category, size_t bytes) {
+    check(bytes);
+    size_t total = usage.total + bytes;
+    if (usage.softLimit && total > usage.softLimit && !softTripped && !reserve) {
+        softTripped = true;
+        throw MemoryLimitError("soft memory limit of " + std::to_string(usage.softLimit) + " bytes exceeded " +
+                               describe(bytes));
+    }
+    usage.used[category] += bytes;
+    usage.total = total;
+    usage.peak = std::max(usage.peak, total);
+}
+
+void MemoryAccount::check(size_t bytes) const {
+    if (usage.hardLimit && (bytes > ceiling() || usage.total > ceiling() - bytes)) {
+        throw MemoryLimitError("memory limit of " + std::to_string(usage.hardLimit) + " bytes exceeded " +
+                               describe(bytes));
+    }
+}
+
+size_t MemoryAccount::headroom() const {
+    if (!usage.hardLimit) return SIZE_MAX;
+    return usage.total < ceiling() ? ceiling() - usage.total : 0;
+}
+
+void MemoryAccount::enforce() const {
+    if (usage.hardLimit && usage.total > usage.hardLimit) {
+        throw MemoryLimitError("memory limit of " + std::to_string(usage.hardLimit) + " bytes exceeded with " +
+                               std::to_string(usage.total) + " in use");
+    }
+}
+
+void MemoryAccount::release(Category category, size_t bytes) {
+    bytes = std::min(bytes, usage.used[category]);
+    usage.used[category] -= bytes;
+    usage.total -= bytes;
+    if (softTripped && usage.total <= usage.softLimit / 10 * 9) softTripped = false;
+}
+
+void MemoryAccount::adjust(Category category, size_t expected, size_t actual) {
+    if (actual > expected) {
+        check(actual - expected);
+        usage.used[category] += actual - expected;
+        usage.total += actual - expected;
+        usage.peak = std::max(usage.peak, usage.total);
+    } else {
+        release(category, expected - actual);
+    }
+}
+
+MemoryAccount* MemoryAccount::current() {
+    return activeAccount;
+}
+
+MemoryAccount::Scope::Scope(MemoryAccount* account) : previous(activeAccount) {
+    activeAccount = account;
+}
+
+MemoryAccount::Scope::~Scope() {
+    activeAccount = previous;
+}
+
+MemoryAccount::Reserve::Reserve(MemoryAccount& account) : account(account), previous(account.reserve) {
+    account.reserve = RESERVE_BYTES;
+}
+
+MemoryAccount::Reserve::~Reserve() {
+    account.reserve = previous;
+}
+
+size_t MemoryAccount::footprint(const std::string& text) {
+    // 短字符串存放在对象内部, 不占用额外的堆内存
+    const char* data = text.data();
+    const char* self = reinterpret_cast<const char*>(&text);
+    if (data >= self && data < self + sizeof(text)) return 0;
+    return text.capacity() + 1;
+}
+
+size_t MemoryAccount::footprint(const Value& value) {
+    if (const auto* text = std::get_if<std::string>(&value)) return footprint(*text);
+    if (const auto* rope = std::get_if<std::shared_ptr<Rope>>(&value)) return (*rope)->ownedLength();
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "ModuleRegistry.h"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <algorithm>
+
+namespace {
+
+struct SymbolTable {
+    std::mutex mutex;
+    std::unordered_map<std::string, int> ids;
+    std::deque<std::string> names;
+};
+
+SymbolTable& symbols() {
+    static SymbolTable table;
+    return table;
+}
+
+bool isLiteralName(const std::string& word) {
+    return !word.empty() && word.find_first_of("$[{\"") == std::string::npos;
+}
+
+} // namespace
+
+ModuleRegistry& ModuleRegistry::instance() {
+    static ModuleRegistry registry;
+    return registry;
+}
+
+ModuleRegistry::ModuleRegistry() {
+    const char* env = std::getenv("TCLUA_PATH");
+    if (!env || !*env) {
+        paths.push_back(".");
+        return;
+    }
+    std::string list = env;
+    size_t start = 0;
+    while (start <= list.length()) {
+        size_t end = list.find(':', start);
+        if (end == std::string::npos) end = list.length();
+        if (end > start) paths.push_back(list.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+std::vector<std::string> ModuleRegistry::searchPath() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return paths;
+}
+
+void ModuleRegistry::addSearchPath(const std::string& dir) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (std::find(paths.begin(), paths.end(), dir) == paths.end()) paths.push_back(dir);
+}
+
+bool ModuleRegistry::isValidName(const std::string& name) {
+    size_t start = 0;
+    while (true) {
+        size_t end = name.find("::", start);
+        std::string segment = name.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        if (segment.empty() || segment == "." || segment == "..") return false;
+        if (segment.find_first_of("/\\:") != std::string::npos || segment.find('\0') != std::string::npos) {
+            return false;
+        }
+        if (end == std::string::npos) return true;
+        start = end + 2;
+    }
+}
+
+std::shared_ptr<const ModuleRegistry::Module> ModuleRegistry::find(const std::string& name) {
+    if (!isValidName(name)) return nullptr;
+    
+    // 持锁完成查找和编译, 并发导入同一个模块时也只编译一次
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = modules.find(name);
+    if (it != modules.end()) return it->second;
+    
+    std::string relative = name;
+    for (size_t pos = 0; (pos = relative.find("::", pos)) != std::string::npos;) {
+        relative.replace(pos, 2, "/");
+    }
+    for (const auto& dir : paths) {
+        std::string path = dir + "/" + relative + ".tcl";
+        std::ifstream in(path);
+        if (!in) continue;
+        std::stringstream buffer;
+        buffer << in.rdbuf();
+        auto module = compile(name, buffer.str(), path);
+        modules.emplace(name, module);
+        return module;
+    }
+    return nullptr;
+}
+
+std::shared_ptr<const ModuleRegistry::Module> ModuleRegistry::compile(const std::string& name, const std::string& source,
+                                                                     const std::string& path) {
+    auto module = std::make_shared<Module>();
+    module->name = name;
+    module->path = path;
+    module->source = source;
+    module->body = CompiledScript::compile(source);
+    
+    // 从顶层的 proc 和 set 命令确定导出的名字
+    for (const auto& entry : module->body->commands) {
+        const auto& words = entry.second->words;
+        if (words.size() < 2 || !words[0]->isConstant()) continue;
+        const std::string& command = *words[0]->constantValue();
+        if (command != "proc" && command != "set") continue;
+        if (!words[1]->isConstant() || !isLiteralName(*words[1]->constantValue())) {
+            module->eager = true;
+            continue;
+        }
+        std::string exported = *words[1]->constantValue();
+        // 已经带命名空间的名字不属于本模块
+        if (exported.find("::") != std::string::npos) continue;
+        if (command == "proc" && words.size() == 4) module->procs.push_back(exported);
+        if (command == "set" && words.size() == 3) module->variables.push_back(exported);
+    }
+    return module;
+}
+
+int ModuleRegistry::symbol(const std::string& qualifiedName) {
+    SymbolTable& table = symbols();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    auto it = table.ids.find(qualifiedName);
+    if (it != table.ids.end()) return it->second;
+    int id = static_cast<int>(table.names.size());
+    table.names.push_back(qualifiedName);
+    table.ids.emplace(qualifiedName, id);
+    return id;
+}
+
+std::string ModuleRegistry::symbolName(int symbol) {
+    SymbolTable& table = symbols();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    return table.names.at(symbol);
+}
+
+bool ModuleRegistry::splitQualified(const std::string& name, std::string& ns, std::string& tail) {
+    size_t pos = name.rfind("::");
+    if (pos == std::string::npos || pos == 0) return false;
+    ns = name.substr(0, pos);
+    tail = name.substr(pos + 2);
+    return !tail.empty();
+}
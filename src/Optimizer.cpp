@@ -0,0 +1,307 @@
+#include "Optimizer.h"
+#include "Tokenizer.h"
+#include <sstream>
+#include <algorithm>
+
+namespace {
+
+bool isBraced(const std::string& word) {
+    return word.length() >= 2 && word.front() == '{' && word.back() == '}';
+}
+
+std::string stripBraces(const std::string& word) {
+    return isBraced(word) ? word.substr(1, word.length() - 2) : word;
+}
+
+bool isDynamic(const std::string& word) {
+    return !isBraced(word) && word.find_first_of("$[") != std::string::npos;
+}
+
+// 对脚本和表达式都没有副作用的内置命令
+bool isReadOnlyCommand(const std::string& name) {
+    static const char* const NAMES[] = {
+        "puts", "print", "string", "split", "memory", "return", "break", "continue", "proc"
+    };
+    for (const char* candidate : NAMES) {
+        if (name == candidate) return true;
+    }
+    return false;
+}
+
+bool isPlainName(const std::string& name) {
+    if (name.empty()) return false;
+    for (char c : name) {
+        if (!isalnum(static_cast<unsigned char>(c)) && c != '_' && c != ':') return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// ---------------------------------------------------------------------------
+// 副作用分析
+
+Optimizer::Effects Optimizer::analyze(const std::string& script) {
+    Effects effects;
+    analyzeScript(script, effects);
+    return effects;
+}
+
+void Optimizer::analyzeScript(const std::string& script, Effects& effects) {
+    // 与 Tclua::compileScript 相同的拆分方式
+    std::istringstream iss(script);
+    std::string line, pending;
+    while (!effects.opaque && std::getline(iss, line)) {
+        pending = pending.empty() ? line : pending + '\n' + line;
+        size_t first = pending.find_first_not_of(" \t");
+        bool comment = first != std::string::npos && pending[first] == '#';
+        if (!comment && !Tokenizer::isComplete(pending)) continue;
+        analyzeCommand(Tokenizer::tokenize(pending, -1), effects);
+        pending.clear();
+    }
+    if (!effects.opaque && !pending.empty()) analyzeCommand(Tokenizer::tokenize(pending, -1), effects);
+}
+
+void Optimizer::analyzeCommand(const std::vector<std::string>& words, Effects& effects) {
+    if (words.empty()) return;
+    for (const auto& word : words) analyzeSubstitutions(word, effects);
+
+    const std::string& name = words[0];
+    if (isDynamic(name)) {
+        effects.opaque = true;
+        return;
+    }
+
+    if (name == "set") {
+        if (words.size() >= 3) addWritten(words[1], effects);
+    } else if (name == "incr" || name == "append") {
+        if (words.size() >= 2) addWritten(words[1], effects);
+    } else if (name == "regexp" || name == "regsub") {
+        // 匹配变量的位置取决于选项, 保守地把所有参数都当作可能写入的变量
+        for (size_t i = 1; i < words.size(); i++) {
+            if (isDynamic(words[i])) continue;
+            effects.written.insert(stripBraces(words[i]));
+        }
+    } else if (name == "table") {
+        if (words.size() >= 3 && words[1] == "decode" &&
+            std::find(words.begin(), words.end(), "-stream") != words.end()) {
+            addWritten(words[words.size() - 2], effects);
+            analyzeBody(words.back(), effects);
+        }
+    } else if (name == "try") {
+        if (words.size() >= 2) analyzeBody(words[1], effects);
+        if (words.size() == 5) {
+            addWritten(words[3], effects);
+            analyzeBody(words[4], effects);
+        }
+    } else if (name == "if") {
+        size_t i = 1;
+        while (i < words.size()) {
+            analyzeExpression(words[i++], effects);
+            if (i < words.size() && words[i] == "then") i++;
+            if (i < words.size()) analyzeBody(words[i++], effects);
+            if (i >= words.size()) break;
+            if (words[i] == "elseif") {
+                i++;
+                continue;
+            }
+            if (words[i] == "else") i++;
+            if (i < words.size()) analyzeBody(words[i], effects);
+            break;
+        }
+    } else if (name == "while") {
+        if (words.size() >= 2) analyzeExpression(words[1], effects);
+        if (words.size() >= 3) analyzeBody(words[2], effects);
+    } else if (name == "for") {
+        if (words.size() >= 2) analyzeBody(words[1], effects);
+        if (words.size() >= 3) analyzeExpression(words[2], effects);
+        for (size_t i = 3; i < words.size(); i++) analyzeBody(words[i], effects);
+    } else if (name == "switch") {
+        size_t i = 1;
+        while (i < words.size() && words[i].size() > 1 && words[i][0] == '-') {
+            if (words[i++] == "--") break;
+        }
+        i++; // 被匹配的字符串
+        std::vector<std::string> arms;
+        if (i + 1 == words.size()) {
+            if (isDynamic(words[i])) {
+                effects.opaque = true;
+                return;
+            }
+            for (const auto& arm : Tokenizer::splitList(stripBraces(words[i]))) arms.push_back("{" + arm + "}");
+        } else {
+            arms.assign(words.begin() + std::min(i, words.size()), words.end());
+        }
+        for (size_t k = 1; k < arms.size(); k += 2) {
+            if (stripBraces(arms[k]) != "-") analyzeBody(arms[k], effects);
+        }
+    } else if (name == "expr") {
+        for (size_t i = 1; i < words.size(); i++) analyzeExpression(words[i], effects);
+    } else if (!isReadOnlyCommand(name)) {
+        // 过程调用以及未知命令可能写入任何变量
+        effects.opaque = true;
+    }
+}
+
+void Optimizer::analyzeBody(const std::string& word, Effects& effects) {
+    if (isDynamic(word)) {
+        effects.opaque = true;
+        return;
+    }
+    analyzeScript(stripBraces(word), effects);
+}
+
+void Optimizer::analyzeExpression(const std::string& word, Effects& effects) {
+    // 表达式本身不写变量, 只有其中的命令替换可能写入
+    std::string expr = stripBraces(word);
+    size_t pos = 0;
+    while (!effects.opaque && (pos = expr.find('[', pos)) != std::string::npos) {
+        size_t end = Tokenizer::matchBracket(expr, pos);
+        if (end == std::string::npos) {
+            effects.opaque = true;
+            return;
+        }
+        analyzeScript(expr.substr(pos + 1, end - pos - 1), effects);
+        pos = end + 1;
+    }
+}
+
+void Optimizer::analyzeSubstitutions(const std::string& word, Effects& effects) {
+    if (isBraced(word) || word.find('[') == std::string::npos) return;
+    analyzeExpression(word, effects);
+}
+
+void Optimizer::addWritten(const std::string& word, Effects& effects) {
+    if (isDynamic(word)) {
+        effects.opaque = true;
+        return;
+    }
+    std::string name = stripBraces(word);
+    effects.written.insert(name);
+    // 写表字段时表变量本身也可能被替换
+    size_t field = name.find_first_of(".(");
+    if (field != std::string::npos) effects.written.insert(name.substr(0, field));
+}
+
+// ---------------------------------------------------------------------------
+// 执行计划
+
+std::shared_ptr<const Optimizer::IfPlan> Optimizer::planIf(const std::vector<std::string>& words,
+                                                           ExpressionParser& parser, int line) {
+    auto plan = std::make_shared<IfPlan>();
+    bool optimize = parser.getOptimizationLevel() >= 1;
+    size_t i = 0;
+    // 条件为常量真的分支之后的内容都不会执行
+    bool decided = false;
+
+    while (true) {
+        if (i >= words.size()) {
+            throw RuntimeError("wrong # args: no expression after \"" + (i ? words[i - 1] : std::string("if")) +
+                               "\" argument", line);
+        }
+        IfPlan::Clause clause;
+        clause.condition = words[i++];
+        if (i < words.size() && words[i] == "then") i++;
+        if (i >= words.size()) {
+            throw RuntimeError("wrong # args: no script following \"" + words[i - 1] + "\" argument", line);
+        }
+        clause.body = words[i++];
+
+        if (!decided) {
+            bool keep = true;
+            if (optimize) {
+                clause.compiled = parser.compile(clause.condition);
+                if (clause.compiled->kind == ExpressionParser::Node::CONSTANT) {
+                    try {
+                        if (parser.isTruthy(clause.compiled->constant)) {
+                            plan->hasElse = true;
+                            plan->elseBody = clause.body;
+                            decided = true;
+                        }
+                        keep = false;
+                    } catch (const InterpreterException&) {
+                        // 不是布尔值的常量条件照常保留, 运行时报错
+                    }
+                }
+            }
+            if (keep) plan->clauses.push_back(std::move(clause));
+        }
+
+        if (i >= words.size()) break;
+        if (words[i] == "elseif") {
+            i++;
+            continue;
+        }
+        if (words[i] == "else") i++;
+        if (i >= words.size()) {
+            throw RuntimeError("wrong # args: no script following \"else\" argument", line);
+        }
+        if (i + 1 != words.size()) {
+            throw RuntimeError("wrong # args: extra words after \"else\" clause in \"if\" command", line);
+        }
+        if (!decided) {
+            plan->hasElse = true;
+            plan->elseBody = words[i];
+        }
+        break;
+    }
+    return plan;
+}
+
+std::shared_ptr<const Optimizer::LoopPlan> Optimizer::planLoop(const std::string& test, const std::string& next,
+                                                               const std::string& body, bool isFor,
+                                                               ExpressionParser& parser) {
+    auto plan = std::make_shared<LoopPlan>();
+    plan->test = test;
+    plan->next = next;
+    plan->body = body;
+    plan->isFor = isFor;
+    int level = parser.getOptimizationLevel();
+    if (level == 0) return plan;
+
+    plan->compiled = parser.compile(test);
+    if (level < 2) return plan;
+
+    Effects effects = analyze(body);
+    if (isFor) analyzeScript(next, effects);
+    analyzeExpression(test, effects);
+    if (!effects.opaque) {
+        plan->written = std::make_shared<const std::unordered_set<std::string>>(std::move(effects.written));
+    }
+
+    // for {...} {$i < $n} {incr i ?step?} {...}: 计数器递增和条件判断直接操作变量槽
+    if (!isFor) return plan;
+    auto words = Tokenizer::tokenize(next, -1);
+    if (words.size() < 2 || words.size() > 3 || words[0] != "incr" || !isPlainName(words[1])) return plan;
+    if (words.size() == 3) {
+        try {
+            size_t used = 0;
+            long long step = std::stoll(words[2], &used);
+            if (used != words[2].length()) return plan;
+            plan->step = static_cast<double>(step);
+        } catch (const std::exception&) {
+            return plan;
+        }
+    }
+
+    using Node = ExpressionParser::Node;
+    const Node& condition = *plan->compiled;
+    if (condition.kind == Node::COMPARE_VAR_CONST && condition.text == words[1]) {
+        auto bound = std::make_shared<Node>();
+        bound->kind = Node::CONSTANT;
+        bound->constant = condition.constant;
+        plan->bound = std::move(bound);
+    } else if (condition.kind == Node::BINARY && condition.op >= ExpressionParser::EQ &&
+               condition.op <= ExpressionParser::GE && condition.operands[0]->kind == Node::VARIABLE &&
+               condition.operands[0]->text == words[1] && condition.operands[1]->pure) {
+        const auto& read = condition.operands[1]->variables;
+        if (std::find(read.begin(), read.end(), words[1]) != read.end()) return plan;
+        plan->bound = condition.operands[1];
+    } else {
+        return plan;
+    }
+    plan->fused = true;
+    plan->counter = words[1];
+    plan->compare = condition.op;
+    return plan;
+}
@@ -0,0 +1,729 @@
+#include "Regex.h"
+#include "StringKernels.h"
+#include "InterpreterException.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <unordered_set>
+
+struct Regex::Node {
+    enum Kind { LITERAL, SET, ANY, BOL, EOL, WORD_BOUNDARY, NOT_WORD_BOUNDARY, CONCAT, ALT, REPEAT, GROUP, EMPTY };
+
+    Kind kind;
+    int value = 0;       // LITERAL: 字符; SET: 字符类下标; GROUP: 分组号(-1 为非捕获)
+    int min = 0;
+    int max = 0;         // REPEAT: -1 表示无上限
+    bool greedy = true;
+    std::vector<std::unique_ptr<Node>> children;
+
+    explicit Node(Kind k, int v = 0) : kind(k), value(v) {}
+};
+
+namespace {
+
+const int MAX_REPEAT = 1000;
+
+// 回溯执行器访问位图的大小 (位); 已知匹配区间时位图按区间分配, 上限为 SPAN_BITMAP_BITS
+const size_t BITMAP_BITS = size_t(64) << 10;
+const size_t SPAN_BITMAP_BITS = size_t(64) << 20;
+
+bool isWordChar(unsigned char c) {
+    return isalnum(c) || c == '_';
+}
+
+std::bitset<256> charClass(int (*predicate)(int)) {
+    std::bitset<256> chars;
+    for (int c = 0; c < 256; c++) {
+        if (predicate(c)) chars.set(c);
+    }
+    return chars;
+}
+
+int isWordPredicate(int c) {
+    return isWordChar(static_cast<unsigned char>(c));
+}
+
+bool namedClass(const std::string& name, std::bitset<256>& chars) {
+    static const std::map<std::string, int (*)(int)> classes = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"space", isspace},
+        {"upper", isupper}, {"lower", islower}, {"punct", ispunct}, {"xdigit", isxdigit},
+        {"cntrl", iscntrl}, {"print", isprint}, {"graph", isgraph}, {"word", isWordPredicate},
+    };
+    auto it = classes.find(name);
+    if (it == classes.end()) return false;
+    chars |= charClass(it->second);
+    return true;
+}
+
+// \d \w \s 及其取反形式
+bool escapeClass(char c, std::bitset<256>& chars) {
+    switch (c) {
+        case 'd': chars |= charClass(isdigit); return true;
+        case 'D': chars |= ~charClass(isdigit); return true;
+        case 'w': chars |= charClass(isWordPredicate); return true;
+        case 'W': chars |= ~charClass(isWordPredicate); return true;
+        case 's': chars |= charClass(isspace); return true;
+        case 'S': chars |= ~charClass(isspace); return true;
+        default: return false;
+    }
+}
+
+char escapeChar(char c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case 'f': return '\f';
+        case 'v': return '\v';
+        case '0': return '\0';
+        default: return c;
+    }
+}
+
+[[noreturn]] void syntaxError(const std::string& why) {
+    throw RuntimeError("couldn't compile regular expression pattern: " + why);
+}
+
+} // namespace
+
+Regex::Regex(const std::string& pat, int fl) : pattern(pat), flags(fl) {
+    size_t pos = 0;
+    std::unique_ptr<Node> root = parseAlternation(pos);
+    if (pos < pattern.length()) syntaxError("parentheses () not balanced");
+
+    emit(program, SAVE, 0);
+    compileNode(*root, program, false);
+    emit(program, SAVE, 1);
+    emit(program, MATCH);
+
+    compileNode(*root, reverseProgram, true);
+    emit(reverseProgram, MATCH);
+
+    extractPrefix(*root);
+    forward.program = &program;
+    forward.closureMark.assign(program.size(), 0);
+    reverse.program = &reverseProgram;
+    reverse.leftmostFirst = false;
+    reverse.closureMark.assign(reverseProgram.size(), 0);
+}
+
+// ---------------------------------------------------------------- 解析
+
+std::unique_ptr<Regex::Node> Regex::parseAlternation(size_t& pos) {
+    std::unique_ptr<Node> first = parseConcat(pos);
+    if (pos >= pattern.length() || pattern[pos] != '|') return first;
+
+    auto alt = std::make_unique<Node>(Node::ALT);
+    alt->children.push_back(std::move(first));
+    while (pos < pattern.length() && pattern[pos] == '|') {
+        pos++;
+        alt->children.push_back(parseConcat(pos));
+    }
+    return alt;
+}
+
+std::unique_ptr<Regex::Node> Regex::parseConcat(size_t& pos) {
+    auto concat = std::make_unique<Node>(Node::CONCAT);
+    while (pos < pattern.length() && pattern[pos] != '|' && pattern[pos] != ')') {
+        concat->children.push_back(parseRepeat(pos));
+    }
+    if (concat->children.empty()) return std::make_unique<Node>(Node::EMPTY);
+    if (concat->children.size() == 1) return std::move(concat->children.front());
+    return concat;
+}
+
+std::unique_ptr<Regex::Node> Regex::parseRepeat(size_t& pos) {
+    std::unique_ptr<Node> atom = parseAtom(pos);
+
+    while (pos < pattern.length()) {
+        int min, max;
+        char c = pattern[pos];
+        if (c == '*') {
+            min = 0, max = -1;
+            pos++;
+        } else if (c == '+') {
+            min = 1, max = -1;
+            pos++;
+        } else if (c == '?') {
+            min = 0, max = 1;
+            pos++;
+        } else if (c == '{' && pos + 1 < pattern.length() && isdigit(static_cast<unsigned char>(pattern[pos + 1]))) {
+            size_t close = pattern.find('}', pos);
+            if (close == std::string::npos) syntaxError("braces {} not balanced");
+            std::string spec = pattern.substr(pos + 1, close - pos - 1);
+            size_t comma = spec.find(',');
+            try {
+                min = std::stoi(spec.substr(0, comma));
+                if (comma == std::string::npos) max = min;
+                else if (comma + 1 == spec.length()) max = -1;
+                else max = std::stoi(spec.substr(comma + 1));
+            } catch (const std::exception&) {
+                syntaxError("invalid repetition count(s)");
+            }
+            if (min > MAX_REPEAT || max > MAX_REPEAT || (max >= 0 && max < min)) {
+                syntaxError("invalid repetition count(s)");
+            }
+            pos = close + 1;
+        } else {
+            break;
+        }
+
+        auto repeat = std::make_unique<Node>(Node::REPEAT);
+        repeat->min = min;
+        repeat->max = max;
+        if (pos < pattern.length() && pattern[pos] == '?') {
+            repeat->greedy = false;
+            pos++;
+        }
+        repeat->children.push_back(std::move(atom));
+        atom = std::move(repeat);
+    }
+    return atom;
+}
+
+std::unique_ptr<Regex::Node> Regex::parseAtom(size_t& pos) {
+    char c = pattern[pos++];
+    switch (c) {
+        case '(': {
+            int group = -1;
+            if (pattern.compare(pos, 2, "?:") == 0) {
+                pos += 2;
+            } else {
+                group = static_cast<int>(++groups);
+            }
+            auto node = std::make_unique<Node>(Node::GROUP, group);
+            node->children.push_back(parseAlternation(pos));
+            if (pos >= pattern.length() || pattern[pos] != ')') syntaxError("parentheses () not balanced");
+            pos++;
+            return node;
+        }
+        case '[':
+            return parseBracket(pos);
+        case '.':
+            return std::make_unique<Node>(Node::ANY);
+        case '^':
+            return std::make_unique<Node>(Node::BOL);
+        case '$':
+            return std::make_unique<Node>(Node::EOL);
+        case '*':
+        case '+':
+        case '?':
+            syntaxError("quantifier operand invalid");
+        case '\\': {
+            if (pos >= pattern.length()) syntaxError("invalid escape \\ sequence");
+            char e = pattern[pos++];
+            std::bitset<256> chars;
+            if (escapeClass(e, chars)) return std::make_unique<Node>(Node::SET, addClass(chars));
+            if (e == 'b' || e == 'y') return std::make_unique<Node>(Node::WORD_BOUNDARY);
+            if (e == 'B' || e == 'Y') return std::make_unique<Node>(Node::NOT_WORD_BOUNDARY);
+            return literalNode(static_cast<unsigned char>(escapeChar(e)));
+        }
+        default:
+            return literalNode(static_cast<unsigned char>(c));
+    }
+}
+
+std::unique_ptr<Regex::Node> Regex::parseBracket(size_t& pos) {
+    std::bitset<256> chars;
+    bool negate = false;
+    if (pos < pattern.length() && pattern[pos] == '^') {
+        negate = true;
+        pos++;
+    }
+
+    bool first = true;
+    while (true) {
+        if (pos >= pattern.length()) syntaxError("brackets [] not balanced");
+        char c = pattern[pos];
+        if (c == ']' && !first) {
+            pos++;
+            break;
+        }
+        first = false;
+
+        if (c == '[' && pattern.compare(pos, 2, "[:") == 0) {
+            size_t close = pattern.find(":]", pos + 2);
+            if (close == std::string::npos || !namedClass(pattern.substr(pos + 2, close - pos - 2), chars)) {
+                syntaxError("invalid character class");
+            }
+            pos = close + 2;
+            continue;
+        }
+
+        unsigned char lo = static_cast<unsigned char>(c);
+        pos++;
+        if (c == '\\' && pos < pattern.length()) {
+            char e = pattern[pos++];
+            if (escapeClass(e, chars)) continue;
+            lo = static_cast<unsigned char>(escapeChar(e));
+        }
+
+        unsigned char hi = lo;
+        if (pos + 1 < pattern.length() && pattern[pos] == '-' && pattern[pos + 1] != ']') {
+            hi = static_cast<unsigned char>(pattern[pos + 1]);
+            pos += 2;
+            if (hi == '\\' && pos < pattern.length()) hi = static_cast<unsigned char>(escapeChar(pattern[pos++]));
+            if (hi < lo) syntaxError("invalid character range");
+        }
+        for (unsigned ch = lo; ch <= hi; ch++) chars.set(ch);
+    }
+
+    if (flags & NOCASE) {
+        for (int ch = 0; ch < 256; ch++) {
+            if (chars.test(ch)) {
+                chars.set(static_cast<unsigned char>(tolower(ch)));
+                chars.set(static_cast<unsigned char>(toupper(ch)));
+            }
+        }
+    }
+    if (negate) chars.flip();
+    return std::make_unique<Node>(Node::SET, addClass(chars));
+}
+
+std::unique_ptr<Regex::Node> Regex::literalNode(unsigned char c) {
+    if ((flags & NOCASE) && isalpha(c)) {
+        std::bitset<256> chars;
+        chars.set(static_cast<unsigned char>(tolower(c)));
+        chars.set(static_cast<unsigned char>(toupper(c)));
+        return std::make_unique<Node>(Node::SET, addClass(chars));
+    }
+    return std::make_unique<Node>(Node::LITERAL, c);
+}
+
+int Regex::addClass(std::bitset<256> chars) {
+    classes.push_back(chars);
+    return static_cast<int>(classes.size() - 1);
+}
+
+// 顶层串联开头的 ^ 和连续字面量决定了锚定和字面量前缀
+void Regex::extractPrefix(const Node& root) {
+    std::vector<const Node*> sequence;
+    if (root.kind == Node::CONCAT) {
+        for (const auto& child : root.children) sequence.push_back(child.get());
+    } else {
+        sequence.push_back(&root);
+    }
+
+    size_t i = 0;
+    if (i < sequence.size() && sequence[i]->kind == Node::BOL) {
+        anchored = true;
+        i++;
+    }
+    for (; i < sequence.size() && sequence[i]->kind == Node::LITERAL; i++) {
+        prefix += static_cast<char>(sequence[i]->value);
+    }
+}
+
+// ---------------------------------------------------------------- 生成指令
+
+int Regex::emit(std::vector<Inst>& out, Op op, int x, int y) {
+    out.push_back({op, x, y});
+    return static_cast<int>(out.size() - 1);
+}
+
+void Regex::compileNode(const Node& node, std::vector<Inst>& out, bool reversed) {
+    switch (node.kind) {
+        case Node::LITERAL: emit(out, CHAR, node.value); break;
+        case Node::SET: emit(out, CLASS, node.value); break;
+        case Node::ANY: emit(out, ANY); break;
+        case Node::BOL: emit(out, reversed ? EOL : BOL); break;
+        case Node::EOL: emit(out, reversed ? BOL : EOL); break;
+        case Node::WORD_BOUNDARY:
+            dfaSupported = false;
+            emit(out, WORD_BOUNDARY);
+            break;
+        case Node::NOT_WORD_BOUNDARY:
+            dfaSupported = false;
+            emit(out, NOT_WORD_BOUNDARY);
+            break;
+        case Node::EMPTY: break;
+
+        case Node::CONCAT:
+            if (reversed) {
+                for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+                    compileNode(**it, out, reversed);
+                }
+            } else {
+                for (const auto& child : node.children) compileNode(*child, out, reversed);
+            }
+            break;
+
+        case Node::GROUP:
+            if (node.value >= 0 && !reversed) emit(out, SAVE, node.value * 2);
+            compileNode(*node.children.front(), out, reversed);
+            if (node.value >= 0 && !reversed) emit(out, SAVE, node.value * 2 + 1);
+            break;
+
+        case Node::ALT: {
+            std::vector<int> exits;
+            for (size_t i = 0; i + 1 < node.children.size(); i++) {
+                int split = emit(out, SPLIT);
+                out[split].x = split + 1;
+                compileNode(*node.children[i], out, reversed);
+                exits.push_back(emit(out, JMP));
+                out[split].y = static_cast<int>(out.size());
+            }
+            compileNode(*node.children.back(), out, reversed);
+            for (int jump : exits) out[jump].x = static_cast<int>(out.size());
+            break;
+        }
+
+        case Node::REPEAT: {
+            const Node& child = *node.children.front();
+            for (int i = 0; i < node.min; i++) compileNode(child, out, reversed);
+
+            if (node.max < 0) {
+                int split = emit(out, SPLIT);
+                compileNode(child, out, reversed);
+                emit(out, JMP, split);
+                int body = split + 1, exit = static_cast<int>(out.size());
+                out[split].x = node.greedy ? body : exit;
+                out[split].y = node.greedy ? exit : body;
+            } else {
+                std::vector<int> splits;
+                for (int i = node.min; i < node.max; i++) {
+                    splits.push_back(emit(out, SPLIT));
+                    compileNode(child, out, reversed);
+                }
+                int exit = static_cast<int>(out.size());
+                for (int split : splits) {
+                    out[split].x = node.greedy ? split + 1 : exit;
+                    out[split].y = node.greedy ? exit : split + 1;
+                }
+            }
+            break;
+        }
+    }
+}
+
+// ---------------------------------------------------------------- 执行
+
+bool Regex::consumes(const Inst& inst, unsigned char c) const {
+    switch (inst.op) {
+        case CHAR: return c == static_cast<unsigned char>(inst.x);
+        case CLASS: return classes[inst.x].test(c);
+        case ANY: return true;
+        default: return false;
+    }
+}
+
+// epsilon 闭包: 结果只包含消耗字符的指令, MATCH, 以及尚未满足的 $ 断言,
+// 按优先级排列; 最左优先时 MATCH 之后的线程优先级更低, 不再加入
+std::vector<int> Regex::closure(Dfa& dfa, const std::vector<int>& seeds, bool atStart, bool atEnd) {
+    if (++dfa.closureGeneration == 0) {
+        std::fill(dfa.closureMark.begin(), dfa.closureMark.end(), 0);
+        dfa.closureGeneration = 1;
+    }
+
+    const std::vector<Inst>& code = *dfa.program;
+    std::vector<int> result;
+    std::vector<int> pending(seeds.rbegin(), seeds.rend());
+    while (!pending.empty()) {
+        int pc = pending.back();
+        pending.pop_back();
+        if (pc == RESTART) {
+            result.push_back(pc);
+            continue;
+        }
+        if (dfa.closureMark[pc] == dfa.closureGeneration) continue;
+        dfa.closureMark[pc] = dfa.closureGeneration;
+
+        const Inst& inst = code[pc];
+        switch (inst.op) {
+            case SPLIT:
+                pending.push_back(inst.y);
+                pending.push_back(inst.x);
+                break;
+            case JMP: pending.push_back(inst.x); break;
+            case SAVE: pending.push_back(pc + 1); break;
+            case BOL:
+                if (atStart) pending.push_back(pc + 1);
+                break;
+            case EOL:
+                if (atEnd) pending.push_back(pc + 1);
+                else result.push_back(pc);
+                break;
+            case MATCH:
+                result.push_back(pc);
+                if (dfa.leftmostFirst) return result;
+                break;
+            default:
+                result.push_back(pc);
+                break;
+        }
+    }
+    return result;
+}
+
+bool Regex::containsMatch(const Dfa& dfa, const std::vector<int>& pcs) {
+    for (int pc : pcs) {
+        if (pc != RESTART && (*dfa.program)[pc].op == MATCH) return true;
+    }
+    return false;
+}
+
+int Regex::dfaState(Dfa& dfa, std::vector<int> pcs) {
+    auto it = dfa.index.find(pcs);
+    if (it != dfa.index.end()) return it->second;
+
+    // 状态数达到上限时清空整个缓存重新构建
+    if (dfa.states.size() >= MAX_DFA_STATES) {
+        dfa.states.clear();
+        dfa.index.clear();
+        dfa.start = dfa.startAtBol = -1;
+        dfa.flushes++;
+    }
+
+    DfaState state;
+    std::fill(std::begin(state.next), std::end(state.next), -1);
+    state.accepting = containsMatch(dfa, pcs);
+    state.halts = state.accepting || pcs.empty();
+    state.pcs = pcs;
+    dfa.states.push_back(std::move(state));
+    int id = static_cast<int>(dfa.states.size() - 1);
+    dfa.index.emplace(std::move(pcs), id);
+    return id;
+}
+
+int Regex::dfaNext(Dfa& dfa, int state, unsigned char c) {
+    int cached = dfa.states[state].next[c];
+    if (cached >= 0) return cached;
+
+    // 还没有匹配时每个位置都可以重新从程序开头尝试, 优先级最低
+    std::vector<int> seeds;
+    for (int pc : dfa.states[state].pcs) {
+        if (pc == RESTART) {
+            seeds.push_back(0);
+            seeds.push_back(RESTART);
+        } else if (consumes((*dfa.program)[pc], c)) {
+            seeds.push_back(pc + 1);
+        }
+    }
+
+    unsigned flushes = dfa.flushes;
+    int next = dfaState(dfa, closure(dfa, seeds, false, false));
+    if (flushes == dfa.flushes) dfa.states[state].next[c] = next;
+    return next;
+}
+
+void Regex::dfaStarts(Dfa& dfa, const std::vector<int>& seeds) {
+    if (dfa.startAtBol < 0) dfa.startAtBol = dfaState(dfa, closure(dfa, seeds, true, false));
+    if (dfa.start < 0) dfa.start = dfaState(dfa, closure(dfa, seeds, false, false));
+}
+
+// 输入结束时 $ 断言成立, 检查优先级高于已有 MATCH 的线程能否由此到达 MATCH
+bool Regex::reachesMatchAtEnd(Dfa& dfa, int state, bool atStart) {
+    std::vector<int> seeds;
+    for (int pc : dfa.states[state].pcs) {
+        if (pc == RESTART) continue;
+        Op op = (*dfa.program)[pc].op;
+        if (op == MATCH && dfa.leftmostFirst) break;
+        if (op == EOL) seeds.push_back(pc + 1);
+    }
+    return !seeds.empty() && containsMatch(dfa, closure(dfa, seeds, atStart, true));
+}
+
+bool Regex::dfaSearch(std::string_view text, size_t start, size_t* matchEnd) {
+    const std::vector<int> seeds = {0, RESTART};
+    dfaStarts(forward, seeds);
+    int state = start == 0 ? forward.startAtBol : forward.start;
+    size_t pos = start;
+    const size_t n = text.size();
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text.data());
+    bool matched = false;
+
+    while (true) {
+        const DfaState& current = forward.states[state];
+        if (current.accepting) {
+            if (!matchEnd) return true;
+            matched = true;
+            *matchEnd = pos;
+        }
+        if (pos == n) break;
+        if (current.pcs.empty()) return matched;
+
+        // 处于初始状态时没有进行中的匹配, 可以直接跳到下一个字面量前缀
+        if (state == forward.start && !prefix.empty()) {
+            pos = StringKernels::find(text, prefix, pos);
+            if (pos == StringKernels::npos) return matched;
+        }
+
+        int next = current.next[data[pos]];
+        if (next < 0) {
+            unsigned flushes = forward.flushes;
+            next = dfaNext(forward, state, data[pos]);
+            if (flushes != forward.flushes) dfaStarts(forward, seeds);
+        }
+        state = next;
+        pos++;
+
+        // 快速路径: 沿已缓存的转移连续前进, 直到需要检查的状态或未缓存的转移
+        const DfaState* states = forward.states.data();
+        const int prefilterState = prefix.empty() ? -1 : forward.start;
+        while (pos < n && !states[state].halts && state != prefilterState) {
+            int following = states[state].next[data[pos]];
+            if (following < 0) break;
+            state = following;
+            pos++;
+        }
+    }
+
+    if (reachesMatchAtEnd(forward, state, pos == 0)) {
+        if (matchEnd) *matchEnd = n;
+        return true;
+    }
+    return matched;
+}
+
+size_t Regex::dfaMatchStart(std::string_view text, size_t start, size_t end) {
+    // 反向程序里原来的 $ 成为开头断言, 原来的 ^ 在扫描到输入开头时检查
+    dfaStarts(reverse, {0});
+    int state = end == text.size() ? reverse.startAtBol : reverse.start;
+    size_t pos = end;
+    size_t found = StringKernels::npos;
+    const unsigned char* data = reinterpret_cast<const unsigned char*>(text.data());
+
+    while (true) {
+        const DfaState& current = reverse.states[state];
+        if (current.accepting) found = pos;
+        if (pos == start || current.pcs.empty()) break;
+
+        int next = current.next[data[pos - 1]];
+        if (next < 0) {
+            unsigned flushes = reverse.flushes;
+            next = dfaNext(reverse, state, data[pos - 1]);
+            if (flushes != reverse.flushes) dfaStarts(reverse, {0});
+        }
+        state = next;
+        pos--;
+    }
+    if (pos == 0 && reachesMatchAtEnd(reverse, state, end == text.size())) found = 0;
+    return found;
+}
+
+bool Regex::backtrack(std::string_view text, size_t first, size_t last, size_t limit, Captures& captures) {
+    const size_t n = text.size();
+    const size_t width = limit - first + 1;
+
+    // 已知匹配区间时位图覆盖整个区间; 否则靠近起点的位置用位图记录访问过的 (指令, 位置),
+    // 更远的位置用哈希集合, 这样 -all 反复调用时每次只需清空一个很小的位图
+    const size_t budget = first == last ? SPAN_BITMAP_BITS : BITMAP_BITS;
+    const size_t window = std::min(width, std::max<size_t>(64, budget / program.size()));
+    backtrackBitmap.assign((program.size() * window + 63) / 64, 0);
+    std::unordered_set<uint64_t> visitedSet;
+
+    // 同一 (指令, 位置) 第二次到达时, 之前的访问优先级更高且已经失败
+    auto visited = [&](int pc, size_t pos) {
+        size_t offset = pos - first;
+        if (offset < window) {
+            uint64_t key = static_cast<uint64_t>(pc) * window + offset;
+            uint64_t bit = uint64_t(1) << (key & 63);
+            if (backtrackBitmap[key >> 6] & bit) return true;
+            backtrackBitmap[key >> 6] |= bit;
+            return false;
+        }
+        return !visitedSet.insert(static_cast<uint64_t>(pc) * width + offset).second;
+    };
+
+    struct Job {
+        int pc;
+        size_t pos;
+        int slot;         // >= 0 时为恢复分组位置的任务
+        long long saved;
+    };
+
+    std::vector<long long> slots(2 * (groups + 1), -1);
+    std::vector<Job> stack;
+
+    for (size_t s = first; s <= last; s++) {
+        if (anchored && s != 0) break;
+        if (!prefix.empty()) {
+            s = StringKernels::find(text, prefix, s);
+            if (s == StringKernels::npos || s > last) break;
+        }
+
+        stack.push_back({0, s, -1, 0});
+        while (!stack.empty()) {
+            Job job = stack.back();
+            stack.pop_back();
+            if (job.slot >= 0) {
+                slots[job.slot] = job.saved;
+                continue;
+            }
+
+            int pc = job.pc;
+            size_t pos = job.pos;
+            bool alive = true;
+            while (alive && !visited(pc, pos)) {
+                const Inst& inst = program[pc];
+                switch (inst.op) {
+                    case CHAR:
+                    case CLASS:
+                    case ANY:
+                        alive = pos < limit && consumes(inst, static_cast<unsigned char>(text[pos]));
+                        pc++;
+                        pos++;
+                        break;
+                    case SPLIT:
+                        stack.push_back({inst.y, pos, -1, 0});
+                        pc = inst.x;
+                        break;
+                    case JMP:
+                        pc = inst.x;
+                        break;
+                    case SAVE:
+                        stack.push_back({0, 0, inst.x, slots[inst.x]});
+                        slots[inst.x] = static_cast<long long>(pos);
+                        pc++;
+                        break;
+                    case BOL:
+                        alive = pos == 0;
+                        pc++;
+                        break;
+                    case EOL:
+                        alive = pos == n;
+                        pc++;
+                        break;
+                    case WORD_BOUNDARY:
+                    case NOT_WORD_BOUNDARY: {
+                        bool before = pos > 0 && isWordChar(static_cast<unsigned char>(text[pos - 1]));
+                        bool after = pos < n && isWordChar(static_cast<unsigned char>(text[pos]));
+                        alive = (before != after) == (inst.op == WORD_BOUNDARY);
+                        pc++;
+                        break;
+                    }
+                    case MATCH:
+                        captures.assign(groups + 1, {-1, -1});
+                        for (size_t g = 0; g <= groups; g++) {
+                            if (slots[2 * g] >= 0 && slots[2 * g + 1] >= 0) {
+                                captures[g] = {slots[2 * g], slots[2 * g + 1]};
+                            }
+                        }
+                        return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+bool Regex::search(std::string_view text, size_t start) {
+    if (start > text.size()) return false;
+    if (!dfaSupported) {
+        Captures ignored;
+        return backtrack(text, start, text.size(), text.size(), ignored);
+    }
+    return dfaSearch(text, start);
+}
+
+bool Regex::exec(std::string_view text, size_t start, Captures& captures) {
+    if (start > text.size()) return false;
+    if (!dfaSupported) return backtrack(text, start, text.size(), text.size(), captures);
+
+    // 正向 DFA 求出匹配终点, 反向 DFA 求出起点, 回溯只在这个区间内进行
+    size_t end;
+    if (!dfaSearch(text, start, &end)) return false;
+    size_t matchStart = dfaMatchStart(text, start, end);
+    if (matchStart == StringKernels::npos) return backtrack(text, start, text.size(), text.size(), captures);
+    return backtrack(text, matchStart, matchStart, end, captures);
+}
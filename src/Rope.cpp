@@ -0,0 +1,216 @@
+#include "Rope.h"
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+
+Rope::Rope(const std::string& text) {
+    if (text.length() >= LEAF_SIZE) {
+        root = build(text, 0, text.length());
+    } else {
+        tail = text;
+    }
+}
+
+template <typename Visitor>
+void Rope::forEachChunk(Visitor&& visit) const {
+    std::vector<const Node*> pending;
+    if (root) pending.push_back(root.get());
+    while (!pending.empty()) {
+        const Node* node = pending.back();
+        pending.pop_back();
+        if (node->depth == 0) {
+            visit(node->text());
+        } else {
+            pending.push_back(node->right.get());
+            pending.push_back(node->left.get());
+        }
+    }
+    if (!tail.empty()) visit(std::string_view(tail));
+}
+
+Rope Rope::view(std::string_view data, std::shared_ptr<const void> owner) {
+    Rope result;
+    if (!data.empty()) result.root = makeView(data, owner);
+    return result;
+}
+
+bool Rope::flat(std::string_view& out) const {
+    if (!root) {
+        out = tail;
+        return true;
+    }
+    if (root->depth != 0 || !tail.empty()) return false;
+    out = root->text();
+    return true;
+}
+
+Rope::NodePtr Rope::makeLeaf(std::string text) {
+    auto node = std::make_shared<Node>();
+    node->length = text.length();
+    node->owned = text.length();
+    node->leaf = std::move(text);
+    return node;
+}
+
+Rope::NodePtr Rope::makeView(std::string_view text, const std::shared_ptr<const void>& owner) {
+    auto node = std::make_shared<Node>();
+    node->length = text.length();
+    node->external = text;
+    node->owner = owner;
+    node->borrowed = true;
+    return node;
+}
+
+Rope::NodePtr Rope::makeNode(const NodePtr& left, const NodePtr& right) {
+    auto node = std::make_shared<Node>();
+    node->left = left;
+    node->right = right;
+    node->length = left->length + right->length;
+    node->owned = left->owned + right->owned;
+    node->depth = std::max(left->depth, right->depth) + 1;
+    return node;
+}
+
+// 把一段文本切成 LEAF_SIZE 大小的叶子, 自底向上构建平衡树
+Rope::NodePtr Rope::build(const std::string& text, size_t start, size_t count) {
+    if (count <= LEAF_SIZE) return makeLeaf(text.substr(start, count));
+    size_t leaves = (count + LEAF_SIZE - 1) / LEAF_SIZE;
+    size_t half = (leaves / 2) * LEAF_SIZE;
+    return makeNode(build(text, start, half), build(text, start + half, count - half));
+}
+
+// 左右子树高度差不超过 2 时, 通过一次单旋或双旋恢复平衡
+Rope::NodePtr Rope::balance(const NodePtr& left, const NodePtr& right) {
+    if (left->depth > right->depth + 1) {
+        if (depthOf(left->left) >= depthOf(left->right)) {
+            return makeNode(left->left, makeNode(left->right, right));
+        }
+        return makeNode(makeNode(left->left, left->right->left),
+                        makeNode(left->right->right, right));
+    }
+    if (right->depth > left->depth + 1) {
+        if (depthOf(right->right) >= depthOf(right->left)) {
+            return makeNode(makeNode(left, right->left), right->right);
+        }
+        return makeNode(makeNode(left, right->left->left),
+                        makeNode(right->left->right, right->right));
+    }
+    return makeNode(left, right);
+}
+
+// AVL 式拼接: 沿较高一侧的边缘下降到高度相近的位置再挂接, O(log n)
+Rope::NodePtr Rope::join(const NodePtr& left, const NodePtr& right) {
+    if (!left || left->length == 0) return right;
+    if (!right || right->length == 0) return left;
+
+    if (left->depth == 0 && right->depth == 0 && left->length + right->length <= LEAF_SIZE) {
+        std::string text(left->text());
+        text.append(right->text());
+        return makeLeaf(std::move(text));
+    }
+    if (left->depth > right->depth + 1) {
+        return balance(left->left, join(left->right, right));
+    }
+    if (right->depth > left->depth + 1) {
+        return balance(join(left, right->left), right->right);
+    }
+    return makeNode(left, right);
+}
+
+Rope::NodePtr Rope::slice(const NodePtr& node, size_t start, size_t count) {
+    if (!node || count == 0) return nullptr;
+    if (start == 0 && count == node->length) return node;
+    if (node->depth == 0) {
+        // 宿主缓冲区的切片仍然引用原来的内存
+        if (node->borrowed) return makeView(node->external.substr(start, count), node->owner);
+        return makeLeaf(node->leaf.substr(start, count));
+    }
+
+    size_t leftLen = node->left->length;
+    if (start + count <= leftLen) return slice(node->left, start, count);
+    if (start >= leftLen) return slice(node->right, start - leftLen, count);
+
+    size_t leftCount = leftLen - start;
+    return join(slice(node->left, start, leftCount), slice(node->right, 0, count - leftCount));
+}
+
+void Rope::flushTail() {
+    if (tail.empty()) return;
+    NodePtr chunk = tail.length() > LEAF_SIZE ? build(tail, 0, tail.length()) : makeLeaf(std::move(tail));
+    root = join(root, chunk);
+    tail.clear();
+}
+
+char Rope::at(size_t index) const {
+    if (index >= length()) throw std::out_of_range("rope index out of range");
+
+    size_t rootLen = root ? root->length : 0;
+    if (index >= rootLen) return tail[index - rootLen];
+
+    const Node* node = root.get();
+    while (node->depth > 0) {
+        if (index < node->left->length) {
+            node = node->left.get();
+        } else {
+            index -= node->left->length;
+            node = node->right.get();
+        }
+    }
+    return node->text()[index];
+}
+
+Rope Rope::slice(size_t start, size_t count) const {
+    Rope result;
+    size_t len = length();
+    if (start >= len) return result;
+    count = std::min(count, len - start);
+
+    size_t rootLen = root ? root->length : 0;
+    if (start < rootLen) {
+        size_t fromRoot = std::min(count, rootLen - start);
+        result.root = slice(root, start, fromRoot);
+        start += fromRoot;
+        count -= fromRoot;
+    }
+    if (count > 0) result.tail = tail.substr(start - rootLen, count);
+    return result;
+}
+
+std::string Rope::substr(size_t start, size_t count) const {
+    return slice(start, count).str();
+}
+
+void Rope::append(const std::string& text) {
+    tail += text;
+    if (tail.length() >= LEAF_SIZE) flushTail();
+}
+
+void Rope::append(const Rope& other) {
+    if (other.length() < LEAF_SIZE) {
+        other.forEachChunk([this](std::string_view chunk) { tail.append(chunk); });
+        if (tail.length() >= LEAF_SIZE) flushTail();
+        return;
+    }
+    flushTail();
+    root = join(root, other.root);
+    tail = other.tail;
+}
+
+void Rope::appendTo(std::string& out) const {
+    out.reserve(out.length() + length());
+    forEachChunk([&out](std::string_view chunk) { out.append(chunk); });
+}
+
+std::string Rope::str() const {
+    std::string result;
+    appendTo(result);
+    return result;
+}
+
+void Rope::write(std::ostream& os) const {
+    forEachChunk([&os](std::string_view chunk) { os.write(chunk.data(), chunk.length()); });
+}
+
+void Rope::visitChunks(const std::function<void(std::string_view)>& visit) const {
+    forEachChunk(visit);
+}
@@ -0,0 +1,449 @@
+#include "StringKernels.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define TCLUA_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+enum class Isa { SCALAR, SSE42, AVX2 };
+
+// TCLUA_ISA=scalar|sse4.2 可以强制使用较低的实现, 便于对比结果
+Isa detectIsa() {
+    const char* forced = std::getenv("TCLUA_ISA");
+    if (forced && std::strcmp(forced, "scalar") == 0) return Isa::SCALAR;
+#ifdef TCLUA_X86_KERNELS
+    __builtin_cpu_init();
+    bool sse42Only = forced && std::strcmp(forced, "sse4.2") == 0;
+    if (!sse42Only && __builtin_cpu_supports("avx2")) return Isa::AVX2;
+    if (__builtin_cpu_supports("sse4.2")) return Isa::SSE42;
+#endif
+    return Isa::SCALAR;
+}
+
+const Isa activeIsa = detectIsa();
+
+// 向量化路径只处理不超过 16 个字符的集合, 更大的集合走位图查表
+const size_t MAX_VECTOR_SET = 16;
+
+size_t scanForwardScalar(const char* s, size_t n, size_t from, const StringKernels::CharSet& set, bool negate) {
+    for (size_t i = from; i < n; i++) {
+        if (set.contains(static_cast<unsigned char>(s[i])) != negate) return i;
+    }
+    return StringKernels::npos;
+}
+
+size_t scanBackwardScalar(const char* s, size_t n, const StringKernels::CharSet& set, bool negate) {
+    for (size_t i = n; i > 0; i--) {
+        if (set.contains(static_cast<unsigned char>(s[i - 1])) != negate) return i - 1;
+    }
+    return StringKernels::npos;
+}
+
+// JSON 字符串中需要单独处理的字节: 引号, 反斜杠, 控制字符以及非 ASCII 字节
+inline bool jsonSpecial(unsigned char c) {
+    return c == '"' || c == '\\' || c < 0x20 || c >= 0x80;
+}
+
+size_t scanJsonStringScalar(const char* s, size_t n, size_t from) {
+    for (size_t i = from; i < n; i++) {
+        if (jsonSpecial(static_cast<unsigned char>(s[i]))) return i;
+    }
+    return StringKernels::npos;
+}
+
+#ifdef TCLUA_X86_KERNELS
+
+// ---- AVX2: 首尾字符过滤的子串查找, 每次处理 32 个候选位置 ----
+
+__attribute__((target("avx2")))
+size_t findAvx2(const char* s, size_t n, const char* needle, size_t m, size_t from) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    const size_t inner = m >= 2 ? m - 2 : 0;
+    size_t i = from;
+    for (; i + m - 1 + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + m - 1));
+        uint32_t mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (std::memcmp(s + i + bit + 1, needle + 1, inner) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return std::string_view(s, n).find(std::string_view(needle, m), i);
+}
+
+__attribute__((target("avx2")))
+size_t rfindAvx2(const char* s, size_t n, const char* needle, size_t m, size_t limit) {
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[m - 1]);
+    const size_t inner = m >= 2 ? m - 2 : 0;
+    size_t end = limit + 1; // 尚未检查的候选起点为 [0, end)
+    while (end >= 32) {
+        size_t i = end - 32;
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i + m - 1));
+        uint32_t mask = _mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = 31 - __builtin_clz(mask);
+            if (std::memcmp(s + i + bit + 1, needle + 1, inner) == 0) return i + bit;
+            mask &= ~(1u << bit);
+        }
+        end = i;
+    }
+    if (end == 0) return StringKernels::npos;
+    return std::string_view(s, n).rfind(std::string_view(needle, m), end - 1);
+}
+
+__attribute__((target("avx2")))
+inline uint32_t setMaskAvx2(const char* p, const __m256i* needles, size_t count) {
+    __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t k = 0; k < count; k++) {
+        acc = _mm256_or_si256(acc, _mm256_cmpeq_epi8(block, needles[k]));
+    }
+    return static_cast<uint32_t>(_mm256_movemask_epi8(acc));
+}
+
+__attribute__((target("avx2")))
+size_t scanForwardAvx2(const char* s, size_t n, size_t from, const StringKernels::CharSet& set, bool negate) {
+    const std::string& chars = set.chars();
+    __m256i needles[MAX_VECTOR_SET];
+    for (size_t k = 0; k < chars.size(); k++) needles[k] = _mm256_set1_epi8(chars[k]);
+
+    size_t i = from;
+    for (; i + 32 <= n; i += 32) {
+        uint32_t mask = setMaskAvx2(s + i, needles, chars.size());
+        if (negate) mask = ~mask;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return scanForwardScalar(s, n, i, set, negate);
+}
+
+__attribute__((target("avx2")))
+size_t scanBackwardAvx2(const char* s, size_t n, const StringKernels::CharSet& set, bool negate) {
+    const std::string& chars = set.chars();
+    __m256i needles[MAX_VECTOR_SET];
+    for (size_t k = 0; k < chars.size(); k++) needles[k] = _mm256_set1_epi8(chars[k]);
+
+    size_t i = n;
+    while (i >= 32) {
+        i -= 32;
+        uint32_t mask = setMaskAvx2(s + i, needles, chars.size());
+        if (negate) mask = ~mask;
+        if (mask) return i + 31 - __builtin_clz(mask);
+    }
+    return scanBackwardScalar(s, i, set, negate);
+}
+
+// 有符号比较 c < 0x20 同时覆盖控制字符和 >= 0x80 的字节
+__attribute__((target("avx2")))
+size_t scanJsonStringAvx2(const char* s, size_t n, size_t from) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i space = _mm256_set1_epi8(0x20);
+    size_t i = from;
+    for (; i + 32 <= n; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(s + i));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash));
+        hits = _mm256_or_si256(hits, _mm256_cmpgt_epi8(space, block));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hits));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return scanJsonStringScalar(s, n, i);
+}
+
+// ---- SSE4.2: 16 字节块; 字符集合比较使用 pcmpestrm ----
+
+__attribute__((target("sse4.2")))
+size_t findSse42(const char* s, size_t n, const char* needle, size_t m, size_t from) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    const size_t inner = m >= 2 ? m - 2 : 0;
+    size_t i = from;
+    for (; i + m - 1 + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + m - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = __builtin_ctz(mask);
+            if (std::memcmp(s + i + bit + 1, needle + 1, inner) == 0) return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    return std::string_view(s, n).find(std::string_view(needle, m), i);
+}
+
+__attribute__((target("sse4.2")))
+size_t rfindSse42(const char* s, size_t n, const char* needle, size_t m, size_t limit) {
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[m - 1]);
+    const size_t inner = m >= 2 ? m - 2 : 0;
+    size_t end = limit + 1;
+    while (end >= 16) {
+        size_t i = end - 16;
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i + m - 1));
+        uint32_t mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask) {
+            unsigned bit = 31 - __builtin_clz(mask);
+            if (std::memcmp(s + i + bit + 1, needle + 1, inner) == 0) return i + bit;
+            mask &= ~(1u << bit);
+        }
+        end = i;
+    }
+    if (end == 0) return StringKernels::npos;
+    return std::string_view(s, n).rfind(std::string_view(needle, m), end - 1);
+}
+
+__attribute__((target("sse4.2")))
+inline uint32_t setMaskSse42(const char* p, __m128i chars, int count) {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    __m128i mask = _mm_cmpestrm(chars, count, block, 16,
+                                _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_BIT_MASK);
+    return static_cast<uint32_t>(_mm_cvtsi128_si32(mask)) & 0xFFFF;
+}
+
+__attribute__((target("sse4.2")))
+__m128i loadCharSet(const std::string& chars) {
+    char buf[16] = {0};
+    std::memcpy(buf, chars.data(), chars.size());
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+}
+
+__attribute__((target("sse4.2")))
+size_t scanForwardSse42(const char* s, size_t n, size_t from, const StringKernels::CharSet& set, bool negate) {
+    const __m128i chars = loadCharSet(set.chars());
+    const int count = static_cast<int>(set.chars().size());
+    size_t i = from;
+    for (; i + 16 <= n; i += 16) {
+        uint32_t mask = setMaskSse42(s + i, chars, count);
+        if (negate) mask = ~mask & 0xFFFF;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return scanForwardScalar(s, n, i, set, negate);
+}
+
+__attribute__((target("sse4.2")))
+size_t scanBackwardSse42(const char* s, size_t n, const StringKernels::CharSet& set, bool negate) {
+    const __m128i chars = loadCharSet(set.chars());
+    const int count = static_cast<int>(set.chars().size());
+    size_t i = n;
+    while (i >= 16) {
+        i -= 16;
+        uint32_t mask = setMaskSse42(s + i, chars, count);
+        if (negate) mask = ~mask & 0xFFFF;
+        if (mask) return i + 31 - __builtin_clz(mask);
+    }
+    return scanBackwardScalar(s, i, set, negate);
+}
+
+__attribute__((target("sse4.2")))
+size_t scanJsonStringSse42(const char* s, size_t n, size_t from) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i space = _mm_set1_epi8(0x20);
+    size_t i = from;
+    for (; i + 16 <= n; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(block, quote), _mm_cmpeq_epi8(block, backslash));
+        hits = _mm_or_si128(hits, _mm_cmplt_epi8(block, space));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return scanJsonStringScalar(s, n, i);
+}
+
+#endif // TCLUA_X86_KERNELS
+
+size_t scanForward(std::string_view text, const StringKernels::CharSet& set, size_t from, bool negate) {
+    if (from >= text.size()) return StringKernels::npos;
+#ifdef TCLUA_X86_KERNELS
+    if (!set.chars().empty() && set.chars().size() <= MAX_VECTOR_SET) {
+        if (activeIsa == Isa::AVX2) return scanForwardAvx2(text.data(), text.size(), from, set, negate);
+        if (activeIsa == Isa::SSE42) return scanForwardSse42(text.data(), text.size(), from, set, negate);
+    }
+#endif
+    return scanForwardScalar(text.data(), text.size(), from, set, negate);
+}
+
+size_t scanBackward(std::string_view text, const StringKernels::CharSet& set, bool negate) {
+#ifdef TCLUA_X86_KERNELS
+    if (!set.chars().empty() && set.chars().size() <= MAX_VECTOR_SET) {
+        if (activeIsa == Isa::AVX2) return scanBackwardAvx2(text.data(), text.size(), set, negate);
+        if (activeIsa == Isa::SSE42) return scanBackwardSse42(text.data(), text.size(), set, negate);
+    }
+#endif
+    return scanBackwardScalar(text.data(), text.size(), set, negate);
+}
+
+bool equalsAt(std::string_view text, size_t pos, const std::string& key, bool nocase) {
+    if (!nocase) return std::memcmp(text.data() + pos, key.data(), key.size()) == 0;
+    for (size_t k = 0; k < key.size(); k++) {
+        if (tolower(static_cast<unsigned char>(text[pos + k])) != tolower(static_cast<unsigned char>(key[k]))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+StringKernels::CharSet::CharSet(std::string_view chars, bool nocase) {
+    auto add = [this](unsigned char c) {
+        if (contains(c)) return;
+        bits[c >> 6] |= uint64_t(1) << (c & 63);
+        list += static_cast<char>(c);
+    };
+    for (char c : chars) {
+        unsigned char uc = static_cast<unsigned char>(c);
+        add(uc);
+        if (nocase) {
+            add(static_cast<unsigned char>(tolower(uc)));
+            add(static_cast<unsigned char>(toupper(uc)));
+        }
+    }
+}
+
+const StringKernels::CharSet& StringKernels::whitespace() {
+    static const CharSet set(" \t\n\r\v\f");
+    return set;
+}
+
+size_t StringKernels::find(std::string_view haystack, std::string_view needle, size_t from) {
+    size_t n = haystack.size(), m = needle.size();
+    if (m == 0) return from <= n ? from : npos;
+    if (from >= n || m > n - from) return npos;
+    if (m == 1) {
+        const void* hit = std::memchr(haystack.data() + from, needle[0], n - from);
+        return hit ? static_cast<const char*>(hit) - haystack.data() : npos;
+    }
+#ifdef TCLUA_X86_KERNELS
+    if (activeIsa == Isa::AVX2) return findAvx2(haystack.data(), n, needle.data(), m, from);
+    if (activeIsa == Isa::SSE42) return findSse42(haystack.data(), n, needle.data(), m, from);
+#endif
+    return haystack.find(needle, from);
+}
+
+size_t StringKernels::rfind(std::string_view haystack, std::string_view needle, size_t before) {
+    size_t n = haystack.size(), m = needle.size();
+    if (m > n) return npos;
+    size_t limit = std::min(before, n - m);
+    if (m == 0) return limit;
+#ifdef TCLUA_X86_KERNELS
+    if (activeIsa == Isa::AVX2) return rfindAvx2(haystack.data(), n, needle.data(), m, limit);
+    if (activeIsa == Isa::SSE42) return rfindSse42(haystack.data(), n, needle.data(), m, limit);
+#endif
+    return haystack.rfind(needle, limit);
+}
+
+size_t StringKernels::findFirstOf(std::string_view text, const CharSet& set, size_t from) {
+    return scanForward(text, set, from, false);
+}
+
+size_t StringKernels::findFirstNotOf(std::string_view text, const CharSet& set, size_t from) {
+    return scanForward(text, set, from, true);
+}
+
+size_t StringKernels::findLastNotOf(std::string_view text, const CharSet& set) {
+    return scanBackward(text, set, true);
+}
+
+std::vector<std::string> StringKernels::split(std::string_view text, const CharSet& set) {
+    std::vector<std::string> result;
+    if (text.empty()) return result;
+
+    // 空的分隔符集合表示拆成单个字符
+    if (set.chars().empty()) {
+        result.reserve(text.size());
+        for (char c : text) result.emplace_back(1, c);
+        return result;
+    }
+
+    size_t pos = 0;
+    while (true) {
+        size_t next = findFirstOf(text, set, pos);
+        if (next == npos) {
+            result.emplace_back(text.substr(pos));
+            break;
+        }
+        result.emplace_back(text.substr(pos, next - pos));
+        pos = next + 1;
+    }
+    return result;
+}
+
+std::string_view StringKernels::trim(std::string_view text, const CharSet& set, bool left, bool right) {
+    if (left) {
+        size_t first = findFirstNotOf(text, set, 0);
+        if (first == npos) return std::string_view();
+        text.remove_prefix(first);
+    }
+    if (right) {
+        size_t last = findLastNotOf(text, set);
+        if (last == npos) return std::string_view();
+        text.remove_suffix(text.size() - last - 1);
+    }
+    return text;
+}
+
+std::string StringKernels::map(std::string_view text,
+                               const std::vector<std::pair<std::string, std::string>>& mapping,
+                               bool nocase) {
+    std::string firstChars;
+    for (const auto& entry : mapping) {
+        if (!entry.first.empty()) firstChars += entry.first[0];
+    }
+    CharSet candidates(firstChars, nocase);
+
+    std::string result;
+    result.reserve(text.size());
+    size_t pos = 0, copied = 0;
+
+    // 用向量化扫描跳过不可能匹配任何键的字节, 只在候选位置逐个比较键
+    while (!firstChars.empty() && (pos = findFirstOf(text, candidates, pos)) != npos) {
+        bool replaced = false;
+        for (const auto& entry : mapping) {
+            const std::string& key = entry.first;
+            if (key.empty() || key.size() > text.size() - pos) continue;
+            if (equalsAt(text, pos, key, nocase)) {
+                result.append(text.data() + copied, pos - copied);
+                result += entry.second;
+                pos += key.size();
+                copied = pos;
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) pos++;
+    }
+
+    result.append(text.data() + copied, text.size() - copied);
+    return result;
+}
+
+size_t StringKernels::scanJsonString(std::string_view text, size_t from) {
+    if (from >= text.size()) return npos;
+#ifdef TCLUA_X86_KERNELS
+    if (activeIsa == Isa::AVX2) return scanJsonStringAvx2(text.data(), text.size(), from);
+    if (activeIsa == Isa::SSE42) return scanJsonStringSse42(text.data(), text.size(), from);
+#endif
+    return scanJsonStringScalar(text.data(), text.size(), from);
+}
+
+const char* StringKernels::isaName() {
+    switch (activeIsa) {
+        case Isa::AVX2: return "avx2";
+        case Isa::SSE42: return "sse4.2";
+        default: return "scalar";
+    }
+}
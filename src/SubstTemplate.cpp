@@ -0,0 +1,221 @@
+#include "SubstTemplate.h"
+#include "MemoryAccount.h"
+#include "ExpressionParser.h"
+#include "ModuleRegistry.h"
+#include "Tokenizer.h"
+#include <cctype>
+
+namespace {
+
+bool isNameChar(char c) {
+    return isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// 扫描 $ 之后的变量名, 支持 name, ns::name, table.field, table(key)
+size_t scanVariableName(const std::string& text, size_t pos, size_t end) {
+    while (pos < end) {
+        if (isNameChar(text[pos])) {
+            pos++;
+        } else if (text[pos] == ':' && pos + 2 < end && text[pos + 1] == ':' && isNameChar(text[pos + 2])) {
+            pos += 2;
+        } else if (text[pos] == '.' && pos + 1 < end && isNameChar(text[pos + 1])) {
+            pos++;
+        } else if (text[pos] == '(') {
+            size_t close = text.find(')', pos);
+            if (close == std::string::npos || close >= end) break;
+            return close + 1;
+        } else {
+            break;
+        }
+    }
+    return pos;
+}
+
+char unescape(char c) {
+    switch (c) {
+        case 'n': return '\n';
+        case 't': return '\t';
+        case 'r': return '\r';
+        case '0': return '\0';
+        default: return c;
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const SubstTemplate> SubstTemplate::compile(const std::string& word, const Upvalues* upvalues) {
+    auto tmpl = std::make_shared<SubstTemplate>();
+
+    if (word.length() >= 2 && word.front() == '{' && word.back() == '}') {
+        // 大括号内不做任何替换
+        tmpl->constant = std::make_shared<const std::string>(word.substr(1, word.length() - 2));
+        if (upvalues) tmpl->upvalue = upvalues->indexOf(*tmpl->constant);
+        return tmpl;
+    }
+
+    if (word.length() >= 2 && word.front() == '"' && word.back() == '"') {
+        tmpl->parse(word, 1, word.length() - 1, true);
+    } else {
+        tmpl->parse(word, 0, word.length(), true);
+    }
+
+    if (tmpl->slotCount == 0) {
+        std::string text;
+        if (!tmpl->segments.empty()) text = tmpl->segments.front().text;
+        tmpl->segments.clear();
+        tmpl->constant = std::make_shared<const std::string>(std::move(text));
+        if (upvalues) tmpl->upvalue = upvalues->indexOf(*tmpl->constant);
+    } else if (upvalues) {
+        for (Segment& segment : tmpl->segments) {
+            if (segment.kind == VARIABLE && segment.symbol < 0) segment.upvalue = upvalues->indexOf(segment.text);
+        }
+    }
+    return tmpl;
+}
+
+void SubstTemplate::addLiteral(std::string& pending) {
+    if (pending.empty()) return;
+    literalLength += pending.length();
+    segments.push_back({LITERAL, std::move(pending)});
+    pending.clear();
+}
+
+void SubstTemplate::addVariable(std::string name) {
+    int symbol = -1;
+    if (name.find("::") != std::string::npos && name.find_first_of(".(") == std::string::npos) {
+        symbol = ModuleRegistry::symbol(name);
+    }
+    segments.push_back({VARIABLE, std::move(name), symbol});
+    slotCount++;
+}
+
+void SubstTemplate::parse(const std::string& text, size_t begin, size_t end, bool backslashes) {
+    std::string pending;
+    size_t pos = begin;
+
+    while (pos < end) {
+        char c = text[pos];
+
+        if (c == '\\' && backslashes && pos + 1 < end) {
+            pending += unescape(text[pos + 1]);
+            pos += 2;
+            continue;
+        }
+
+        if (c == '$' && pos + 1 < end) {
+            if (text[pos + 1] == '{') {
+                size_t close = text.find('}', pos + 2);
+                if (close != std::string::npos && close < end) {
+                    addLiteral(pending);
+                    addVariable(text.substr(pos + 2, close - pos - 2));
+                    pos = close + 1;
+                    continue;
+                }
+            } else {
+                size_t nameEnd = scanVariableName(text, pos + 1, end);
+                if (nameEnd > pos + 1) {
+                    addLiteral(pending);
+                    addVariable(text.substr(pos + 1, nameEnd - pos - 1));
+                    pos = nameEnd;
+                    continue;
+                }
+            }
+        }
+
+        if (c == '[') {
+            size_t close = Tokenizer::matchBracket(text, pos, end);
+            if (close != std::string::npos) {
+                addLiteral(pending);
+                segments.push_back({COMMAND, text.substr(pos + 1, close - pos - 1)});
+                slotCount++;
+                hasCommands = true;
+                pos = close + 1;
+                continue;
+            }
+        }
+
+        pending += c;
+        pos++;
+    }
+
+    addLiteral(pending);
+}
+
+Value SubstTemplate::evaluate(const VariableManager& vars, const CommandEvaluator& evalCommand,
+                              int line) const {
+    if (constant) return *constant;
+    if (segments.size() == 1) {
+        const Segment& seg = segments.front();
+        if (seg.kind == VARIABLE) {
+            const Value* slot = vars.lookup(seg.text, seg.symbol, seg.upvalue);
+            return slot ? *slot : vars.get(seg.text, line);
+        }
+        if (seg.kind == COMMAND) return evalCommand(seg.text);
+    }
+    return render(vars, evalCommand, line);
+}
+
+std::string SubstTemplate::render(const VariableManager& vars, const CommandEvaluator& evalCommand,
+                                  int line) const {
+    if (constant) return *constant;
+
+    // 单个槽且无字面量时直接返回槽的值, 不做拼接
+    if (segments.size() == 1) {
+        const Segment& seg = segments.front();
+        if (seg.kind == VARIABLE) {
+            if (const Value* slot = vars.lookup(seg.text, seg.symbol, seg.upvalue)) {
+                return ExpressionParser::valueToString(*slot);
+            }
+            return ExpressionParser::valueToString(vars.get(seg.text, line));
+        }
+        return ExpressionParser::valueToString(evalCommand(seg.text));
+    }
+
+    // 先按从左到右的顺序求出所有槽, 再算出总长度, 结果只分配一次。
+    // 没有命令槽时变量值不会在渲染期间改变, 可以直接引用变量槽而不复制
+    std::vector<std::string> owned;
+    std::vector<const std::string*> parts;
+    owned.reserve(slotCount);
+    parts.reserve(slotCount);
+
+    size_t total = literalLength;
+    for (const Segment& seg : segments) {
+        if (seg.kind == LITERAL) continue;
+
+        const std::string* part = nullptr;
+        if (seg.kind == VARIABLE && !hasCommands) {
+            const Value* slot = vars.lookup(seg.text, seg.symbol, seg.upvalue);
+            if (slot && std::holds_alternative<std::string>(*slot)) {
+                part = &std::get<std::string>(*slot);
+            } else {
+                owned.push_back(ExpressionParser::valueToString(slot ? *slot : vars.get(seg.text, line)));
+                part = &owned.back();
+            }
+        } else if (seg.kind == VARIABLE) {
+            const Value* slot = seg.upvalue >= 0 ? vars.lookup(seg.text, seg.symbol, seg.upvalue) : nullptr;
+            owned.push_back(ExpressionParser::valueToString(slot ? *slot : vars.get(seg.text, line)));
+            part = &owned.back();
+        } else {
+            owned.push_back(ExpressionParser::valueToString(evalCommand(seg.text)));
+            part = &owned.back();
+        }
+        total += part->length();
+        parts.push_back(part);
+    }
+
+    std::string result;
+    result.reserve(total);
+    size_t slot = 0;
+    for (const Segment& seg : segments) {
+        if (seg.kind == LITERAL) result += seg.text;
+        else result += *parts[slot++];
+    }
+    return result;
+}
+
+size_t SubstTemplate::memoryUsage() const {
+    size_t bytes = sizeof(SubstTemplate) + segments.capacity() * sizeof(Segment);
+    for (const auto& segment : segments) bytes += MemoryAccount::footprint(segment.text);
+    if (constant) bytes += sizeof(std::string) + MemoryAccount::footprint(*constant);
+    return bytes;
+}
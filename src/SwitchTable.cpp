@@ -0,0 +1,111 @@
+#include "SwitchTable.h"
+#include "InterpreterException.h"
+#include "MemoryAccount.h"
+#include <algorithm>
+
+namespace {
+
+// unordered_map 中一个节点的大致大小 (键值对加上链表指针和缓存的哈希值)
+template <typename Entry>
+size_t nodeBytes() {
+    return sizeof(Entry) + 2 * sizeof(void*);
+}
+
+} // namespace
+
+SwitchTable::SwitchTable(const std::vector<std::string>& arms, Mode mode, const GlobFactory& makeGlob) {
+    if (arms.size() % 2 != 0) {
+        throw RuntimeError("extra switch pattern with no body");
+    }
+    size_t count = arms.size() / 2;
+    if (count > 0 && arms.back() == "-") {
+        throw RuntimeError("no body specified for pattern \"" + arms[arms.size() - 2] + "\"");
+    }
+    
+    patterns.resize(count);
+    bodies.resize(count);
+    globs.resize(count);
+    // 哈希表的键指向这些字符串, 之后不能再让它们搬家
+    unescaped.reserve(count);
+    
+    // 主体为 "-" 的分支穿透到后面第一个真正的主体
+    for (size_t k = count; k-- > 0;) {
+        patterns[k] = arms[2 * k];
+        const std::string& body = arms[2 * k + 1];
+        bodies[k] = body == "-" ? bodies[k + 1] : body;
+    }
+    
+    literals.reserve(count);
+    for (size_t k = 0; k < count; k++) {
+        const std::string& pattern = patterns[k];
+        if (pattern == "default" && k + 1 == count) {
+            defaultArm = static_cast<int>(k);
+            continue;
+        }
+        
+        std::string_view key = pattern;
+        if (mode == GLOB) {
+            auto glob = makeGlob(pattern);
+            if (!glob->isLiteral()) {
+                globs[k] = glob;
+                const std::string& prefix = glob->literalPrefix();
+                if (prefix.empty()) {
+                    unprefixedGlobs.push_back(static_cast<int>(k));
+                } else {
+                    globsByPrefix[prefix].push_back(static_cast<int>(k));
+                    prefixLengths.push_back(prefix.length());
+                }
+                continue;
+            }
+            // 不含通配符的 glob 模式和 -exact 一样按字面量处理
+            if (glob->literalPrefix() != pattern) {
+                unescaped.push_back(glob->literalPrefix());
+                key = unescaped.back();
+            }
+        }
+        
+        // 重复的模式只保留第一个
+        literals.emplace(key, static_cast<int>(k));
+    }
+    
+    std::sort(prefixLengths.begin(), prefixLengths.end());
+    prefixLengths.erase(std::unique(prefixLengths.begin(), prefixLengths.end()), prefixLengths.end());
+    
+    codeBytes = sizeof(SwitchTable) + (patterns.capacity() + bodies.capacity() + unescaped.capacity()) * sizeof(std::string) +
+                globs.capacity() * sizeof(globs[0]) + prefixLengths.capacity() * sizeof(size_t) +
+                unprefixedGlobs.capacity() * sizeof(int) +
+                literals.size() * nodeBytes<decltype(literals)::value_type>() +
+                globsByPrefix.size() * nodeBytes<decltype(globsByPrefix)::value_type>() +
+                (literals.bucket_count() + globsByPrefix.bucket_count()) * sizeof(void*);
+    for (size_t k = 0; k < count; k++) {
+        codeBytes += MemoryAccount::footprint(patterns[k]) + MemoryAccount::footprint(bodies[k]);
+        // 编译后的模式大致与模式文本同样大
+        if (globs[k]) codeBytes += sizeof(GlobPattern) + 2 * patterns[k].size();
+    }
+    for (const auto& text : unescaped) codeBytes += MemoryAccount::footprint(text);
+    for (const auto& group : globsByPrefix) codeBytes += group.second.capacity() * sizeof(int);
+}
+
+int SwitchTable::firstMatch(const std::vector<int>& arms, std::string_view subject, int chosen) const {
+    for (int arm : arms) {
+        if (chosen >= 0 && arm > chosen) break;
+        if (globs[arm]->matches(subject)) return arm;
+    }
+    return chosen;
+}
+
+const std::string* SwitchTable::select(std::string_view subject) const {
+    auto literal = literals.find(subject);
+    int chosen = literal != literals.end() ? literal->second : -1;
+    
+    // 只有编号小于当前选中分支的 glob 分支才可能优先
+    for (size_t length : prefixLengths) {
+        if (length > subject.length()) break;
+        auto group = globsByPrefix.find(subject.substr(0, length));
+        if (group != globsByPrefix.end()) chosen = firstMatch(group->second, subject, chosen);
+    }
+    chosen = firstMatch(unprefixedGlobs, subject, chosen);
+    
+    if (chosen < 0) chosen = defaultArm;
+    return chosen >= 0 ? &bodies[chosen] : nullptr;
+}
@@ -1,37 +1,76 @@
-#ifndef TABLE_H
-#define TABLE_H
+#include "Table.h"
+#include "MemoryAccount.h"
 
-#include <map>
-#include <string>
-#include <vector>
-#include <memory>
-#include <variant>
-#include <functional>
+namespace {
 
-using Value = std::variant<double, std::string, bool, std::nullptr_t, std::shared_ptr<class Table>>;
+size_t fieldBytes(const std::string& key) {
+    return MemoryAccount::MAP_NODE_BYTES + MemoryAccount::footprint(key);
+}
 
-class Table;
+} // namespace
 
-class Table : public std::enable_shared_from_this<Table> {
-public:
-    std::map<std::string, Value> fields;
-    std::shared_ptr<Table> metatable;
-    
-    bool contains(const std::string& key) const;
-    Value get(const std::string& key, int line = -1) const;
-    void set(const std::string& key, const Value& value);
-    
-    std::vector<std::string> keys() const;
-    std::vector<Value> values() const;
-    
-    void sort(const std::function<bool(const Value&, const Value&)>& comparator);
-    Table filter(const std::function<bool(const std::string&, const Value&)>& predicate) const;
-    Table map(const std::function<Value(const std::string&, const Value&)>& mapper) const;
-};
+Table::Table() {
+    if (MemoryAccount* current = MemoryAccount::current()) {
+        current->charge(MemoryAccount::TABLES, sizeof(Table));
+        account = current->shared_from_this();
+    }
+}
+
+Table::Table(const Table& other)
+    : std::enable_shared_from_this<Table>(), fields(other.fields), metatable(other.metatable) {
+    if (MemoryAccount* current = MemoryAccount::current()) {
+        size_t tableBytes = sizeof(Table), stringBytes = 0;
+        for (const auto& field : fields) {
+            tableBytes += fieldBytes(field.first);
+            stringBytes += MemoryAccount::footprint(field.second);
+        }
+        current->charge(MemoryAccount::TABLES, tableBytes);
+        current->charge(MemoryAccount::STRINGS, stringBytes);
+        account = current->shared_from_this();
+    }
+}
+
+Table::~Table() {
+    if (!account) return;
+    size_t tableBytes = sizeof(Table), stringBytes = 0;
+    for (const auto& field : fields) {
+        tableBytes += fieldBytes(field.first);
+        stringBytes += MemoryAccount::footprint(field.second);
+    }
+    account->release(MemoryAccount::TABLES, tableBytes);
+    account->release(MemoryAccount::STRINGS, stringBytes);
+}
+
+// 在修改字段之前记账, 超过限制时字段保持不变
+void Table::charge(const std::string& key, const Value& value, bool newKey) {
+    if (!account) return;
+    if (newKey) account->charge(MemoryAccount::TABLES, fieldBytes(key));
+    try {
+        account->charge(MemoryAccount::STRINGS, MemoryAccount::footprint(value));
+    } catch (...) {
+        if (newKey) account->release(MemoryAccount::TABLES, fieldBytes(key));
+        throw;
+    }
+}
 
-#endif // TABLE_H
 void Table::set(const std::string& key, const Value& value) {
-    fields[key] = value;
+    set(std::string(key), Value(value));
+}
+
+void Table::set(std::string&& key, Value&& value) {
+    // 按键的顺序插入 (解码, 数组) 时直接放在末尾, 不必从根开始查找
+    bool last = fields.empty() || fields.rbegin()->first < key;
+    auto it = last ? fields.end() : fields.find(key);
+    bool newKey = it == fields.end();
+    charge(key, value, newKey);
+    
+    if (newKey) {
+        if (last) fields.emplace_hint(fields.end(), std::move(key), std::move(value));
+        else fields.emplace(std::move(key), std::move(value));
+        return;
+    }
+    if (account) account->release(MemoryAccount::STRINGS, MemoryAccount::footprint(it->second));
+    it->second = std::move(value);
 }
 
 Value Table::get(const std::string& key, int line) const {
@@ -0,0 +1,734 @@
+#include "TableCodec.h"
+#include "InterpreterException.h"
+#include "StringKernels.h"
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <charconv>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <cstdlib>
+
+namespace {
+
+const char BINARY_MAGIC[4] = {'T', 'C', 'L', 'B'};
+const unsigned char BINARY_VERSION = 1;
+const int MAX_DEPTH = 512;
+const size_t STREAM_CHUNK = 64 * 1024;
+
+enum Tag : unsigned char { TAG_NULL, TAG_FALSE, TAG_TRUE, TAG_NUMBER, TAG_STRING, TAG_TABLE, TAG_REF };
+
+// ---- UTF-8 ----
+
+// 从 byteAt(0) 开始的合法 UTF-8 序列的长度, 不合法时返回 0; byteAt 越界时返回 -1
+template <typename ByteAt>
+size_t utf8Length(ByteAt byteAt) {
+    int b0 = byteAt(0);
+    if (b0 < 0x80) return 1;
+
+    size_t length;
+    int low = 0x80, high = 0xBF;  // 第二个字节的范围, 排除超长编码和代理区
+    if (b0 >= 0xC2 && b0 <= 0xDF) {
+        length = 2;
+    } else if (b0 >= 0xE0 && b0 <= 0xEF) {
+        length = 3;
+        if (b0 == 0xE0) low = 0xA0;
+        else if (b0 == 0xED) high = 0x9F;
+    } else if (b0 >= 0xF0 && b0 <= 0xF4) {
+        length = 4;
+        if (b0 == 0xF0) low = 0x90;
+        else if (b0 == 0xF4) high = 0x8F;
+    } else {
+        return 0;
+    }
+
+    for (size_t k = 1; k < length; k++) {
+        int b = byteAt(k);
+        if (k == 1 ? (b < low || b > high) : (b < 0x80 || b > 0xBF)) return 0;
+    }
+    return length;
+}
+
+void appendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += static_cast<char>(cp);
+    } else if (cp < 0x800) {
+        out += static_cast<char>(0xC0 | (cp >> 6));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else if (cp < 0x10000) {
+        out += static_cast<char>(0xE0 | (cp >> 12));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (cp >> 18));
+        out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (cp & 0x3F));
+    }
+}
+
+void appendUnicodeEscape(std::string& out, unsigned char c) {
+    static const char hex[] = "0123456789abcdef";
+    out += "\\u00";
+    out += hex[c >> 4];
+    out += hex[c & 15];
+}
+
+// 把 text 按 JSON 字符串的规则转义后追加到 out。
+// 普通字符整段复制; 末尾的 UTF-8 序列不完整时用 next(k) 读取 text 之后的第 k 个字节补全,
+// 返回因此多用掉的字节数。不合法的字节按 Latin-1 字符转义, 保证输出总是合法的 JSON
+template <typename Next>
+size_t appendEscaped(std::string& out, std::string_view text, Next next) {
+    size_t i = 0;
+    while (i < text.size()) {
+        size_t special = StringKernels::scanJsonString(text, i);
+        if (special == StringKernels::npos) special = text.size();
+        out.append(text.data() + i, special - i);
+        i = special;
+        if (i >= text.size()) break;
+
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += static_cast<char>(c);
+            i++;
+            continue;
+        }
+        if (c < 0x20) {
+            switch (c) {
+                case '\n': out += "\\n"; break;
+                case '\t': out += "\\t"; break;
+                case '\r': out += "\\r"; break;
+                case '\b': out += "\\b"; break;
+                case '\f': out += "\\f"; break;
+                default: appendUnicodeEscape(out, c); break;
+            }
+            i++;
+            continue;
+        }
+
+        auto byteAt = [&](size_t k) -> int {
+            size_t p = i + k;
+            return p < text.size() ? static_cast<unsigned char>(text[p]) : next(p - text.size());
+        };
+        size_t length = utf8Length(byteAt);
+        if (length == 0) {
+            appendUnicodeEscape(out, c);
+            i++;
+            continue;
+        }
+        for (size_t k = 0; k < length; k++) out += static_cast<char>(byteAt(k));
+        i += length;
+    }
+    return i - text.size();
+}
+
+// ---- 二进制格式 ----
+//   "TCLB" 版本号 值
+//   值: TAG_NULL | TAG_FALSE | TAG_TRUE | TAG_NUMBER 8字节小端 | TAG_STRING 长度 字节
+//       | TAG_TABLE 字段数 (键长度 键 值)* 元表值 | TAG_REF 表编号
+// 长度和编号为 varint; 表按第一次出现的顺序编号, 再次出现时写 TAG_REF
+
+class BinaryWriter {
+public:
+    explicit BinaryWriter(std::string& out) : out(out) {}
+
+    void write(const Value& value, int depth) {
+        if (const double* number = std::get_if<double>(&value)) {
+            uint64_t bits;
+            std::memcpy(&bits, number, sizeof(bits));
+            out += static_cast<char>(TAG_NUMBER);
+            for (int k = 0; k < 8; k++) out += static_cast<char>(bits >> (8 * k));
+        } else if (const std::string* text = std::get_if<std::string>(&value)) {
+            out += static_cast<char>(TAG_STRING);
+            bytes(*text);
+        } else if (const bool* flag = std::get_if<bool>(&value)) {
+            out += static_cast<char>(*flag ? TAG_TRUE : TAG_FALSE);
+        } else if (const auto* rope = std::get_if<std::shared_ptr<Rope>>(&value)) {
+            out += static_cast<char>(TAG_STRING);
+            varint((*rope)->length());
+            (*rope)->visitChunks([this](std::string_view chunk) { out.append(chunk.data(), chunk.size()); });
+        } else if (const auto* table = std::get_if<std::shared_ptr<Table>>(&value)) {
+            writeTable(table->get(), depth);
+        } else {
+            out += static_cast<char>(TAG_NULL);
+        }
+    }
+
+private:
+    std::string& out;
+    std::unordered_map<const Table*, uint64_t> ids;
+
+    void varint(uint64_t value) {
+        while (value >= 0x80) {
+            out += static_cast<char>((value & 0x7F) | 0x80);
+            value >>= 7;
+        }
+        out += static_cast<char>(value);
+    }
+
+    void bytes(std::string_view text) {
+        varint(text.size());
+        out.append(text.data(), text.size());
+    }
+
+    void writeTable(const Table* table, int depth) {
+        if (!table) {
+            out += static_cast<char>(TAG_NULL);
+            return;
+        }
+        auto it = ids.find(table);
+        if (it != ids.end()) {
+            out += static_cast<char>(TAG_REF);
+            varint(it->second);
+            return;
+        }
+        if (depth >= MAX_DEPTH) throw RuntimeError("table nesting too deep to encode");
+
+        ids.emplace(table, ids.size());
+        out += static_cast<char>(TAG_TABLE);
+        varint(table->fields.size());
+        for (const auto& field : table->fields) {
+            bytes(field.first);
+            write(field.second, depth + 1);
+        }
+        writeTable(table->metatable.get(), depth + 1);
+    }
+};
+
+class BinaryReader {
+public:
+    explicit BinaryReader(std::string_view data, std::shared_ptr<const void> owner = nullptr,
+                          size_t borrowFrom = SIZE_MAX)
+        : data(data), owner(std::move(owner)), borrowFrom(borrowFrom) {}
+
+    Value document() {
+        if (data.size() < sizeof(BINARY_MAGIC) + 1 || std::memcmp(data.data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0) {
+            fail("not an encoded table");
+        }
+        pos = sizeof(BINARY_MAGIC);
+        if (byte() != BINARY_VERSION) fail("unsupported format version");
+        Value value = read(0);
+        if (pos != data.size()) fail("trailing data");
+        return value;
+    }
+
+private:
+    std::string_view data;
+    std::shared_ptr<const void> owner;
+    size_t borrowFrom;
+    size_t pos = 0;
+    std::vector<std::shared_ptr<Table>> tables;
+
+    [[noreturn]] void fail(const std::string& why) const {
+        throw RuntimeError("invalid binary table data at offset " + std::to_string(pos) + ": " + why);
+    }
+
+    unsigned char byte() {
+        if (pos >= data.size()) fail("unexpected end of data");
+        return static_cast<unsigned char>(data[pos++]);
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            unsigned char b = byte();
+            value |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (!(b & 0x80)) return value;
+        }
+        fail("malformed length");
+    }
+
+    std::string_view bytes() {
+        uint64_t length = varint();
+        if (length > data.size() - pos) fail("string runs past end of data");
+        std::string_view text = data.substr(pos, length);
+        pos += length;
+        return text;
+    }
+
+    Value read(int depth) {
+        switch (byte()) {
+            case TAG_NULL: return nullptr;
+            case TAG_FALSE: return false;
+            case TAG_TRUE: return true;
+            case TAG_NUMBER: {
+                if (data.size() - pos < 8) fail("unexpected end of data");
+                uint64_t bits = 0;
+                for (int k = 0; k < 8; k++) bits |= static_cast<uint64_t>(static_cast<unsigned char>(data[pos + k])) << (8 * k);
+                pos += 8;
+                double number;
+                std::memcpy(&number, &bits, sizeof(number));
+                return number;
+            }
+            case TAG_STRING: {
+                std::string_view text = bytes();
+                if (text.size() >= borrowFrom) return std::make_shared<Rope>(Rope::view(text, owner));
+                return std::string(text);
+            }
+            case TAG_REF: {
+                uint64_t id = varint();
+                if (id >= tables.size()) fail("reference to unknown table");
+                return tables[id];
+            }
+            case TAG_TABLE: return readTable(depth);
+            default: fail("unknown value tag");
+        }
+    }
+
+    Value readTable(int depth) {
+        if (depth >= MAX_DEPTH) fail("tables nested too deeply");
+        // 先登记再读字段, 字段中对它自身的引用 (环) 才能解析
+        auto table = std::make_shared<Table>();
+        tables.push_back(table);
+
+        uint64_t count = varint();
+        if (count > data.size() - pos) fail("field count runs past end of data");
+        for (uint64_t k = 0; k < count; k++) {
+            std::string key(bytes());
+            Value value = read(depth + 1);
+            table->set(std::move(key), std::move(value));
+        }
+
+        Value metatable = read(depth + 1);
+        if (auto* meta = std::get_if<std::shared_ptr<Table>>(&metatable)) {
+            table->metatable = *meta;
+        } else if (!std::holds_alternative<std::nullptr_t>(metatable)) {
+            fail("metatable is not a table");
+        }
+        return table;
+    }
+};
+
+// ---- JSON ----
+
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string& out) : out(out) {}
+
+    void write(const Value& value, int depth) {
+        if (const double* number = std::get_if<double>(&value)) {
+            writeNumber(*number);
+        } else if (const std::string* text = std::get_if<std::string>(&value)) {
+            out += '"';
+            appendEscaped(out, *text, [](size_t) { return -1; });
+            out += '"';
+        } else if (const bool* flag = std::get_if<bool>(&value)) {
+            out += *flag ? "true" : "false";
+        } else if (const auto* rope = std::get_if<std::shared_ptr<Rope>>(&value)) {
+            writeRope(**rope);
+        } else if (const auto* table = std::get_if<std::shared_ptr<Table>>(&value)) {
+            if (*table) writeTable(**table, depth);
+            else out += "null";
+        } else {
+            out += "null";
+        }
+    }
+
+private:
+    std::string& out;
+    std::unordered_set<const Table*> active; // 正在编码的表, 用来发现环
+
+    void writeNumber(double number) {
+        if (!std::isfinite(number)) {
+            out += "null";
+            return;
+        }
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), number);
+        out.append(buffer, result.ptr);
+    }
+
+    // 逐块转义, 跨块的 UTF-8 序列通过 at() 向后读取, 下一块跳过已经写出的字节
+    void writeRope(const Rope& rope) {
+        out += '"';
+        size_t offset = 0, skip = 0;
+        rope.visitChunks([&](std::string_view chunk) {
+            size_t used = std::min(skip, chunk.size());
+            skip -= used;
+            size_t end = offset + chunk.size();
+            skip += appendEscaped(out, chunk.substr(used), [&](size_t k) -> int {
+                return end + k < rope.length() ? static_cast<unsigned char>(rope.at(end + k)) : -1;
+            });
+            offset = end;
+        });
+        out += '"';
+    }
+
+    // 键恰好是 "1".."n" 时返回按下标排列的值, 否则返回空
+    static std::vector<const Value*> arrayElements(const Table& table) {
+        size_t n = table.fields.size();
+        std::vector<const Value*> elements(n, nullptr);
+        for (const auto& field : table.fields) {
+            const std::string& key = field.first;
+            if (key.empty() || key.size() > 19 || key[0] == '0') return {};
+            uint64_t index = 0;
+            for (char c : key) {
+                if (c < '0' || c > '9') return {};
+                index = index * 10 + (c - '0');
+            }
+            if (index > n) return {};
+            elements[index - 1] = &field.second;
+        }
+        return elements;
+    }
+
+    void writeTable(const Table& table, int depth) {
+        if (depth >= MAX_DEPTH) throw RuntimeError("table nesting too deep to encode");
+        if (!active.insert(&table).second) throw RuntimeError("cannot encode a cyclic table as JSON");
+
+        auto elements = arrayElements(table);
+        if (!elements.empty()) {
+            out += '[';
+            for (size_t k = 0; k < elements.size(); k++) {
+                if (k) out += ',';
+                write(*elements[k], depth + 1);
+            }
+            out += ']';
+        } else {
+            out += '{';
+            bool first = true;
+            for (const auto& field : table.fields) {
+                if (!first) out += ',';
+                first = false;
+                out += '"';
+                appendEscaped(out, field.first, [](size_t) { return -1; });
+                out += "\":";
+                write(field.second, depth + 1);
+            }
+            out += '}';
+        }
+
+        active.erase(&table);
+    }
+};
+
+// 校验和解析一趟完成。输入可以是整块内存, 也可以是分块读取的流;
+// 解析出的字符串和数字都复制到自己的缓冲区, 换块时不需要保留已经读过的输入
+class JsonReader {
+public:
+    explicit JsonReader(std::string_view text)
+        : start(text.data()), cur(text.data()), end(text.data() + text.size()) {}
+    explicit JsonReader(std::istream& in) : in(&in), buffer(STREAM_CHUNK, '\0') {}
+
+    int peek() {
+        if (cur == end && !fill()) return -1;
+        return static_cast<unsigned char>(*cur);
+    }
+
+    int next() {
+        int c = peek();
+        if (c >= 0) cur++;
+        return c;
+    }
+
+    void skipWhitespace() {
+        for (int c = peek(); c == ' ' || c == '\t' || c == '\n' || c == '\r'; c = peek()) cur++;
+    }
+
+    [[noreturn]] void fail(const std::string& why) const {
+        size_t offset = discarded + (cur - start);
+        throw RuntimeError("invalid JSON at offset " + std::to_string(offset) + ": " + why);
+    }
+
+    Value value(int depth) {
+        skipWhitespace();
+        int c = peek();
+        switch (c) {
+            case '{': return object(depth);
+            case '[': return array(depth);
+            case '"': {
+                cur++;
+                std::string text;
+                string(text);
+                return text;
+            }
+            case 't': literal("true"); return true;
+            case 'f': literal("false"); return false;
+            case 'n': literal("null"); return nullptr;
+            case -1: fail("unexpected end of input");
+            default:
+                if (c == '-' || (c >= '0' && c <= '9')) return number();
+                fail("unexpected character");
+        }
+    }
+
+private:
+    std::istream* in = nullptr;
+    std::string buffer;
+    const char* start = nullptr;
+    const char* cur = nullptr;
+    const char* end = nullptr;
+    size_t discarded = 0;
+
+    // 只在当前块读完时调用
+    bool fill() {
+        if (!in) return false;
+        discarded += end - start;
+        in->read(&buffer[0], buffer.size());
+        size_t count = static_cast<size_t>(in->gcount());
+        start = cur = buffer.data();
+        end = start + count;
+        return count > 0;
+    }
+
+    Value object(int depth) {
+        if (depth >= MAX_DEPTH) fail("nesting too deep");
+        cur++;
+        auto table = std::make_shared<Table>();
+        skipWhitespace();
+        if (peek() == '}') {
+            cur++;
+            return table;
+        }
+        for (;;) {
+            skipWhitespace();
+            if (next() != '"') fail("expected string key");
+            std::string key;
+            string(key);
+            skipWhitespace();
+            if (next() != ':') fail("expected ':'");
+            table->set(std::move(key), value(depth + 1));
+            skipWhitespace();
+            int c = next();
+            if (c == ',') continue;
+            if (c == '}') return table;
+            fail("expected ',' or '}'");
+        }
+    }
+
+    Value array(int depth) {
+        if (depth >= MAX_DEPTH) fail("nesting too deep");
+        cur++;
+        auto table = std::make_shared<Table>();
+        skipWhitespace();
+        if (peek() == ']') {
+            cur++;
+            return table;
+        }
+        for (size_t index = 1;; index++) {
+            table->set(std::to_string(index), value(depth + 1));
+            skipWhitespace();
+            int c = next();
+            if (c == ',') continue;
+            if (c == ']') return table;
+            fail("expected ',' or ']'");
+        }
+    }
+
+    // 开头的引号已经读过
+    void string(std::string& out) {
+        for (;;) {
+            if (cur == end && !fill()) fail("unterminated string");
+
+            // 向量化扫描跳过普通字符, 整段复制
+            std::string_view chunk(cur, end - cur);
+            size_t special = StringKernels::scanJsonString(chunk);
+            if (special == StringKernels::npos) {
+                out.append(cur, chunk.size());
+                cur = end;
+                continue;
+            }
+            out.append(cur, special);
+            cur += special;
+
+            unsigned char c = static_cast<unsigned char>(*cur++);
+            if (c == '"') return;
+            if (c == '\\') {
+                escape(out);
+                continue;
+            }
+            if (c < 0x20) fail("control character in string");
+
+            // 非 ASCII 字节: 校验 UTF-8 序列, 序列可能跨越两块输入
+            unsigned char sequence[4] = {c};
+            size_t have = 1;
+            auto byteAt = [&](size_t k) -> int {
+                while (have <= k) {
+                    int b = peek();
+                    if (b < 0 || (b & 0xC0) != 0x80) return -1;
+                    sequence[have++] = static_cast<unsigned char>(b);
+                    cur++;
+                }
+                return sequence[k];
+            };
+            size_t length = utf8Length(byteAt);
+            if (length == 0) fail("invalid UTF-8 in string");
+            out.append(reinterpret_cast<const char*>(sequence), length);
+        }
+    }
+
+    uint32_t hex4() {
+        uint32_t value = 0;
+        for (int k = 0; k < 4; k++) {
+            int c = next();
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else fail("invalid \\u escape");
+        }
+        return value;
+    }
+
+    void escape(std::string& out) {
+        int c = next();
+        switch (c) {
+            case '"': case '\\': case '/': out += static_cast<char>(c); return;
+            case 'b': out += '\b'; return;
+            case 'f': out += '\f'; return;
+            case 'n': out += '\n'; return;
+            case 'r': out += '\r'; return;
+            case 't': out += '\t'; return;
+            case 'u': break;
+            default: fail("invalid escape");
+        }
+
+        uint32_t cp = hex4();
+        if (cp >= 0xD800 && cp <= 0xDBFF) {
+            if (next() != '\\' || next() != 'u') fail("unpaired surrogate");
+            uint32_t low = hex4();
+            if (low < 0xDC00 || low > 0xDFFF) fail("unpaired surrogate");
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+        } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            fail("unpaired surrogate");
+        }
+        appendUtf8(out, cp);
+    }
+
+    static bool numberChar(char c) {
+        return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+    }
+
+    // 校验 [p, e) 是否恰好是一个 JSON 数字
+    static bool validNumber(const char* p, const char* e) {
+        auto digits = [&]() {
+            const char* first = p;
+            while (p < e && *p >= '0' && *p <= '9') p++;
+            return p > first;
+        };
+        if (p < e && *p == '-') p++;
+        if (p < e && *p == '0') p++;
+        else if (!digits()) return false;
+        if (p < e && *p == '.') {
+            p++;
+            if (!digits()) return false;
+        }
+        if (p < e && (*p == 'e' || *p == 'E')) {
+            p++;
+            if (p < e && (*p == '+' || *p == '-')) p++;
+            if (!digits()) return false;
+        }
+        return p == e;
+    }
+
+    static double parseNumber(const char* p, const char* e) {
+        double number = 0;
+        auto result = std::from_chars(p, e, number);
+        // 超出 double 范围时 from_chars 不写结果, 交给 strtod 给出无穷大或零
+        if (result.ec == std::errc::result_out_of_range) number = std::strtod(std::string(p, e).c_str(), nullptr);
+        return number;
+    }
+
+    Value number() {
+        // 数字完整地落在当前块里时直接在输入上解析, 不复制
+        const char* last = cur;
+        while (last < end && numberChar(*last)) last++;
+        if (last < end) {
+            if (!validNumber(cur, last)) fail("invalid number");
+            double number = parseNumber(cur, last);
+            cur = last;
+            return number;
+        }
+
+        std::string token;
+        auto digits = [&]() {
+            size_t count = 0;
+            for (int c = peek(); c >= '0' && c <= '9'; c = peek()) {
+                token += static_cast<char>(c);
+                cur++;
+                count++;
+            }
+            return count;
+        };
+
+        if (peek() == '-') token += static_cast<char>(next());
+        if (peek() == '0') token += static_cast<char>(next());
+        else if (digits() == 0) fail("invalid number");
+        if (peek() == '.') {
+            token += static_cast<char>(next());
+            if (digits() == 0) fail("invalid number");
+        }
+        if (peek() == 'e' || peek() == 'E') {
+            token += static_cast<char>(next());
+            if (peek() == '+' || peek() == '-') token += static_cast<char>(next());
+            if (digits() == 0) fail("invalid number");
+        }
+
+        return parseNumber(token.data(), token.data() + token.size());
+    }
+
+    void literal(const char* word) {
+        for (const char* p = word; *p; p++) {
+            if (next() != *p) fail("invalid literal");
+        }
+    }
+};
+
+} // namespace
+
+std::string TableCodec::encodeBinary(const Value& value) {
+    std::string out(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+    out += static_cast<char>(BINARY_VERSION);
+    BinaryWriter(out).write(value, 0);
+    return out;
+}
+
+Value TableCodec::decodeBinary(std::string_view data) {
+    return BinaryReader(data).document();
+}
+
+Value TableCodec::decodeBinary(std::string_view data, std::shared_ptr<const void> owner, size_t borrowFrom) {
+    return BinaryReader(data, std::move(owner), borrowFrom).document();
+}
+
+std::string TableCodec::encodeJson(const Value& value) {
+    std::string out;
+    JsonWriter(out).write(value, 0);
+    return out;
+}
+
+Value TableCodec::decodeJson(std::string_view text) {
+    JsonReader reader(text);
+    Value value = reader.value(0);
+    reader.skipWhitespace();
+    if (reader.peek() != -1) reader.fail("trailing characters");
+    return value;
+}
+
+size_t TableCodec::decodeJsonArray(std::istream& in, const std::function<void(Value)>& onElement) {
+    JsonReader reader(in);
+    reader.skipWhitespace();
+    if (reader.next() != '[') reader.fail("expected '[' at start of array document");
+
+    size_t count = 0;
+    reader.skipWhitespace();
+    if (reader.peek() == ']') {
+        reader.next();
+    } else {
+        for (;;) {
+            onElement(reader.value(1));
+            count++;
+            reader.skipWhitespace();
+            int c = reader.next();
+            if (c == ',') continue;
+            if (c == ']') break;
+            reader.fail("expected ',' or ']'");
+        }
+    }
+
+    reader.skipWhitespace();
+    if (reader.peek() != -1) reader.fail("trailing characters");
+    return count;
+}
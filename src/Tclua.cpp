@@ -1,16 +1,20 @@
 #include "Tclua.h"
-#include "Tokenizer.h"
-#include <sstream>
+#include "Image.h"
 
 void Tclua::execute(const std::string& script) {
-    std::istringstream iss(script);
-    std::string line;
-    currentLine = 0;
+    MemoryAccount::Scope scope(memoryAccount.get());
+    std::shared_ptr<const CompiledScript> compiled;
+    try {
+        compiled = compileScript(script);
+    } catch (const InterpreterException& e) {
+        std::cerr << "Error: " << e.fullMessage() << std::endl;
+        return;
+    }
     
-    while (std::getline(iss, line)) {
-        currentLine++;
+    for (const auto& entry : compiled->commands) {
+        currentLine = entry.first;
         try {
-            execute_line(line);
+            execute_compiled(*entry.second);
         } catch (const InterpreterException& e) {
             std::cerr << "Error: " << e.fullMessage() << std::endl;
             if (e.getLine() == -1) std::cerr << "  At line: " << currentLine << std::endl;
@@ -20,11 +24,106 @@ void Tclua::execute(const std::string& script) {
     }
 }
 
+Value Tclua::evaluate(const std::string& script) {
+    return evaluateScript(script, false);
+}
+
+Value Tclua::evaluateScript(const std::string& script, bool tail) {
+    MemoryAccount::Scope scope(memoryAccount.get());
+    auto compiled = compileScript(script);
+    return run(*compiled, tail);
+}
+
+Value Tclua::run(const CompiledScript& compiled, bool tail) {
+    MemoryAccount::Scope scope(memoryAccount.get());
+    Value result = std::string();
+    
+    for (size_t i = 0; i < compiled.commands.size(); i++) {
+        // 先释放上一条命令的结果, 避免它额外持有 append 正在修改的 rope
+        result = std::string();
+        result = execute_compiled(*compiled.commands[i].second, tail && i + 1 == compiled.commands.size());
+    }
+    return result;
+}
+
+Value Tclua::invoke(const std::string& name, const std::vector<Value>& args) {
+    MemoryAccount::Scope scope(memoryAccount.get());
+    if (!cmdHandler.hasCommand(name)) {
+        throw RuntimeError("invalid command name \"" + name + "\"");
+    }
+    cmdHandler.setLineNumber(currentLine);
+    cmdHandler.setTailPosition(false);
+    return cmdHandler.executeCommand(name, args);
+}
+
+std::shared_ptr<const CompiledScript> Tclua::compileScript(const std::string& script) {
+    auto it = compiledScripts.find(script);
+    if (it != compiledScripts.end()) return it->second;
+    
+    auto compiled = CompiledScript::compile(script, [this](const std::string& line) { return compile(line); });
+    if (compiledScripts.size() >= MAX_COMPILED_COMMANDS) {
+        compiledScripts.clear();
+        memoryAccount->release(MemoryAccount::CODE, compiledScriptBytes);
+        compiledScriptBytes = 0;
+    }
+    memoryAccount->charge(MemoryAccount::CODE, compiled->codeBytes);
+    compiledScriptBytes += compiled->codeBytes;
+    compiledScripts.emplace(script, compiled);
+    return compiled;
+}
+
+std::shared_ptr<const CompiledCommand> Tclua::compile(const std::string& line) {
+    auto it = compiledCommands.find(line);
+    if (it != compiledCommands.end()) return it->second;
+    
+    auto compiled = CompiledCommand::compile(line, currentLine);
+    if (compiledCommands.size() >= MAX_COMPILED_COMMANDS) {
+        compiledCommands.clear();
+        memoryAccount->release(MemoryAccount::CODE, compiledCommandBytes);
+        compiledCommandBytes = 0;
+    }
+    memoryAccount->charge(MemoryAccount::CODE, compiled->codeBytes);
+    compiledCommandBytes += compiled->codeBytes;
+    compiledCommands.emplace(line, compiled);
+    return compiled;
+}
+
 Value Tclua::execute_line(const std::string& line) {
-    auto tokens = Tokenizer::tokenize(line, currentLine);
-    if (tokens.empty()) return 0.0;
+    return execute_compiled(*compile(line));
+}
+
+Value Tclua::execute_compiled(const CompiledCommand& command, bool tail) {
+    if (command.words.empty()) return 0.0;
+    
+    auto evalCommand = [this](const std::string& script) { return evaluate(script); };
+    std::string cmd = command.words[0]->render(varManager, evalCommand, currentLine);
+    std::vector<Value> args;
+    args.reserve(command.words.size() - 1);
+    for (size_t i = 1; i < command.words.size(); i++) {
+        args.push_back(command.words[i]->evaluate(varManager, evalCommand, currentLine));
+    }
     
     cmdHandler.setLineNumber(currentLine);
-    std::vector<std::string> args(tokens.begin() + 1, tokens.end());
-    return cmdHandler.executeCommand(tokens[0], args);
+    cmdHandler.setTailPosition(tail);
+    cmdHandler.setCommandWords(&command);
+    return cmdHandler.executeCommand(cmd, args);
+}
+
+void Tclua::saveImage(const std::string& path) {
+    MemoryAccount::Scope scope(memoryAccount.get());
+    if (!callStack.empty()) {
+        throw RuntimeError("cannot save an image while a procedure is running");
+    }
+    auto root = std::make_shared<Table>();
+    cmdHandler.exportState(*root);
+    Image::write(path, root);
+}
+
+void Tclua::loadImage(const std::string& path) {
+    MemoryAccount::Scope scope(memoryAccount.get());
+    if (!callStack.empty()) {
+        throw RuntimeError("cannot load an image while a procedure is running");
+    }
+    auto root = Image::read(path);
+    cmdHandler.importState(*root);
 }
@@ -1,20 +1,238 @@
 #include "Tokenizer.h"
-#include <sstream>
 #include <algorithm>
 #include <cctype>
 
+namespace {
+
+// 跳过一个配对的括号块, 返回右括号之后的位置(未闭合时返回末尾)
+size_t skipBalanced(const std::string& input, size_t pos, char open, char close) {
+    int depth = 0;
+    while (pos < input.length()) {
+        char c = input[pos];
+        if (c == '\\' && pos + 1 < input.length()) {
+            pos += 2;
+            continue;
+        }
+        if (c == open) depth++;
+        else if (c == close && --depth == 0) return pos + 1;
+        pos++;
+    }
+    return pos;
+}
+
+// 跳过命令替换, 返回右方括号之后的位置(未闭合时返回末尾)
+size_t skipCommand(const std::string& input, size_t pos) {
+    size_t close = Tokenizer::matchBracket(input, pos);
+    return close == std::string::npos ? input.length() : close + 1;
+}
+
+size_t skipQuoted(const std::string& input, size_t pos) {
+    pos++;
+    while (pos < input.length() && input[pos] != '"') {
+        if (input[pos] == '\\' && pos + 1 < input.length()) {
+            pos += 2;
+        } else if (input[pos] == '[') {
+            pos = skipCommand(input, pos);
+        } else {
+            pos++;
+        }
+    }
+    return pos < input.length() ? pos + 1 : pos;
+}
+
+size_t skipBare(const std::string& input, size_t pos) {
+    while (pos < input.length() && !isspace(static_cast<unsigned char>(input[pos]))) {
+        char c = input[pos];
+        if (c == '\\' && pos + 1 < input.length()) {
+            pos += 2;
+        } else if (c == '[') {
+            pos = skipCommand(input, pos);
+        } else if (c == '$' && pos + 1 < input.length() && input[pos + 1] == '{') {
+            pos = skipBalanced(input, pos + 1, '{', '}');
+        } else {
+            pos++;
+        }
+    }
+    return pos;
+}
+
+// 移除常见的标点符号, 保留命名空间分隔符 "::"
+void stripPunctuation(std::string& token) {
+    std::string result;
+    result.reserve(token.length());
+    for (size_t i = 0; i < token.length(); i++) {
+        char c = token[i];
+        if (c == ':' && i + 1 < token.length() && token[i + 1] == ':') {
+            result += "::";
+            i++;
+            continue;
+        }
+        if (c == ',' || c == ';' || c == ':') continue;
+        result += c;
+    }
+    token.swap(result);
+}
+
+bool needsBraces(const std::string& element) {
+    if (element.empty()) return true;
+    for (char c : element) {
+        if (isspace(static_cast<unsigned char>(c)) || c == '{' || c == '}' || c == '[' ||
+            c == ']' || c == '$' || c == '"' || c == '\\' || c == ';') {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool bracesBalanced(const std::string& element) {
+    if (element.empty()) return true;
+    int depth = 0;
+    for (char c : element) {
+        if (c == '{') depth++;
+        else if (c == '}' && --depth < 0) return false;
+    }
+    return depth == 0 && element.back() != '\\';
+}
+
+} // namespace
+
 std::vector<std::string> Tokenizer::tokenize(const std::string& input, int line) {
-    std::istringstream iss(input);
     std::vector<std::string> tokens;
-    std::string token;
+    size_t pos = 0;
+
+    while (pos < input.length()) {
+        if (isspace(static_cast<unsigned char>(input[pos]))) {
+            pos++;
+            continue;
+        }
+        // 行首的 # 为注释
+        if (tokens.empty() && input[pos] == '#') break;
+
+        size_t start = pos;
+        char c = input[pos];
+        if (c == '{') {
+            pos = skipBalanced(input, pos, '{', '}');
+        } else if (c == '"') {
+            pos = skipQuoted(input, pos);
+        } else {
+            pos = skipBare(input, pos);
+        }
+
+        std::string token = input.substr(start, pos - start);
+        // 只由标点组成的单词(如 split 的分隔符)保持原样
+        std::string original = token;
+        if (c != '{' && c != '"' && c != '[') stripPunctuation(token);
+        tokens.push_back(token.empty() ? original : token);
+    }
+
+    return tokens;
+}
+
+bool Tokenizer::isComplete(const std::string& input) {
+    int braces = 0, brackets = 0;
+    bool quoted = false;
     
-    while (iss >> token) {
-        // 移除常见的标点符号
-        token.erase(std::remove_if(token.begin(), token.end(), 
-                   [](char c) { return c == ',' || c == ';' || c == ':'; }), 
-                   token.end());
-        tokens.push_back(token);
+    for (size_t i = 0; i < input.length(); i++) {
+        char c = input[i];
+        if (c == '\\') {
+            i++;
+            continue;
+        }
+        if (braces > 0) {
+            if (c == '{') braces++;
+            else if (c == '}') braces--;
+        } else if (c == '{') {
+            braces++;
+        } else if (c == '[') {
+            brackets++;
+        } else if (c == ']' && brackets > 0) {
+            brackets--;
+        } else if (c == '"' && brackets == 0) {
+            quoted = !quoted;
+        }
     }
+    return braces == 0 && brackets == 0 && !quoted;
+}
+
+size_t Tokenizer::matchBracket(const std::string& input, size_t pos, size_t end) {
+    end = std::min(end, input.length());
+    int depth = 0;
+    bool wordStart = true;
+    while (pos < end) {
+        char c = input[pos];
+        if (c == '\\' && pos + 1 < end) {
+            pos += 2;
+            wordStart = false;
+            continue;
+        }
+        if (wordStart && (c == '{' || c == '"')) {
+            // 与 tokenize 一致: 只有单词开头的大括号和引号才括起整个单词
+            pos = c == '{' ? skipBalanced(input, pos, '{', '}') : skipQuoted(input, pos);
+            wordStart = false;
+            continue;
+        }
+        if (c == '$' && pos + 1 < end && input[pos + 1] == '{') {
+            pos = skipBalanced(input, pos + 1, '{', '}');
+            wordStart = false;
+            continue;
+        }
+        if (c == '[') {
+            depth++;
+            wordStart = true;
+        } else if (c == ']') {
+            if (--depth == 0) return pos;
+            wordStart = false;
+        } else {
+            wordStart = isspace(static_cast<unsigned char>(c)) || c == ';';
+        }
+        pos++;
+    }
+    return std::string::npos;
+}
+
+std::vector<std::string> Tokenizer::splitList(const std::string& list) {
+    std::vector<std::string> elements;
+    size_t pos = 0;
     
-    return tokens;
-}
\ No newline at end of file
+    while (pos < list.length()) {
+        if (isspace(static_cast<unsigned char>(list[pos]))) {
+            pos++;
+            continue;
+        }
+        size_t start = pos;
+        char c = list[pos];
+        if (c == '{') {
+            pos = skipBalanced(list, pos, '{', '}');
+            elements.push_back(list.substr(start + 1, pos - start - 2));
+        } else if (c == '"') {
+            pos = skipQuoted(list, pos);
+            elements.push_back(list.substr(start + 1, pos - start - 2));
+        } else {
+            pos = skipBare(list, pos);
+            elements.push_back(list.substr(start, pos - start));
+        }
+    }
+    
+    return elements;
+}
+
+std::string Tokenizer::joinList(const std::vector<std::string>& elements) {
+    std::string result;
+    for (const auto& element : elements) {
+        if (!result.empty()) result += ' ';
+        if (!needsBraces(element)) {
+            result += element;
+        } else if (bracesBalanced(element)) {
+            result += '{' + element + '}';
+        } else {
+            for (char c : element) {
+                if (isspace(static_cast<unsigned char>(c)) || c == '{' || c == '}' || c == '[' ||
+                    c == ']' || c == '$' || c == '"' || c == '\\' || c == ';') {
+                    result += '\\';
+                }
+                result += c;
+            }
+        }
+    }
+    return result;
+}
@@ -1,16 +1,75 @@
 #include "VariableManager.h"
 #include "InterpreterException.h"
+#include "MemoryAccount.h"
 
-VariableManager::VariableManager(CallStack& cs) : callStack(cs) {}
+namespace {
 
-void VariableManager::set(const std::string& name, const Value& value, int line) {
+// 全局变量表中一个条目的固定开销
+size_t variableBytes(const std::string& name) {
+    return MemoryAccount::MAP_NODE_BYTES + 2 * sizeof(std::string) + MemoryAccount::footprint(name);
+}
+
+// 变量名 (表字段取表名部分) 是否是 ns::name 形式的限定名, 限定名总是全局变量
+bool isQualified(const std::string& name) {
+    size_t pos = name.find("::");
+    return pos != std::string::npos && pos < name.find_first_of(".(");
+}
+
+} // namespace
+
+VariableManager::VariableManager(CallStack& cs, MemoryAccount* account) : callStack(cs), account(account) {}
+
+VariableManager::~VariableManager() {
+    if (!account) return;
+    for (const auto& entry : variables) {
+        account->release(MemoryAccount::STRINGS,
+                         MemoryAccount::footprint(entry.second.value) + variableBytes(entry.first));
+    }
+}
+
+VariableManager::NamespaceScope::NamespaceScope(VariableManager& vm, const std::string& ns, bool topLevel)
+    : vm(vm), savedNamespace(vm.currentNamespace), savedDepth(vm.namespaceDepth) {
+    vm.currentNamespace = ns;
+    vm.namespaceDepth = topLevel ? vm.callStack.depth() : static_cast<size_t>(-1);
+}
+
+VariableManager::NamespaceScope::~NamespaceScope() {
+    vm.currentNamespace = std::move(savedNamespace);
+    vm.namespaceDepth = savedDepth;
+}
+
+std::string VariableManager::qualify(const std::string& name) const {
+    if (isQualified(name)) return name;
+    std::string qualified = currentNamespace + "::" + name;
+    if (atNamespaceTop()) return qualified;
+    // 命名空间内的过程: 命名空间里已有的变量优先于同名全局变量
+    size_t field = name.find_first_of(".(");
+    std::string base = field == std::string::npos ? qualified : qualified.substr(0, currentNamespace.length() + 2 + field);
+    return variables.count(base) ? qualified : name;
+}
+
+bool VariableManager::loadModuleOf(const std::string& name) const {
+    if (!moduleLoader) return false;
+    size_t pos = name.rfind("::", name.find_first_of(".("));
+    if (pos == std::string::npos || pos == 0) return false;
+    return moduleLoader(name.substr(0, pos));
+}
+
+void VariableManager::set(const std::string& rawName, const Value& value, int line, int upvalue) {
+    if (upvalue >= 0 && callStack.setUpvalue(upvalue, value)) return;
+    
     // 先检查局部变量
-    auto localValue = callStack.getLocal(name);
-    if (!std::holds_alternative<std::nullptr_t>(localValue)) {
-        callStack.setLocal(name, value);
+    if (!atNamespaceTop() && callStack.findLocal(rawName)) {
+        callStack.setLocal(rawName, value);
         return;
     }
     
+    std::string scoped;
+    const std::string& name = currentNamespace.empty() ? rawName : (scoped = qualify(rawName));
+    bool qualified = isQualified(name);
+    // 写入未执行模块的变量之前先执行模块体, 避免之后被模块体覆盖
+    if (qualified && !variables.count(name.substr(0, name.find_first_of(".(")))) loadModuleOf(name);
+    
     // 处理表字段
     size_t dotPos = name.find('.');
     size_t parenPos = name.find('(');
@@ -19,18 +78,7 @@ void VariableManager::set(const std::string& name, const Value& value, int line)
         std::string tableName = name.substr(0, dotPos);
         std::string fieldName = name.substr(dotPos + 1);
         
-        if (variables.find(tableName) == variables.end() || 
-            !variables[tableName].isTableField) {
-            variables[tableName] = {
-                std::make_shared<Table>(),
-                true,
-                tableName,
-                ""
-            };
-        }
-        
-        auto table = std::get<std::shared_ptr<Table>>(variables[tableName].value);
-        table->set(fieldName, value);
+        tableVariable(tableName)->set(fieldName, value);
         return;
     }
     
@@ -38,31 +86,57 @@ void VariableManager::set(const std::string& name, const Value& value, int line)
         std::string tableName = name.substr(0, parenPos);
         std::string fieldName = name.substr(parenPos + 1, name.length() - parenPos - 2);
         
-        if (variables.find(tableName) == variables.end() || 
-            !variables[tableName].isTableField) {
-            variables[tableName] = {
-                std::make_shared<Table>(),
-                true,
-                tableName,
-                ""
-            };
+        tableVariable(tableName)->set(fieldName, value);
+        return;
+    }
+    
+    // 过程内新建的普通变量属于当前帧, 已有的全局变量仍然按全局变量更新
+    if (!qualified && !callStack.empty() && variables.find(name) == variables.end()) {
+        callStack.setLocal(name, value);
+        return;
+    }
+    
+    size_t bytes = MemoryAccount::footprint(value);
+    auto it = variables.find(name);
+    if (it != variables.end()) {
+        if (account) {
+            account->charge(MemoryAccount::STRINGS, bytes);
+            account->release(MemoryAccount::STRINGS, MemoryAccount::footprint(it->second.value));
         }
-        
-        auto table = std::get<std::shared_ptr<Table>>(variables[tableName].value);
-        table->set(fieldName, value);
+        it->second = {value, false, "", ""};
         return;
     }
+    if (account) account->charge(MemoryAccount::STRINGS, bytes + variableBytes(name));
+    variables.emplace(name, Variable{value, false, "", ""});
+}
+
+std::shared_ptr<Table> VariableManager::tableVariable(const std::string& tableName) {
+    auto it = variables.find(tableName);
+    if (it != variables.end() && it->second.isTableField) {
+        return std::get<std::shared_ptr<Table>>(it->second.value);
+    }
     
-    variables[name] = {value, false, "", ""};
+    auto table = std::make_shared<Table>();
+    if (it == variables.end()) {
+        if (account) account->charge(MemoryAccount::STRINGS, variableBytes(tableName));
+        variables.emplace(tableName, Variable{table, true, tableName, ""});
+    } else {
+        if (account) account->release(MemoryAccount::STRINGS, MemoryAccount::footprint(it->second.value));
+        it->second = {table, true, tableName, ""};
+    }
+    return table;
 }
 
-Value VariableManager::get(const std::string& name, int line) const {
+Value VariableManager::get(const std::string& rawName, int line) const {
     // 先检查局部变量
-    auto localValue = callStack.getLocal(name);
-    if (!std::holds_alternative<std::nullptr_t>(localValue)) {
-        return localValue;
+    if (!atNamespaceTop()) {
+        if (const Value* local = callStack.findLocal(rawName)) return *local;
     }
     
+    std::string scoped;
+    const std::string& name = currentNamespace.empty() ? rawName : (scoped = qualify(rawName));
+    if (isQualified(name) && !variables.count(name.substr(0, name.find_first_of(".(")))) loadModuleOf(name);
+    
     // 处理表字段
     size_t dotPos = name.find('.');
     size_t parenPos = name.find('(');
@@ -73,7 +147,7 @@ Value VariableManager::get(const std::string& name, int line) const {
         
         auto it = variables.find(tableName);
         if (it == variables.end() || !it->second.isTableField) {
-            throw UndefinedVariable(name, line);
+            throw UndefinedVariable(rawName, line);
         }
         
         auto table = std::get<std::shared_ptr<Table>>(it->second.value);
@@ -86,7 +160,7 @@ Value VariableManager::get(const std::string& name, int line) const {
         
         auto it = variables.find(tableName);
         if (it == variables.end() || !it->second.isTableField) {
-            throw UndefinedVariable(name, line);
+            throw UndefinedVariable(rawName, line);
         }
         
         auto table = std::get<std::shared_ptr<Table>>(it->second.value);
@@ -95,7 +169,7 @@ Value VariableManager::get(const std::string& name, int line) const {
     
     auto it = variables.find(name);
     if (it == variables.end()) {
-        throw UndefinedVariable(name, line);
+        throw UndefinedVariable(rawName, line);
     }
     return it->second.value;
 }
@@ -103,3 +177,73 @@ Value VariableManager::get(const std::string& name, int line) const {
 bool VariableManager::exists(const std::string& name) const {
     return variables.find(name) != variables.end();
 }
+
+void VariableManager::exportGlobals(Table& globals, Table& fieldTables) const {
+    for (const auto& entry : variables) {
+        globals.set(entry.first, entry.second.value);
+        if (entry.second.isTableField) fieldTables.set(entry.first, true);
+    }
+}
+
+void VariableManager::importGlobals(const Table& globals, const Table& fieldTables) {
+    for (const auto& entry : globals.fields) {
+        bool tableField = fieldTables.fields.count(entry.first) &&
+                          std::holds_alternative<std::shared_ptr<Table>>(entry.second);
+        Variable variable{entry.second, tableField, tableField ? entry.first : "", ""};
+        size_t bytes = MemoryAccount::footprint(entry.second);
+        auto it = variables.find(entry.first);
+        if (it != variables.end()) {
+            if (account) {
+                account->charge(MemoryAccount::STRINGS, bytes);
+                account->release(MemoryAccount::STRINGS, MemoryAccount::footprint(it->second.value));
+            }
+            it->second = std::move(variable);
+            continue;
+        }
+        if (account) account->charge(MemoryAccount::STRINGS, bytes + variableBytes(entry.first));
+        variables.emplace(entry.first, std::move(variable));
+    }
+}
+
+const Value* VariableManager::lookup(const std::string& name) const {
+    if (!currentNamespace.empty()) {
+        // 命名空间内按 get 的规则解析, 未执行的模块由 get 负责加载
+        if (!atNamespaceTop()) {
+            if (const Value* local = callStack.findLocal(name)) return local;
+        }
+        auto it = variables.find(qualify(name));
+        if (it == variables.end() || it->second.isTableField) return nullptr;
+        return &it->second.value;
+    }
+    if (const Value* local = callStack.findLocal(name)) {
+        return local;
+    }
+    auto it = variables.find(name);
+    if (it == variables.end() || it->second.isTableField) return nullptr;
+    return &it->second.value;
+}
+
+const Value* VariableManager::lookup(const std::string& name, int symbol, int upvalue) const {
+    if (upvalue >= 0) {
+        if (const Value* cell = callStack.findUpvalue(upvalue)) return cell;
+    }
+    if (symbol < 0) return lookup(name);
+    // 限定名不会是局部变量, 第一次找到之后直接使用缓存的变量槽
+    size_t index = static_cast<size_t>(symbol);
+    if (index < slots.size() && slots[index]) {
+        return slots[index]->isTableField ? nullptr : &slots[index]->value;
+    }
+    auto it = variables.find(name);
+    if (it == variables.end()) return nullptr;
+    if (index >= slots.size()) slots.resize(index + 1, nullptr);
+    slots[index] = &it->second;
+    return it->second.isTableField ? nullptr : &it->second.value;
+}
+
+Value* VariableManager::lookup(const std::string& name) {
+    return const_cast<Value*>(static_cast<const VariableManager*>(this)->lookup(name));
+}
+
+Value* VariableManager::lookup(const std::string& name, int symbol, int upvalue) {
+    return const_cast<Value*>(static_cast<const VariableManager*>(this)->lookup(name, symbol, upvalue));
+}
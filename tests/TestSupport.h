@@ -0,0 +1,57 @@
+#ifndef TEST_SUPPORT_H
+#define TEST_SUPPORT_H
+
+#include <iostream>
+#include <string>
+
+// 测试程序共用的检查宏: 失败时打印位置并计数, 不中断后面的检查
+namespace test {
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+inline int finish() {
+    if (failures()) std::cerr << failures() << " check(s) failed" << std::endl;
+    return failures() ? 1 : 0;
+}
+
+} // namespace test
+
+#define CHECK(condition)                                                                        \
+    do {                                                                                        \
+        if (!(condition)) {                                                                     \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+            test::failures()++;                                                                 \
+        }                                                                                       \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                                              \
+    do {                                                                                        \
+        auto actualValue = (actual);                                                            \
+        auto expectedValue = (expected);                                                        \
+        if (!(actualValue == expectedValue)) {                                                  \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": " #actual " == " << actualValue      \
+                      << ", expected " << expectedValue << std::endl;                           \
+            test::failures()++;                                                                 \
+        }                                                                                       \
+    } while (0)
+
+// 表达式应当抛出 Exception 类型的异常
+#define CHECK_THROWS(expression, Exception)                                                     \
+    do {                                                                                        \
+        bool thrown = false;                                                                    \
+        try {                                                                                   \
+            (void)(expression);                                                                 \
+        } catch (const Exception&) {                                                            \
+            thrown = true;                                                                      \
+        }                                                                                       \
+        if (!thrown) {                                                                          \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": expected " #Exception " from "       \
+                      << #expression << std::endl;                                              \
+            test::failures()++;                                                                 \
+        }                                                                                       \
+    } while (0)
+
+#endif // TEST_SUPPORT_H
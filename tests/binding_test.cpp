@@ -0,0 +1,56 @@
+#include "Tclua.h"
+#include "TestSupport.h"
+#include <cmath>
+#include <cstdint>
+
+namespace {
+
+// 整数参数的范围检查必须在 double 上精确进行: 2^63 不能被当成 int64_t 的最大值放过
+void integerBoundaries() {
+    Tclua interp;
+    const double twoTo63 = std::ldexp(1.0, 63);
+    
+    interp.setVariable("x", twoTo63);
+    CHECK_THROWS(interp.variable<int64_t>("x"), RuntimeError);
+    CHECK_EQ(interp.variable<uint64_t>("x"), uint64_t(1) << 63);
+    
+    interp.setVariable("x", -twoTo63);
+    CHECK_EQ(interp.variable<int64_t>("x"), INT64_MIN);
+    CHECK_THROWS(interp.variable<uint64_t>("x"), RuntimeError);
+    
+    interp.setVariable("x", std::ldexp(1.0, 64));
+    CHECK_THROWS(interp.variable<uint64_t>("x"), RuntimeError);
+    interp.setVariable("x", -twoTo63 - 2048.0);  // 小于 -2^63 的下一个 double
+    CHECK_THROWS(interp.variable<int64_t>("x"), RuntimeError);
+    
+    interp.setVariable("x", 2147483647.0);
+    CHECK_EQ(interp.variable<int32_t>("x"), INT32_MAX);
+    interp.setVariable("x", 2147483648.0);
+    CHECK_THROWS(interp.variable<int32_t>("x"), RuntimeError);
+    interp.setVariable("x", -2147483648.0);
+    CHECK_EQ(interp.variable<int32_t>("x"), INT32_MIN);
+    interp.setVariable("x", -2147483649.0);
+    CHECK_THROWS(interp.variable<int32_t>("x"), RuntimeError);
+    interp.setVariable("x", 256.0);
+    CHECK_THROWS(interp.variable<uint8_t>("x"), RuntimeError);
+    interp.setVariable("x", -1.0);
+    CHECK_THROWS(interp.variable<uint8_t>("x"), RuntimeError);
+    interp.setVariable("x", 1.5);
+    CHECK_THROWS(interp.variable<int64_t>("x"), RuntimeError);
+}
+
+void boundCommandArguments() {
+    Tclua interp;
+    interp.bind("half", [](int64_t value) { return value / 2; });
+    CHECK_THROWS(interp.evaluate("half 9223372036854775808\n"), RuntimeError);
+    CHECK_EQ(interp.call<int64_t>("half", -std::ldexp(1.0, 63)), INT64_MIN / 2);
+    CHECK_THROWS(interp.call<int64_t>("half", std::ldexp(1.0, 63)), RuntimeError);
+}
+
+} // namespace
+
+int main() {
+    integerBoundaries();
+    boundCommandArguments();
+    return test::finish();
+}
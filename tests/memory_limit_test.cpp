@@ -0,0 +1,128 @@
+#include "Tclua.h"
+#include "TestSupport.h"
+
+namespace {
+
+std::string eval(Tclua& interp, const std::string& script) {
+    return ExpressionParser::valueToString(interp.evaluate(script));
+}
+
+// 填满硬限制的循环, 处理程序清空表后解释器应当可以继续执行
+const char* FILL = R"(set i 0
+set caught 0
+try {
+    while 1 {
+        set t.k$i [string repeat x 50]
+        incr i
+    }
+} catch e {
+    set caught 1
+    set message $e
+    set t {}
+}
+)";
+
+void catchesHardLimitInline() {
+    Tclua interp;
+    interp.memory().setLimits(0, 300000);
+    interp.evaluate(FILL);
+    CHECK_EQ(eval(interp, "set caught"), std::string("1"));
+    CHECK(eval(interp, "set message").find("memory limit of 300000 bytes exceeded") != std::string::npos);
+    
+    // 表已经释放, 之后的命令照常分配
+    CHECK_EQ(eval(interp, "set s [string repeat y 1000]\nstring length $s"), std::string("1000"));
+    CHECK(interp.memory().stats().total <= 300000);
+    CHECK(interp.memory().stats().peak <= 300000 + MemoryAccount::RESERVE_BYTES);
+}
+
+void catchesHardLimitInProcHandler() {
+    Tclua interp;
+    interp.memory().setLimits(0, 300000);
+    // 处理程序是预先定义的过程, 调用它要压入新的帧
+    interp.evaluate("proc h {msg} {\n    set caught 1\n    set t {}\n    return $msg\n}\n");
+    interp.evaluate(R"(set i 0
+set caught 0
+try {
+    while 1 {
+        set t.k$i [string repeat x 50]
+        incr i
+    }
+} catch e {
+    h $e
+}
+)");
+    CHECK_EQ(eval(interp, "set caught"), std::string("1"));
+    CHECK_EQ(eval(interp, "set u [string repeat z 10]"), std::string("zzzzzzzzzz"));
+}
+
+void handlerThatKeepsMemoryFails() {
+    Tclua interp;
+    interp.memory().setLimits(0, 300000);
+    // 处理程序没有释放内存, 结束后仍然越过限制时错误继续向外传播
+    CHECK_THROWS(interp.evaluate(R"(set i 0
+try {
+    while 1 {
+        set t.k$i [string repeat x 50]
+        incr i
+    }
+} catch e {
+    set keep [string repeat k 2000]
+}
+)"), MemoryLimitError);
+    CHECK(interp.memory().stats().peak <= 300000 + MemoryAccount::RESERVE_BYTES);
+}
+
+void appendStaysUnderLimit() {
+    Tclua interp;
+    interp.memory().setLimits(0, 400000);
+    // 每个变量停在 LEAF_SIZE 以下, 一直是按容量翻倍增长的普通字符串
+    CHECK_THROWS(interp.evaluate(R"(set k 0
+while 1 {
+    set n 0
+    while {$n < 50} {
+        append s$k [string repeat a 37]
+        incr n
+    }
+    incr k
+}
+)"), MemoryLimitError);
+    // 追加时扩容留出的空余容量不能让用量越过硬限制
+    CHECK(interp.memory().stats().peak <= 400000);
+}
+
+void softLimitReArmsBelowNinetyPercent() {
+    MemoryAccount account;
+    account.setLimits(1000, 0);
+    account.charge(MemoryAccount::STRINGS, 990);
+    CHECK_THROWS(account.charge(MemoryAccount::STRINGS, 20), MemoryLimitError);
+    // 回退少量内存后不会立即再次触发
+    account.release(MemoryAccount::STRINGS, 10);
+    account.charge(MemoryAccount::STRINGS, 20);
+    account.release(MemoryAccount::STRINGS, 200);
+    CHECK_THROWS(account.charge(MemoryAccount::STRINGS, 300), MemoryLimitError);
+}
+
+void repeatCountCannotOverflow() {
+    Tclua interp;
+    interp.memory().setLimits(0, 300000);
+    // 长度乘积溢出 size_t 后会绕回一个很小的数, 不能因此通过限制检查
+    CHECK_THROWS(interp.evaluate("string repeat abcd 4611686018427387905\n"), MemoryLimitError);
+    CHECK_THROWS(interp.evaluate("string repeat ab 9223372036854775807\n"), MemoryLimitError);
+    
+    Tclua unlimited;
+    CHECK_THROWS(unlimited.evaluate("string repeat abcd 4611686018427387905\n"), MemoryLimitError);
+    CHECK_EQ(eval(unlimited, "string repeat {} 9223372036854775807"), std::string());
+    CHECK_EQ(eval(unlimited, "string repeat ab 3"), std::string("ababab"));
+}
+
+} // namespace
+
+int main() {
+    catchesHardLimitInline();
+    catchesHardLimitInProcHandler();
+    handlerThatKeepsMemoryFails();
+    appendStaysUnderLimit();
+    softLimitReArmsBelowNinetyPercent();
+    repeatCountCannotOverflow();
+    return test::finish();
+}
@@ -0,0 +1,84 @@
+#include "Tclua.h"
+#include "TestSupport.h"
+#include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <unistd.h>
+
+namespace {
+
+std::string eval(Tclua& interp, const std::string& script) {
+    return ExpressionParser::valueToString(interp.evaluate(script));
+}
+
+bool onSearchPath(const std::string& dir) {
+    auto paths = ModuleRegistry::instance().searchPath();
+    return std::find(paths.begin(), paths.end(), dir) != paths.end();
+}
+
+void scriptsCannotChangeSearchPath() {
+    Tclua interp;
+    // 搜索路径对进程内所有解释器生效, 脚本只能查询
+    CHECK_THROWS(interp.evaluate("module -path /tmp/tclua-test-elsewhere\n"), RuntimeError);
+    CHECK(!onSearchPath("/tmp/tclua-test-elsewhere"));
+    CHECK(!eval(interp, "module -path").empty());
+    
+    Tclua::addModulePath("/tmp/tclua-test-host");
+    CHECK(onSearchPath("/tmp/tclua-test-host"));
+}
+
+void rejectsNamesOutsideSearchPath() {
+    CHECK(ModuleRegistry::isValidName("geo"));
+    CHECK(ModuleRegistry::isValidName("geo::point"));
+    CHECK(!ModuleRegistry::isValidName(""));
+    CHECK(!ModuleRegistry::isValidName("../../etc/x"));
+    CHECK(!ModuleRegistry::isValidName(".."));
+    CHECK(!ModuleRegistry::isValidName("a::..::b"));
+    CHECK(!ModuleRegistry::isValidName("/etc/passwd"));
+    CHECK(!ModuleRegistry::isValidName("a/b"));
+    CHECK(!ModuleRegistry::isValidName("a::::b"));
+    CHECK(!ModuleRegistry::isValidName("::a"));
+    CHECK(!ModuleRegistry::isValidName("a::"));
+    CHECK(!ModuleRegistry::isValidName("a:::b"));
+    
+    Tclua interp;
+    CHECK_THROWS(interp.evaluate("import ../../etc/x\n"), RuntimeError);
+    CHECK_THROWS(interp.evaluate("import /etc/passwd\n"), RuntimeError);
+    CHECK_THROWS(interp.evaluate("import a::::b\n"), RuntimeError);
+    CHECK(ModuleRegistry::instance().find("../../etc/x") == nullptr);
+}
+
+void importsFromHostPath() {
+    char dir[] = "/tmp/tclua-module-XXXXXX";
+    CHECK(mkdtemp(dir) != nullptr);
+    {
+        std::ofstream out(std::string(dir) + "/modtestmath.tcl");
+        out << "proc twice {x} {\n    return [expr {$x * 2}]\n}\nset answer 42\n";
+    }
+    // 搜索路径之外的同名文件不能通过 .. 访问到
+    std::string outside = std::string(dir) + "/../modtestoutside.tcl";
+    {
+        std::ofstream out(outside);
+        out << "set leaked 1\n";
+    }
+    Tclua::addModulePath(dir);
+    
+    Tclua interp;
+    interp.evaluate("import modtestmath\n");
+    CHECK_EQ(eval(interp, "twice 21"), std::string("42"));
+    CHECK_EQ(eval(interp, "set modtestmath::answer"), std::string("42"));
+    CHECK_THROWS(interp.evaluate("import ..::modtestoutside\n"), RuntimeError);
+    
+    std::remove((std::string(dir) + "/modtestmath.tcl").c_str());
+    std::remove(outside.c_str());
+    rmdir(dir);
+}
+
+} // namespace
+
+int main() {
+    scriptsCannotChangeSearchPath();
+    rejectsNamesOutsideSearchPath();
+    importsFromHostPath();
+    return test::finish();
+}
@@ -0,0 +1,105 @@
+#include "Regex.h"
+#include "InterpreterException.h"
+#include "TestSupport.h"
+#include <regex>
+#include <random>
+#include <iostream>
+
+namespace {
+
+// 用 std::regex (ECMAScript, 同样是最左优先) 求参考答案, 未参与的分组为 (-1, -1)
+bool reference(const std::regex& re, const std::string& text, size_t start, Regex::Captures& captures) {
+    std::smatch match;
+    auto flags = start > 0 ? std::regex_constants::match_prev_avail : std::regex_constants::match_default;
+    if (!std::regex_search(text.begin() + start, text.end(), match, re, flags)) return false;
+    captures.clear();
+    for (size_t g = 0; g < match.size(); g++) {
+        if (!match[g].matched) {
+            captures.emplace_back(-1, -1);
+        } else {
+            captures.emplace_back(match[g].first - text.begin(), match[g].second - text.begin());
+        }
+    }
+    return true;
+}
+
+std::string describe(const Regex::Captures& captures) {
+    std::string out;
+    for (const auto& span : captures) {
+        out += " (" + std::to_string(span.first) + "," + std::to_string(span.second) + ")";
+    }
+    return out;
+}
+
+// 随机拼出的模式与 std::regex 比较是否匹配以及每个分组的位置。
+// 分组不放在量词内层的量词分组里, 避免 ECMAScript 每轮清空内层分组带来的差异
+void agreesWithStdRegex() {
+    std::mt19937 rng(42);
+    const char* atoms[] = {"a", "b", "c", ".", "[ab]", "[^a]", "(a)", "(b|c)", "(a*)", "(ab)+", "a?", "b*?",
+                           "(a|ab)", "(c?)", "(a|b)*", "x", "(?:ab|a)", "a{1,3}", "(b{2})", "a+?", "[bc]+"};
+    const int atomCount = sizeof(atoms) / sizeof(atoms[0]);
+    int compared = 0, mismatches = 0;
+    for (int iter = 0; iter < 3000; iter++) {
+        std::string pattern;
+        int length = 1 + rng() % 4;
+        for (int i = 0; i < length; i++) pattern += atoms[rng() % atomCount];
+        if (rng() % 5 == 0) pattern = "(" + pattern + ")|" + atoms[rng() % atomCount];
+        if (rng() % 6 == 0) pattern = "^" + pattern;
+        if (rng() % 6 == 0) pattern += "$";
+        std::string text;
+        int textLength = rng() % 24;
+        for (int i = 0; i < textLength; i++) text += "abcx"[rng() % 4];
+        
+        Regex regex(pattern);
+        std::regex expected(pattern, std::regex::ECMAScript);
+        for (size_t start = 0; start <= text.size(); start += 1 + rng() % 3) {
+            Regex::Captures got, want;
+            bool matched = regex.exec(text, start, got);
+            bool wanted = reference(expected, text, start, want);
+            compared++;
+            if (matched != wanted || (matched && got != want) || regex.search(text, start) != wanted) {
+                if (mismatches++ < 10) {
+                    std::cerr << "pattern " << pattern << " text \"" << text << "\" start " << start << ": got"
+                              << (matched ? describe(got) : " no match") << ", expected"
+                              << (wanted ? describe(want) : " no match") << "\n";
+                }
+            }
+        }
+    }
+    CHECK_EQ(mismatches, 0);
+    CHECK(compared > 10000);
+}
+
+// 反向 DFA 曾经给出错误的起点, 回溯执行器在错误的区间内产生越出匹配范围的分组
+void capturesStayInsideMatch() {
+    struct Case {
+        const char* pattern;
+        const char* text;
+        Regex::Captures expected;
+    };
+    const Case cases[] = {
+        {"b*?b*?a", "bacc", {{0, 2}}},
+        {"(b*?)(b*?)a", "bacc", {{0, 2}, {0, 0}, {0, 1}}},
+        {"(b*?)(b*)a", "cbbacc", {{1, 4}, {1, 1}, {1, 3}}},
+        {"(a|ab)(c|bcd)", "abcd", {{0, 4}, {0, 1}, {1, 4}}},
+        {"x*(a+?)(a*)", "xxaaa", {{0, 5}, {2, 3}, {3, 5}}},
+    };
+    for (const auto& c : cases) {
+        Regex regex(c.pattern);
+        Regex::Captures captures;
+        CHECK(regex.exec(c.text, 0, captures));
+        CHECK_EQ(describe(captures), describe(c.expected));
+        for (const auto& span : captures) {
+            if (span.first < 0) continue;
+            CHECK(span.first >= captures[0].first && span.second <= captures[0].second);
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    agreesWithStdRegex();
+    capturesStayInsideMatch();
+    return test::finish();
+}
@@ -0,0 +1,190 @@
+#include "StringKernels.h"
+#include "TestSupport.h"
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <iostream>
+
+namespace {
+
+// 逐字节的参考实现, 与向量化内核对比
+
+bool inSet(std::string_view chars, unsigned char c) {
+    return chars.find(static_cast<char>(c)) != std::string_view::npos;
+}
+
+size_t refFirstOf(std::string_view text, std::string_view chars, size_t from, bool negate) {
+    for (size_t i = from; i < text.size(); i++) {
+        if (inSet(chars, text[i]) != negate) return i;
+    }
+    return StringKernels::npos;
+}
+
+size_t refLastNotOf(std::string_view text, std::string_view chars) {
+    for (size_t i = text.size(); i-- > 0;) {
+        if (!inSet(chars, text[i])) return i;
+    }
+    return StringKernels::npos;
+}
+
+std::vector<std::string> refSplit(std::string_view text, std::string_view chars) {
+    std::vector<std::string> result;
+    if (text.empty()) return result;
+    std::string field;
+    for (char c : text) {
+        if (chars.empty()) {
+            result.emplace_back(1, c);
+        } else if (inSet(chars, c)) {
+            result.push_back(field);
+            field.clear();
+        } else {
+            field += c;
+        }
+    }
+    if (!chars.empty()) result.push_back(field);
+    return result;
+}
+
+std::string refTrim(std::string_view text, std::string_view chars, bool left, bool right) {
+    size_t begin = 0, end = text.size();
+    while (left && begin < end && inSet(chars, text[begin])) begin++;
+    while (right && end > begin && inSet(chars, text[end - 1])) end--;
+    return std::string(text.substr(begin, end - begin));
+}
+
+std::string refMap(std::string_view text, const std::vector<std::pair<std::string, std::string>>& mapping) {
+    std::string result;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        bool replaced = false;
+        for (const auto& entry : mapping) {
+            if (!entry.first.empty() && text.substr(pos, entry.first.size()) == entry.first) {
+                result += entry.second;
+                pos += entry.first.size();
+                replaced = true;
+                break;
+            }
+        }
+        if (!replaced) result += text[pos++];
+    }
+    return result;
+}
+
+size_t refScanJson(std::string_view text, size_t from) {
+    for (size_t i = from; i < text.size(); i++) {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\' || c < 0x20 || c >= 0x80) return i;
+    }
+    return StringKernels::npos;
+}
+
+std::mt19937 rng(7);
+
+// 大部分字节取自很小的字母表以便产生匹配, 偶尔出现 JSON 需要转义的字节
+std::string randomText(size_t length, bool special) {
+    std::string text;
+    for (size_t i = 0; i < length; i++) {
+        unsigned r = rng() % 64;
+        if (special && r == 0) {
+            const char bytes[] = {'"', '\\', '\n', '\x01', '\x7f', '\x80', '\xff'};
+            text += bytes[rng() % sizeof(bytes)];
+        } else {
+            text += "abcd "[r % 5];
+        }
+    }
+    return text;
+}
+
+// 覆盖向量宽度 (16, 32) 附近的长度, 以及比一个向量块更长的输入
+const size_t LENGTHS[] = {0, 1, 2, 7, 15, 16, 17, 31, 32, 33, 47, 48, 63, 64, 65, 100};
+
+// 每种长度都从缓冲区的各个偏移开始取, 起点和尾部都不对齐
+template <typename Check>
+void forEachView(bool special, Check check) {
+    for (size_t length : LENGTHS) {
+        for (int sample = 0; sample < 8; sample++) {
+            std::string buffer = randomText(length + 32, special);
+            for (size_t offset = 0; offset < 32; offset++) {
+                check(std::string_view(buffer).substr(offset, length));
+            }
+        }
+    }
+}
+
+void checkIsa() {
+    const char* forced = std::getenv("TCLUA_ISA");
+    std::string isa = StringKernels::isaName();
+    std::cout << "isa " << isa << "\n";
+    if (forced && std::strcmp(forced, "scalar") == 0) CHECK_EQ(isa, std::string("scalar"));
+    if (forced && std::strcmp(forced, "sse4.2") == 0) CHECK(isa != "avx2");
+}
+
+void findMatchesReference() {
+    forEachView(false, [](std::string_view text) {
+        for (size_t m = 0; m <= 5; m++) {
+            // 针取自文本末尾时一定有匹配, 覆盖落在尾部的命中
+            std::string needle = m <= text.size() && rng() % 2 ? std::string(text.substr(text.size() - m))
+                                                                : randomText(m, false);
+            size_t from = rng() % (text.size() + 2);
+            CHECK_EQ(StringKernels::find(text, needle, from), text.find(needle, from));
+            CHECK_EQ(StringKernels::find(text, needle), text.find(needle));
+            CHECK_EQ(StringKernels::rfind(text, needle, from), text.rfind(needle, from));
+            CHECK_EQ(StringKernels::rfind(text, needle), text.rfind(needle));
+        }
+    });
+}
+
+void charSetScansMatchReference() {
+    // 1 到 20 个字符, 超过 16 个时走位图查表
+    const std::string pool = "abcd efghijklmnopqrstuvwxyz";
+    forEachView(false, [&](std::string_view text) {
+        size_t size = 1 + rng() % 20;
+        std::string chars;
+        for (size_t i = 0; i < size; i++) chars += pool[rng() % pool.size()];
+        StringKernels::CharSet set(chars);
+        for (int c = 0; c < 256; c++) CHECK_EQ(set.contains(c), inSet(chars, c));
+        
+        size_t from = rng() % (text.size() + 1);
+        CHECK_EQ(StringKernels::findFirstOf(text, set, from), refFirstOf(text, chars, from, false));
+        CHECK_EQ(StringKernels::findFirstNotOf(text, set, from), refFirstOf(text, chars, from, true));
+        CHECK_EQ(StringKernels::findLastNotOf(text, set), refLastNotOf(text, chars));
+        CHECK(StringKernels::split(text, set) == refSplit(text, chars));
+        for (int mode = 1; mode <= 3; mode++) {
+            bool left = mode & 1, right = mode & 2;
+            CHECK_EQ(std::string(StringKernels::trim(text, set, left, right)), refTrim(text, chars, left, right));
+        }
+    });
+    
+    StringKernels::CharSet empty("");
+    CHECK(StringKernels::split("abc", empty) == refSplit("abc", ""));
+    StringKernels::CharSet nocase("aZ", true);
+    CHECK(nocase.contains('A') && nocase.contains('a') && nocase.contains('Z') && nocase.contains('z'));
+    CHECK(!nocase.contains('b'));
+}
+
+void mapMatchesReference() {
+    const std::vector<std::pair<std::string, std::string>> mapping = {
+        {"ab", "<AB>"}, {"a", "1"}, {"dd", ""}, {" ", "_"}, {"cab", "never"}};
+    forEachView(false, [&](std::string_view text) {
+        CHECK_EQ(StringKernels::map(text, mapping), refMap(text, mapping));
+    });
+}
+
+void scanJsonMatchesReference() {
+    forEachView(true, [](std::string_view text) {
+        for (size_t from = 0; from <= text.size(); from += 1 + rng() % 7) {
+            CHECK_EQ(StringKernels::scanJsonString(text, from), refScanJson(text, from));
+        }
+    });
+}
+
+} // namespace
+
+int main() {
+    checkIsa();
+    findMatchesReference();
+    charSetScansMatchReference();
+    mapMatchesReference();
+    scanJsonMatchesReference();
+    return test::finish();
+}
@@ -0,0 +1,38 @@
+#include "Tclua.h"
+#include "TestSupport.h"
+
+namespace {
+
+std::string eval(Tclua& interp, const std::string& script) {
+    return ExpressionParser::valueToString(interp.evaluate(script));
+}
+
+void lastIgnoresMatchesStraddlingLastIndex() {
+    Tclua interp;
+    CHECK_EQ(eval(interp, "string last bc abcabc"), std::string("4"));
+    // "bc" 在 4..5, lastIndex 为 4 时只跨了一半, 不应该算
+    CHECK_EQ(eval(interp, "string last bc abcabc 4"), std::string("1"));
+    CHECK_EQ(eval(interp, "string last bc abcabc 5"), std::string("4"));
+    CHECK_EQ(eval(interp, "string last bc abcabc end"), std::string("4"));
+    CHECK_EQ(eval(interp, "string last bc abcabc end-1"), std::string("1"));
+    CHECK_EQ(eval(interp, "string last bc abcabc 2"), std::string("1"));
+    CHECK_EQ(eval(interp, "string last bc abcabc 1"), std::string("-1"));
+    CHECK_EQ(eval(interp, "string last a abcabc 0"), std::string("0"));
+    CHECK_EQ(eval(interp, "string last abc ab 5"), std::string("-1"));
+    CHECK_EQ(eval(interp, "string last a abc -1"), std::string("-1"));
+}
+
+void firstStartsAtIndex() {
+    Tclua interp;
+    CHECK_EQ(eval(interp, "string first bc abcabc"), std::string("1"));
+    CHECK_EQ(eval(interp, "string first bc abcabc 2"), std::string("4"));
+    CHECK_EQ(eval(interp, "string first bc abcabc 5"), std::string("-1"));
+}
+
+} // namespace
+
+int main() {
+    lastIgnoresMatchesStraddlingLastIndex();
+    firstStartsAtIndex();
+    return test::finish();
+}